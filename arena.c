@@ -0,0 +1,125 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+static arenaBlock * newBlock(size_t start, size_t size)
+{
+    arenaBlock *b = (arenaBlock *)malloc(sizeof(arenaBlock));
+    if (!b) {
+        return NULL;
+    }
+    // MAP_NORESERVE: no swap is set aside, untouched pages cost nothing
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        free(b);
+        return NULL;
+    }
+    b->next = NULL;
+    b->base = (unsigned char *)base;
+    b->start = start;
+    b->size = size;
+    return b;
+}
+
+static void freeBlocks(arenaBlock *b)
+{
+    while (b) {
+        arenaBlock *next = b->next;
+        munmap(b->base, b->size);
+        free(b);
+        b = next;
+    }
+}
+
+arena * arenaNew(size_t reserve)
+{
+    arena *a = (arena *)malloc(sizeof(arena));
+    if (!a) {
+        return NULL;
+    }
+    if (!reserve) {
+        reserve = ARENA_ALIGN;
+    }
+    a->first = newBlock(0, reserve);
+    if (!a->first) {
+        free(a);
+        return NULL;
+    }
+    a->block = a->first;
+    a->reserved = reserve;
+    a->used = 0;
+    a->peak = 0;
+    a->allocs = 0;
+    return a;
+}
+
+void arenaFree(arena *a)
+{
+    if (!a) {
+        return;
+    }
+    freeBlocks(a->first);
+    free(a);
+}
+
+void * arenaAlloc(arena *a, size_t bytes)
+{
+    assert(a);
+    arenaBlock *b = a->block;
+    size_t offset = (a->used - b->start + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (offset > b->size || bytes > b->size - offset) {
+        // the rest of this block is skipped, blocks start page aligned
+        if (!b->next || b->next->size < bytes) {
+            size_t size = 2 * b->size;
+            if (size < bytes) {
+                size = bytes;
+            }
+            arenaBlock *next = newBlock(b->start + b->size, size);
+            if (!next) {
+                return NULL;
+            }
+            // later blocks too small for this are dropped, offsets stay increasing
+            arenaBlock *d;
+            for (d = b->next; d; d = d->next) {
+                a->reserved -= d->size;
+            }
+            a->reserved += size;
+            freeBlocks(b->next);
+            b->next = next;
+        }
+        b = a->block = b->next;
+        offset = 0;
+    }
+    a->used = b->start + offset + bytes;
+    if (a->used > a->peak) {
+        a->peak = a->used;
+    }
+    ++a->allocs;
+    return b->base + offset;
+}
+
+void arenaReset(arena *a)
+{
+    a->block = a->first;
+    a->used = 0;
+}
+
+size_t arenaMark(arena *a)
+{
+    return a->used;
+}
+
+void arenaRewind(arena *a, size_t mark)
+{
+    assert(mark <= a->used);
+    arenaBlock *b = a->first;
+    while (b->next && b->next->start <= mark) {
+        b = b->next;
+    }
+    // a mark at the very end of a block is also the start of the next
+    a->block = b;
+    a->used = mark;
+}
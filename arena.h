@@ -0,0 +1,45 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+typedef struct arenaBlock {
+    struct arenaBlock *next;
+    unsigned char *base;
+    size_t start;   // offset of base within the arena
+    size_t size;
+} arenaBlock;
+
+/*
+ * Bump allocator over reserved blocks. The first block is reserved up
+ * front and pages are only backed once touched; when an allocation
+ * doesn't fit, a block twice the size of the last is chained on, so a
+ * small first reservation is cheap and a large frame still fits. Blocks
+ * are kept across resets, a steady frame maps nothing new. Allocations
+ * are never freed one by one: the whole arena is reset in O(1), or
+ * rewound to a mark.
+ */
+typedef struct arena {
+    arenaBlock *first;
+    arenaBlock *block;  // the one allocations come from
+    size_t reserved;    // all blocks
+    size_t used;        // offset of the next free byte, across blocks
+    size_t peak;
+    unsigned long long allocs; // since creation
+} arena;
+
+#define ARENA_ALIGN 64 // cache line, also enough for any vector type
+
+// reserve is the size of the first block
+arena * arenaNew(size_t reserve);
+void arenaFree(arena *);
+
+// NULL when no block can be mapped
+void * arenaAlloc(arena *, size_t bytes);
+
+void arenaReset(arena *);
+
+size_t arenaMark(arena *);
+void arenaRewind(arena *, size_t mark);
+
+#endif // ARENA_H_
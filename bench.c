@@ -0,0 +1,611 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tga.h"
+#include "model.h"
+#include "raster.h"
+#include "context.h"
+#include "optimize.h"
+#include "ssao.h"
+#include "output.h"
+#include "stats.h"
+
+/*
+ * Benchmarks over the bundled assets. Every case runs `warmup` untimed
+ * iterations and then `trials` timed ones; the median is reported so a
+ * single noisy trial does not move the baseline.
+ */
+
+typedef void (*benchFn)(void *ctx);
+
+typedef struct benchCase {
+    const char *name;
+    benchFn setup; /* untimed, before every iteration, may be NULL */
+    benchFn run;
+    void *ctx;
+    double work;   /* units of work done by one run */
+    const char *unit;
+    double work2;  /* optional second throughput, 0 if unused */
+    const char *unit2;
+} benchCase;
+
+static int warmup = 2;
+static int trials = 10;
+static FILE *csv = NULL;
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void benchRun(benchCase *bc)
+{
+    int i;
+    double *t = (double *)malloc(trials * sizeof(double));
+    for (i = 0; i < warmup; ++i) {
+        if (bc->setup) {
+            bc->setup(bc->ctx);
+        }
+        bc->run(bc->ctx);
+    }
+    for (i = 0; i < trials; ++i) {
+        if (bc->setup) {
+            bc->setup(bc->ctx);
+        }
+        double start = statsWallTime();
+        bc->run(bc->ctx);
+        t[i] = statsWallTime() - start;
+    }
+    qsort(t, trials, sizeof(double), cmpDouble);
+    double median = t[trials / 2];
+    double best = t[0];
+
+    printf("%-24s %10.3f %10.3f %12.2f %-9s", bc->name, median * 1e3, best * 1e3,
+           bc->work / median, bc->unit);
+    if (bc->work2 > 0) {
+        printf(" %12.2f %s", bc->work2 / median, bc->unit2);
+    }
+    printf("\n");
+    if (csv) {
+        fprintf(csv, "%s,%.6f,%.6f,%.4f,%s,%.4f,%s\n", bc->name, median * 1e3, best * 1e3,
+                bc->work / median, bc->unit,
+                bc->work2 > 0 ? bc->work2 / median : 0.0, bc->work2 > 0 ? bc->unit2 : "");
+    }
+    free(t);
+}
+
+static long fileSize(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st)) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+/* loadFromObj */
+
+static void runLoadObj(void *ctx)
+{
+    Model *model = loadFromObj((const char *)ctx);
+    freeModel(model);
+}
+
+/* tgaLoadFromFile */
+
+static void runLoadTga(void *ctx)
+{
+    tgaImage *image = tgaLoadFromFile((const char *)ctx);
+    tgaFreeImage(image);
+}
+
+/* loadRLE, decoding from memory so disk speed is not measured */
+
+typedef struct rleCtx {
+    unsigned char *data;
+    size_t size;
+    size_t offset; /* first byte after the header */
+    FILE *stream;
+    tgaImage *image;
+} rleCtx;
+
+static void setupRLE(void *ctx)
+{
+    rleCtx *rc = (rleCtx *)ctx;
+    fseek(rc->stream, rc->offset, SEEK_SET);
+}
+
+static void runRLE(void *ctx)
+{
+    rleCtx *rc = (rleCtx *)ctx;
+    if (-1 == loadRLE(rc->image, rc->stream)) {
+        fprintf(stderr, "loadRLE failed\n");
+        exit(1);
+    }
+}
+
+/* product_mat */
+
+#define MAT_ITERATIONS (1 << 20)
+
+static void runProductMat(void *ctx)
+{
+    Mat4x4 m = {
+               {0.9, 0.1, 0.0, 0.1},
+               {-0.1, 0.9, 0.0, 0.2},
+               {0.0, 0.0, 1.0, 0.3},
+               {0.0, 0.0, -0.3, 1.0}
+               };
+    Mat4x1 a = {1.0, 2.0, 3.0, 1.0};
+    Mat4x1 b;
+    int i;
+    for (i = 0; i < MAT_ITERATIONS; i += 2) {
+        product_mat(m, a, &b);
+        product_mat(m, b, &a);
+        a[3] = 1.0;
+    }
+    *(volatile double *)ctx = a[0];
+}
+
+/* triangle over pre-transformed cat.obj faces */
+
+typedef struct faceSetup {
+    Vector a, b, c;
+    Vec3 *uva, *uvb, *uvc;
+    double I;
+} faceSetup;
+
+typedef struct triCtx {
+    Model *model;
+    tgaImage *image;
+    int *zbuffer;
+    faceSetup *faces;
+    unsigned int nface;
+} triCtx;
+
+static void setupTriangles(void *ctx)
+{
+    triCtx *tc = (triCtx *)ctx;
+    unsigned int i;
+    for (i = 0; i < tc->image->width * tc->image->height; ++i) {
+        tc->zbuffer[i] = -10000;
+    }
+}
+
+static void runTriangles(void *ctx)
+{
+    triCtx *tc = (triCtx *)ctx;
+    unsigned int i;
+    for (i = 0; i < tc->nface; ++i) {
+        faceSetup *f = &tc->faces[i];
+        triangle(tc->image, tc->model, f->a, f->b, f->c, *f->uva, *f->uvb, *f->uvc, f->I, tc->zbuffer);
+    }
+}
+
+static unsigned int prepareFaces(Model *model, tgaImage *image, faceSetup *faces)
+{
+    Vec3 light = { 0.0, 0.0, 1.0 };
+    Vector *screen = (Vector *)malloc(model->nvert * sizeof(Vector));
+    unsigned int i, k, n = 0;
+    projectVertices(image, model, screen);
+    for (i = 0; i < model->nface; ++i) {
+        faceSetup *f = &faces[n];
+        int *v[3] = { f->a, f->b, f->c };
+        for (k = 0; k < 3; ++k) {
+            memcpy(v[k], screen[getVertexIndex(model, i, k)], sizeof(Vector));
+        }
+        if (cull(image, f->a, f->b, f->c)) {
+            continue;
+        }
+        f->uva = getDiffuseUV(model, i, 0);
+        f->uvb = getDiffuseUV(model, i, 1);
+        f->uvc = getDiffuseUV(model, i, 2);
+        f->I = d_abs(intension(getVertex(model, i, 0), getVertex(model, i, 1), getVertex(model, i, 2), light));
+        ++n;
+    }
+    free(screen);
+    return n;
+}
+
+/* tgaSaveToFile */
+
+typedef struct saveCtx {
+    tgaImage *image;
+    const char *path;
+} saveCtx;
+
+static void runSave(void *ctx)
+{
+    saveCtx *sc = (saveCtx *)ctx;
+    if (-1 == tgaSaveToFile(sc->image, sc->path)) {
+        perror("tgaSaveToFile");
+        exit(1);
+    }
+}
+
+/* outputSave */
+
+typedef struct encodeCtx {
+    tgaImage *image;
+    const char *path;
+    int format;
+} encodeCtx;
+
+static void runEncode(void *ctx)
+{
+    encodeCtx *ec = (encodeCtx *)ctx;
+    if (-1 == outputSave(ec->image, ec->path, ec->format, 0, 0)) {
+        perror("outputSave");
+        exit(1);
+    }
+}
+
+/* end-to-end frame */
+
+typedef struct frameCtx {
+    Model *model;
+    tgaImage *image;
+} frameCtx;
+
+static void setupFrame(void *ctx)
+{
+    frameCtx *fc = (frameCtx *)ctx;
+    memset(fc->image->data, 0, fc->image->width * fc->image->height * fc->image->bpp);
+}
+
+static void runFrame(void *ctx)
+{
+    frameCtx *fc = (frameCtx *)ctx;
+    renderModel(fc->image, fc->model);
+}
+
+/* the same frame through a context kept across trials, buffers are reused */
+
+typedef struct contextFrameCtx {
+    Model *model;
+    renderContext *rc;
+    int shading;
+    modelEdges *edges;      // depth tested overlay when not NULL
+    const ssaoParams *ssao; // post pass after the resolve when not NULL
+} contextFrameCtx;
+
+static void setupContextFrame(void *ctx)
+{
+    contextFrameCtx *cc = (contextFrameCtx *)ctx;
+    renderClear(cc->rc, tgaRGB(0, 0, 0));
+}
+
+static void runContextFrame(void *ctx)
+{
+    contextFrameCtx *cc = (contextFrameCtx *)ctx;
+    renderDrawModel(cc->rc, cc->model, cc->shading);
+    if (cc->edges) {
+        renderDrawEdges(cc->rc, cc->model, cc->edges, tgaRGB(255, 255, 255), 1);
+    }
+    renderResolve(cc->rc);
+    if (cc->ssao) {
+        ssaoApply(cc->rc, cc->ssao);
+    }
+}
+
+/* locality reordering, in place: later runs see an already ordered mesh */
+
+static void runOptimize(void *ctx)
+{
+    optimizeModel((Model *)ctx);
+}
+
+/* one halving step of the LOD chain */
+
+static void runSimplify(void *ctx)
+{
+    Model *model = (Model *)ctx;
+    Model *level = simplifyModel(model, model->nface / 2);
+    if (level) {
+        freeModel(level);
+    }
+}
+
+/* a thumbnail of the model through its LOD chain */
+
+typedef struct lodFrameCtx {
+    modelLod *lod;
+    renderContext *rc;
+} lodFrameCtx;
+
+static void setupLodFrame(void *ctx)
+{
+    lodFrameCtx *lc = (lodFrameCtx *)ctx;
+    renderClear(lc->rc, tgaRGB(0, 0, 0));
+}
+
+static void runLodFrame(void *ctx)
+{
+    lodFrameCtx *lc = (lodFrameCtx *)ctx;
+    renderDrawLod(lc->rc, lc->lod, SHADING_FLAT);
+    renderResolve(lc->rc);
+}
+
+static char *assetPath(const char *dir, const char *name)
+{
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = (char *)malloc(len);
+    snprintf(path, len, "%s/%s", dir, name);
+    return path;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-d assetdir] [-t tmpdir] [-w warmup] [-n trials] [-o results.csv]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = ".";
+    const char *tmpdir = "/tmp";
+    const char *csv_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:t:w:n:o:")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg; break;
+        case 't': tmpdir = optarg; break;
+        case 'w': warmup = atoi(optarg); break;
+        case 'n': trials = atoi(optarg); break;
+        case 'o': csv_path = optarg; break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (trials < 1 || warmup < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) {
+            perror(csv_path);
+            return -1;
+        }
+        fprintf(csv, "name,median_ms,best_ms,throughput,unit,throughput2,unit2\n");
+    }
+
+    char *obj_path = assetPath(dir, "cat.obj");
+    char *diff_path = assetPath(dir, "cat_diff.tga");
+    char *norm_path = assetPath(dir, "cat_norm.tga");
+    char *out_path = assetPath(tmpdir, "render_bench.tga");
+
+    Model *model = loadFromObj(obj_path);
+    if (!model || !loadDiffuseMap(model, diff_path)) {
+        fprintf(stderr, "Can't load %s or %s\n", obj_path, diff_path);
+        return -1;
+    }
+
+    printf("%d warmup, %d trials\n", warmup, trials);
+    printf("%-24s %10s %10s %22s\n", "case", "median ms", "best ms", "throughput");
+
+    benchCase bc;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.name = "loadFromObj";
+    bc.run = runLoadObj;
+    bc.ctx = obj_path;
+    bc.work = fileSize(obj_path) / 1e6;
+    bc.unit = "MB/s";
+    bc.work2 = model->nface / 1e6;
+    bc.unit2 = "Mfaces/s";
+    benchRun(&bc);
+
+    memset(&bc, 0, sizeof(bc));
+    bc.name = "tgaLoadFromFile";
+    bc.run = runLoadTga;
+    bc.ctx = diff_path;
+    bc.work = fileSize(diff_path) / 1e6;
+    bc.unit = "MB/s";
+    benchRun(&bc);
+
+    rleCtx rc;
+    memset(&rc, 0, sizeof(rc));
+    FILE *fd = fopen(norm_path, "rb");
+    long size = fileSize(norm_path);
+    if (fd && size > 18) {
+        rc.size = size;
+        rc.data = (unsigned char *)malloc(rc.size);
+        if (1 == fread(rc.data, rc.size, 1, fd) && (rc.data[2] == 10 || rc.data[2] == 11)) {
+            unsigned int w = rc.data[12] | (rc.data[13] << 8);
+            unsigned int h = rc.data[14] | (rc.data[15] << 8);
+            rc.offset = 18 + rc.data[0];
+            rc.image = tgaNewImage(h, w, rc.data[16] >> 3);
+            rc.stream = fmemopen(rc.data, rc.size, "rb");
+        }
+        fclose(fd);
+    }
+    if (rc.stream) {
+        memset(&bc, 0, sizeof(bc));
+        bc.name = "loadRLE";
+        bc.setup = setupRLE;
+        bc.run = runRLE;
+        bc.ctx = &rc;
+        bc.work = rc.image->width * rc.image->height * rc.image->bpp / 1e6;
+        bc.unit = "MB/s";
+        benchRun(&bc);
+        fclose(rc.stream);
+        tgaFreeImage(rc.image);
+    } else {
+        fprintf(stderr, "Skipping loadRLE: %s is not an RLE tga\n", norm_path);
+    }
+    free(rc.data);
+
+    double sink;
+    memset(&bc, 0, sizeof(bc));
+    bc.name = "product_mat";
+    bc.run = runProductMat;
+    bc.ctx = &sink;
+    bc.work = MAT_ITERATIONS / 1e6;
+    bc.unit = "Mcalls/s";
+    benchRun(&bc);
+
+    triCtx tc;
+    tc.model = model;
+    tc.image = tgaNewImage(1000, 1000, RGB);
+    tc.zbuffer = (int *)malloc(1000 * 1000 * sizeof(int));
+    tc.faces = (faceSetup *)malloc(model->nface * sizeof(faceSetup));
+    tc.nface = prepareFaces(model, tc.image, tc.faces);
+    memset(&bc, 0, sizeof(bc));
+    bc.name = "triangle 1000x1000";
+    bc.setup = setupTriangles;
+    bc.run = runTriangles;
+    bc.ctx = &tc;
+    bc.work = tc.nface / 1e6;
+    bc.unit = "Mtri/s";
+    benchRun(&bc);
+    free(tc.faces);
+    free(tc.zbuffer);
+
+    saveCtx sc;
+    sc.image = tc.image;
+    sc.path = out_path;
+    memset(&bc, 0, sizeof(bc));
+    bc.name = "tgaSaveToFile";
+    bc.run = runSave;
+    bc.ctx = &sc;
+    bc.work = tc.image->width * tc.image->height * tc.image->bpp / 1e6;
+    bc.unit = "MB/s";
+    benchRun(&bc);
+
+    int i;
+    static const int formats[] = { OUTPUT_TGA_RLE, OUTPUT_PPM, OUTPUT_PNG, OUTPUT_PNG_STORED };
+    static const char *format_names[] = { "outputSave tga-rle", "outputSave ppm", "outputSave png", "outputSave png-stored" };
+    for (i = 0; i < 4; ++i) {
+        encodeCtx ec;
+        ec.image = tc.image;
+        ec.path = out_path;
+        ec.format = formats[i];
+        memset(&bc, 0, sizeof(bc));
+        bc.name = format_names[i];
+        bc.run = runEncode;
+        bc.ctx = &ec;
+        bc.work = tc.image->width * tc.image->height * tc.image->bpp / 1e6;
+        bc.unit = "MB/s";
+        benchRun(&bc);
+    }
+    unlink(out_path);
+    tgaFreeImage(tc.image);
+
+    static const unsigned int resolutions[] = { 256, 512, 1024, 2048 };
+    static char names[4][32];
+    for (i = 0; i < 4; ++i) {
+        frameCtx fc;
+        fc.model = model;
+        fc.image = tgaNewImage(resolutions[i], resolutions[i], RGB);
+        snprintf(names[i], sizeof(names[i]), "frame %ux%u", resolutions[i], resolutions[i]);
+        memset(&bc, 0, sizeof(bc));
+        bc.name = names[i];
+        bc.setup = setupFrame;
+        bc.run = runFrame;
+        bc.ctx = &fc;
+        bc.work = (double)resolutions[i] * resolutions[i] / 1e6;
+        bc.unit = "Mpix/s";
+        bc.work2 = model->nface / 1e6;
+        bc.unit2 = "Mtri/s";
+        benchRun(&bc);
+        tgaFreeImage(fc.image);
+    }
+
+    contextFrameCtx cc;
+    cc.model = model;
+    cc.rc = renderNewContext(1024, 1024, 1, DEPTH_DEFAULT);
+    cc.shading = SHADING_FLAT;
+    cc.edges = NULL;
+    cc.ssao = NULL;
+    memset(&bc, 0, sizeof(bc));
+    bc.name = "context 1024x1024";
+    bc.setup = setupContextFrame;
+    bc.run = runContextFrame;
+    bc.ctx = &cc;
+    bc.work = 1024.0 * 1024 / 1e6;
+    bc.unit = "Mpix/s";
+    bc.work2 = model->nface / 1e6;
+    bc.unit2 = "Mtri/s";
+    benchRun(&bc);
+
+    // lit per vertex, against flat above
+    cc.shading = SHADING_GOURAUD;
+    bc.name = "gouraud 1024x1024";
+    benchRun(&bc);
+    cc.shading = SHADING_FLAT;
+
+    // the same frame with its wireframe over it
+    cc.edges = wireEdges(model);
+    if (cc.edges) {
+        bc.name = "wireframe 1024x1024";
+        benchRun(&bc);
+        wireFreeEdges(cc.edges);
+        cc.edges = NULL;
+    }
+
+    // ambient occlusion on top, at half and at full resolution
+    ssaoParams ssao = { 0.05, 1.0, 0, 0 };
+    cc.ssao = &ssao;
+    bc.name = "ssao 1024x1024";
+    benchRun(&bc);
+    ssao.full = 1;
+    bc.name = "ssao full 1024x1024";
+    benchRun(&bc);
+    cc.ssao = NULL;
+    renderFreeContext(cc.rc);
+
+    memset(&bc, 0, sizeof(bc));
+    bc.name = "optimizeModel";
+    bc.run = runOptimize;
+    bc.ctx = model;
+    bc.work = model->nface / 1e6;
+    bc.unit = "Mfaces/s";
+    benchRun(&bc);
+
+    memset(&bc, 0, sizeof(bc));
+    bc.name = "simplifyModel";
+    bc.run = runSimplify;
+    bc.ctx = model;
+    bc.work = model->nface / 1e6;
+    bc.unit = "Mfaces/s";
+    benchRun(&bc);
+
+    lodFrameCtx lc;
+    Model *full = loadFromObj(obj_path);
+    lc.lod = full ? buildLod(full) : NULL;
+    lc.rc = renderNewContext(128, 128, 1, DEPTH_DEFAULT);
+    if (lc.lod && lc.rc) {
+        memset(&bc, 0, sizeof(bc));
+        bc.name = "lod 128x128";
+        bc.setup = setupLodFrame;
+        bc.run = runLodFrame;
+        bc.ctx = &lc;
+        bc.work = 128.0 * 128 / 1e6;
+        bc.unit = "Mpix/s";
+        benchRun(&bc);
+    } else {
+        fprintf(stderr, "Out of memory for the lod benchmark\n");
+    }
+    renderFreeContext(lc.rc);
+    if (lc.lod) {
+        freeLod(lc.lod);
+    } else if (full) {
+        freeModel(full);
+    }
+
+    freeModel(model);
+    renderModelRelease();
+    free(obj_path);
+    free(diff_path);
+    free(norm_path);
+    free(out_path);
+    if (csv) {
+        fclose(csv);
+    }
+    return 0;
+}
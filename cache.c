@@ -0,0 +1,222 @@
+#include "cache.h"
+#include "optimize.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+assetCache * cacheNew(size_t max_bytes)
+{
+    assetCache *cache = (assetCache *)calloc(1, sizeof(assetCache));
+    if (!cache) {
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->max_bytes = max_bytes;
+    return cache;
+}
+
+static void freeEntry(cacheEntry *entry)
+{
+    if (entry->kind == CACHE_MODEL) {
+        freeModel((Model *)entry->data);
+    } else if (entry->kind == CACHE_LOD) {
+        freeLod((modelLod *)entry->data);
+    } else {
+        tgaFreeImage((tgaImage *)entry->data);
+    }
+    free(entry->path);
+    free(entry);
+}
+
+void cacheFree(assetCache *cache)
+{
+    if (!cache) {
+        return;
+    }
+    cacheEntry *entry = cache->entries;
+    while (entry) {
+        cacheEntry *next = entry->next;
+        assert(entry->refs == 0);
+        freeEntry(entry);
+        entry = next;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+static size_t modelBytes(Model *model)
+{
+    size_t bytes = sizeof(Model);
+    bytes += (model->nvert + model->ntext + model->nnorm) * sizeof(Vec3);
+    bytes += model->nface * sizeof(Face);
+    if (model->tangents) {
+        bytes += 2 * (model->nface + 1) * sizeof(Vec3);
+    }
+    return bytes;
+}
+
+static void * loadEntry(int kind, const char *path, int optimize, size_t *bytes)
+{
+    if (kind == CACHE_MODEL || kind == CACHE_LOD) {
+        Model *model = loadModel(path);
+        if (!model) {
+            return NULL;
+        }
+        if (optimize && -1 == optimizeModel(model)) {
+            freeModel(model);
+            return NULL;
+        }
+        // tangents only depend on the geometry, compute them now so a shared
+        // model is never written to when a render adds a normal map
+        if (model->textures) {
+            computeTangents(model);
+        }
+        if (kind == CACHE_MODEL) {
+            *bytes = modelBytes(model);
+            return model;
+        }
+        // simplified once here, every job then only picks a level
+        modelLod *lod = buildLod(model);
+        if (!lod) {
+            freeModel(model);
+            return NULL;
+        }
+        unsigned int i;
+        *bytes = sizeof(modelLod);
+        for (i = 0; i < lod->nlevels; ++i) {
+            *bytes += modelBytes(lod->levels[i]);
+        }
+        return lod;
+    }
+    tgaImage *map = loadTextureMap(path);
+    if (!map) {
+        return NULL;
+    }
+    *bytes = sizeof(tgaImage) + (size_t)map->width * map->height * map->bpp;
+    return map;
+}
+
+static void unlinkEntry(assetCache *cache, cacheEntry *entry)
+{
+    cacheEntry **p = &cache->entries;
+    while (*p != entry) {
+        p = &(*p)->next;
+    }
+    *p = entry->next;
+    cache->bytes -= entry->bytes;
+}
+
+// drops least recently used entries nobody holds until the cache fits
+static void evict(assetCache *cache)
+{
+    while (cache->bytes > cache->max_bytes) {
+        cacheEntry *victim = NULL;
+        cacheEntry *entry;
+        for (entry = cache->entries; entry; entry = entry->next) {
+            if (!entry->refs && (!victim || entry->used < victim->used)) {
+                victim = entry;
+            }
+        }
+        if (!victim) {
+            return;
+        }
+        unlinkEntry(cache, victim);
+        freeEntry(victim);
+    }
+}
+
+static cacheEntry * lookup(assetCache *cache, int kind, const char *path, struct stat *st)
+{
+    cacheEntry *entry;
+    for (entry = cache->entries; entry; entry = entry->next) {
+        if (entry->kind != kind || entry->stale || strcmp(entry->path, path)) {
+            continue;
+        }
+        if (entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+            entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+            entry->size == st->st_size) {
+            return entry;
+        }
+        // the file changed on disk
+        entry->stale = 1;
+        if (!entry->refs) {
+            unlinkEntry(cache, entry);
+            freeEntry(entry);
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+cacheEntry * cacheGet(assetCache *cache, int kind, const char *path)
+{
+    struct stat st;
+    if (-1 == stat(path, &st)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cacheEntry *entry = lookup(cache, kind, path, &st);
+    if (entry) {
+        ++entry->refs;
+        entry->used = ++cache->tick;
+        ++cache->hits;
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+    ++cache->misses;
+    pthread_mutex_unlock(&cache->lock);
+
+    // parse without the lock, hits on other assets go on meanwhile
+    size_t bytes = 0;
+    void *data = loadEntry(kind, path, cache->optimize, &bytes);
+    if (!data) {
+        return NULL;
+    }
+    entry = (cacheEntry *)calloc(1, sizeof(cacheEntry));
+    assert(entry);
+    entry->kind = kind;
+    entry->path = strdup(path);
+    entry->mtime = st.st_mtim;
+    entry->size = st.st_size;
+    entry->data = data;
+    entry->bytes = bytes;
+
+    pthread_mutex_lock(&cache->lock);
+    cacheEntry *other = lookup(cache, kind, path, &st);
+    if (other) { // another thread loaded it first
+        ++other->refs;
+        other->used = ++cache->tick;
+        pthread_mutex_unlock(&cache->lock);
+        freeEntry(entry);
+        return other;
+    }
+    entry->refs = 1;
+    entry->used = ++cache->tick;
+    entry->next = cache->entries;
+    cache->entries = entry;
+    cache->bytes += bytes;
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+void cacheRelease(assetCache *cache, cacheEntry *entry)
+{
+    if (!entry) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    assert(entry->refs > 0);
+    if (!--entry->refs) {
+        if (entry->stale) {
+            unlinkEntry(cache, entry);
+            freeEntry(entry);
+        } else {
+            evict(cache);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,56 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include "tga.h"
+#include "model.h"
+#include "lod.h"
+
+enum cacheKind {
+    CACHE_MODEL,   // loadModel, tangents precomputed
+    CACHE_TEXTURE, // loadTextureMap
+    CACHE_LOD      // CACHE_MODEL simplified into a buildLod chain
+};
+
+/*
+ * One parsed file. Entries are shared between threads and read only once
+ * loaded; `refs` keeps an entry alive while a render uses it.
+ */
+typedef struct cacheEntry {
+    int kind;
+    char *path;
+    struct timespec mtime;
+    off_t size;               // file size, together with mtime detects changes
+    void *data;               // Model *, tgaImage * or modelLod *
+    size_t bytes;             // memory held by data
+    unsigned int refs;
+    int stale;                // file changed, dropped once refs reaches 0
+    unsigned long long used;  // tick of the last lookup, smallest is evicted first
+    struct cacheEntry *next;
+} cacheEntry;
+
+typedef struct assetCache {
+    pthread_mutex_t lock;
+    cacheEntry *entries;
+    size_t bytes;
+    size_t max_bytes;
+    int optimize;             // models are reordered with optimizeModel once loaded
+    unsigned long long tick;
+    unsigned long long hits;
+    unsigned long long misses;
+} assetCache;
+
+assetCache * cacheNew(size_t max_bytes);
+void cacheFree(assetCache *cache);
+
+/*
+ * Returns the entry for path, loading it when it isn't cached or the file
+ * changed since. NULL if the file can't be loaded. Every entry returned
+ * must be given back with cacheRelease.
+ */
+cacheEntry * cacheGet(assetCache *cache, int kind, const char *path);
+void cacheRelease(assetCache *cache, cacheEntry *entry);
+
+#endif // CACHE_H_
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Sends render jobs to renderd, see server.c for the protocol. With --repeat the
+ * same job is sent repeatedly on one connection, which shows the cost of a
+ * render once the assets are cached.
+ */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] model.obj|model.mesh diffuse.tga outfile.tga\n"
+                    "  --socket path          server socket (default /tmp/renderd.sock)\n"
+                    "  --repeat n             send the job n times\n"
+                    "  --shading mode         depth|flat|gouraud|phong\n"
+                    "  --normal-map file\n"
+                    "  --specular-map file\n"
+                    "  --size WxH\n"
+                    "  --msaa samples\n"
+                    "  --depth format\n"
+                    "  --lod\n"
+                    "  --eye x,y,z\n"
+                    "  --center x,y,z\n"
+                    "  --up x,y,z\n", prog);
+}
+
+/* the server has its own working directory */
+static void absolute(const char *path, char *out, size_t size)
+{
+    char cwd[PATH_MAX];
+    if (path[0] == '/' || !getcwd(cwd, sizeof(cwd))) {
+        snprintf(out, size, "%s", path);
+    } else {
+        snprintf(out, size, "%s/%s", cwd, path);
+    }
+}
+
+static void addPath(char *job, size_t size, const char *key, const char *path)
+{
+    char abs[PATH_MAX + 1];
+    absolute(path, abs, sizeof(abs));
+    size_t len = strlen(job);
+    snprintf(job + len, size - len, "%s %s\n", key, abs);
+}
+
+static void addValue(char *job, size_t size, const char *key, const char *value)
+{
+    size_t len = strlen(job);
+    snprintf(job + len, size - len, "%s %s\n", key, value);
+}
+
+/* "1,2,3" -> "1 2 3" */
+static void addVec3(char *job, size_t size, const char *key, const char *value)
+{
+    char v[256];
+    char *p;
+    snprintf(v, sizeof(v), "%s", value);
+    for (p = v; *p; ++p) {
+        if (*p == ',') {
+            *p = ' ';
+        }
+    }
+    addValue(job, size, key, v);
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_path = "/tmp/renderd.sock";
+    int repeat = 1;
+    char job[16384] = "";
+    char size[64];
+    static struct option long_options[] = {
+        {"socket",       required_argument, 0, 's'},
+        {"repeat",       required_argument, 0, 'r'},
+        {"shading",      required_argument, 0, 'S'},
+        {"normal-map",   required_argument, 0, 'n'},
+        {"specular-map", required_argument, 0, 'p'},
+        {"size",         required_argument, 0, 'z'},
+        {"msaa",         required_argument, 0, 'm'},
+        {"depth",        required_argument, 0, 'd'},
+        {"lod",          no_argument,       0, 'l'},
+        {"eye",          required_argument, 0, 'e'},
+        {"center",       required_argument, 0, 'c'},
+        {"up",           required_argument, 0, 'u'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's': socket_path = optarg; break;
+        case 'r': repeat = atoi(optarg); break;
+        case 'S': addValue(job, sizeof(job), "shading", optarg); break;
+        case 'n': addPath(job, sizeof(job), "normal", optarg); break;
+        case 'p': addPath(job, sizeof(job), "specular", optarg); break;
+        case 'z': {
+            unsigned int w, h;
+            if (2 != sscanf(optarg, "%ux%u", &w, &h)) {
+                usage(argv[0]);
+                return -1;
+            }
+            snprintf(size, sizeof(size), "%u %u", w, h);
+            addValue(job, sizeof(job), "size", size);
+            break;
+        }
+        case 'm': addValue(job, sizeof(job), "msaa", optarg); break;
+        case 'd': addValue(job, sizeof(job), "depth", optarg); break;
+        case 'l': addValue(job, sizeof(job), "lod", "1"); break;
+        case 'e': addVec3(job, sizeof(job), "eye", optarg); break;
+        case 'c': addVec3(job, sizeof(job), "center", optarg); break;
+        case 'u': addVec3(job, sizeof(job), "up", optarg); break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (argc - optind < 3 || repeat < 1) {
+        usage(argv[0]);
+        return -1;
+    }
+    addPath(job, sizeof(job), "model", argv[optind]);
+    addPath(job, sizeof(job), "diffuse", argv[optind + 1]);
+    addPath(job, sizeof(job), "output", argv[optind + 2]);
+    strncat(job, "\n", sizeof(job) - strlen(job) - 1); // an empty line ends the job
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == fd || -1 == connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        perror(socket_path);
+        return -1;
+    }
+    FILE *in = fdopen(fd, "r");
+    int rv = 0;
+    int i;
+    for (i = 0; i < repeat; ++i) {
+        size_t len = strlen(job);
+        if (len != (size_t)write(fd, job, len)) {
+            perror("write");
+            rv = -1;
+            break;
+        }
+        char reply[1024];
+        if (!fgets(reply, sizeof(reply), in)) {
+            fprintf(stderr, "Connection closed\n");
+            rv = -1;
+            break;
+        }
+        fputs(reply, stdout);
+        if (strncmp(reply, "ok", 2)) {
+            rv = -1;
+        }
+    }
+    fclose(in);
+    return rv;
+}
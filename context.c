@@ -0,0 +1,788 @@
+#include "context.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+
+static int allocBuffers(renderContext *ctx, int depth_format)
+{
+    unsigned int width = ctx->image->width;
+    unsigned int height = ctx->image->height;
+    size_t depth_bytes = depthBytes(width, height, ctx->samples, depth_format);
+    size_t sample_bytes = ctx->samples > 1 ? (size_t)width * height * ctx->samples * sizeof(tgaColor) : 0;
+    size_t bytes = depth_bytes + sample_bytes + 2 * ARENA_ALIGN;
+    // the old buffers stay in place until the new ones exist
+    if (!ctx->buffers || ctx->buffers->reserved < bytes) {
+        arena *buffers = arenaNew(bytes);
+        if (!buffers) {
+            return -1;
+        }
+        arenaFree(ctx->buffers);
+        ctx->buffers = buffers;
+    }
+    arenaReset(ctx->buffers);
+    depthInit(&ctx->depth_storage, arenaAlloc(ctx->buffers, depth_bytes), width, height, ctx->samples, depth_format);
+    ctx->depth = &ctx->depth_storage;
+    ctx->target.image = ctx->image;
+    ctx->target.samples = ctx->samples;
+    ctx->target.sample_colors = NULL;
+    ctx->target.clip[0] = ctx->target.clip[1] = 0;
+    ctx->target.clip[2] = width - 1;
+    ctx->target.clip[3] = height - 1;
+    if (sample_bytes) {
+        ctx->target.sample_colors = (tgaColor *)arenaAlloc(ctx->buffers, sample_bytes);
+    }
+    return 0;
+}
+
+static renderContext * newContext(tgaImage *image, int own_image, int samples, int depth_format)
+{
+    assert(validSampleCount(samples));
+    renderContext *ctx = (renderContext *)calloc(1, sizeof(renderContext));
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->image = image;
+    ctx->own_image = own_image;
+    ctx->samples = samples;
+    ctx->small_batches = 1;
+    ctx->frame = arenaNew(RENDER_FRAME_BLOCK);
+    if (!ctx->frame || -1 == allocBuffers(ctx, depth_format)) {
+        arenaFree(ctx->frame);
+        free(ctx);
+        return NULL;
+    }
+    defaultCamera(ctx->camera);
+    Vec3 light = { 0.0, 0.0, 1.0 };
+    renderSetLight(ctx, light);
+    return ctx;
+}
+
+renderContext * renderNewContext(unsigned int width, unsigned int height, int samples, int depth_format)
+{
+    tgaImage *image = tgaNewImage(height, width, RGB);
+    if (!image) {
+        return NULL;
+    }
+    renderContext *ctx = newContext(image, 1, samples, depth_format);
+    if (!ctx) {
+        tgaFreeImage(image);
+        return NULL;
+    }
+    renderClear(ctx, tgaRGB(0, 0, 0));
+    return ctx;
+}
+
+renderContext * renderNewContextForImage(tgaImage *image, int samples, int depth_format)
+{
+    renderContext *ctx = newContext(image, 0, samples, depth_format);
+    if (!ctx) {
+        return NULL;
+    }
+    renderClearDepth(ctx);
+    return ctx;
+}
+
+void renderFreeContext(renderContext *ctx)
+{
+    if (!ctx) {
+        return;
+    }
+    if (ctx->own_image) {
+        tgaFreeImage(ctx->image);
+    }
+    arenaFree(ctx->buffers);
+    arenaFree(ctx->frame);
+    free(ctx);
+}
+
+int renderResize(renderContext *ctx, unsigned int width, unsigned int height)
+{
+    if (ctx->image->width == width && ctx->image->height == height) {
+        return 0;
+    }
+    if (!ctx->own_image) {
+        return -1;
+    }
+    tgaImage *image = tgaNewImage(height, width, RGB);
+    if (!image) {
+        return -1;
+    }
+    tgaImage *old = ctx->image;
+    ctx->image = image;
+    if (-1 == allocBuffers(ctx, ctx->depth->format)) {
+        ctx->image = old;
+        tgaFreeImage(image);
+        return -1;
+    }
+    tgaFreeImage(old);
+    renderClear(ctx, tgaRGB(0, 0, 0));
+    return 0;
+}
+
+void renderSetCamera(renderContext *ctx, Vec3 eye, Vec3 center, Vec3 up)
+{
+    lookAt(eye, center, up, ctx->camera);
+}
+
+void renderSetLight(renderContext *ctx, Vec3 direction)
+{
+    memcpy(ctx->light, direction, sizeof(Vec3));
+    normal_vec3(&ctx->light, v_length(ctx->light));
+}
+
+void renderSetLightCamera(renderContext *shadow, Vec3 light, Vec3 lo, Vec3 hi)
+{
+    Vec3 center, eye, l;
+    Vec3 up = { 0.0, 1.0, 0.0 };
+    int i;
+    memcpy(l, light, sizeof(Vec3));
+    normal_vec3(&l, v_length(l));
+    double radius = 0;
+    for (i = 0; i < 3; ++i) {
+        center[i] = (lo[i] + hi[i]) / 2;
+        radius += (hi[i] - lo[i]) * (hi[i] - lo[i]) / 4;
+    }
+    radius = sqrt(radius);
+    if (radius <= 0) {
+        radius = 1;
+    }
+    // far enough for little perspective, the near half of the box still fits
+    for (i = 0; i < 3; ++i) {
+        eye[i] = center[i] + l[i] * 4 * radius;
+    }
+    if (d_abs(l[1]) > 0.99) {
+        up[0] = 1.0;
+        up[1] = 0.0;
+    }
+    lookAt(eye, center, up, shadow->camera);
+    // lookAt keeps one unit at center across the image, scale the box in
+    for (i = 0; i < 4; ++i) {
+        shadow->camera[0][i] *= 0.75 / radius;
+        shadow->camera[1][i] *= 0.75 / radius;
+    }
+    memcpy(shadow->light, l, sizeof(Vec3));
+    renderFitDepth(shadow, lo, hi);
+}
+
+void renderSetShadow(renderContext *ctx, renderContext *shadow, int pcf)
+{
+    ctx->shadow = shadow;
+    ctx->target.shadow = NULL;
+    if (!shadow) {
+        return;
+    }
+    assert(shadow->samples == 1 && shadow->depth->format == DEPTH_FLOAT);
+    ctx->shadow_map.depth = (const float *)shadow->depth->data;
+    ctx->shadow_map.width = shadow->depth->width;
+    ctx->shadow_map.height = shadow->depth->height;
+    ctx->shadow_map.pcf = pcf < 0 ? 0 : pcf;
+    ctx->shadow_map.bias = RENDER_SHADOW_BIAS * depthSpan(shadow->depth);
+    ctx->target.shadow = &ctx->shadow_map;
+}
+
+void renderClear(renderContext *ctx, tgaColor color)
+{
+    tgaImage *image = ctx->image;
+    unsigned int i;
+    for (i = 0; i < image->width * image->height; ++i) {
+        memcpy(image->data + i * image->bpp, &color, image->bpp);
+    }
+    if (ctx->samples > 1) {
+        size_t n = (size_t)image->width * image->height * ctx->samples;
+        size_t k;
+        for (k = 0; k < n; ++k) {
+            ctx->target.sample_colors[k] = color;
+        }
+    }
+    depthClear(ctx->depth);
+    ctx->depth_fitted = 0;
+    arenaReset(ctx->frame);
+}
+
+void renderClearDepth(renderContext *ctx)
+{
+    tgaImage *image = ctx->image;
+    if (ctx->samples > 1) {
+        unsigned int i;
+        int k;
+        for (i = 0; i < image->width * image->height; ++i) {
+            tgaColor c = tgaGetPixel(image, i % image->width, i / image->width);
+            for (k = 0; k < ctx->samples; ++k) {
+                ctx->target.sample_colors[i * ctx->samples + k] = c;
+            }
+        }
+    }
+    depthClear(ctx->depth);
+    ctx->depth_fitted = 0;
+    arenaReset(ctx->frame);
+}
+
+/* screen positions and buffer depths of every vertex, from the frame arena, -1 when it is out of memory */
+static int projectModel(renderContext *ctx, Model *model, Mat4x4 M, Vector **screen_out, double **z_out)
+{
+    depthBuffer *depth = ctx->depth;
+    Vector *screen = (Vector *)arenaAlloc(ctx->frame, model->nvert * sizeof(Vector));
+    double *z = (double *)arenaAlloc(ctx->frame, model->nvert * sizeof(double));
+    unsigned int j;
+    if (!screen || !z) {
+        return -1;
+    }
+
+    // every vertex is shared by several faces, so transform each one once
+    statsBegin(STAGE_TRANSFORM);
+    projectVerticesWith(M, ctx->image, model, screen, z);
+    if (depth->format == DEPTH_LEGACY) {
+        for (j = 0; j < model->nvert; ++j) {
+            z[j] = screen[j][2];
+        }
+    } else {
+        if (!ctx->depth_fitted) {
+            depthFitRange(depth, z, model->nvert);
+            ctx->depth_fitted = 1;
+        }
+        for (j = 0; j < model->nvert; ++j) {
+            z[j] = depthValue(depth, z[j]);
+        }
+    }
+    statsEnd(STAGE_TRANSFORM);
+    *screen_out = screen;
+    *z_out = z;
+    return 0;
+}
+
+/*
+ * Per draw vertex work beyond projection, from the frame arena: gouraud
+ * intensities per unique vertex, and where every position lands in the
+ * shadow map. world places the model in the world, NULL for identity.
+ * -1 when the arena is out of memory.
+ */
+static int vertexStage(renderContext *ctx, Model *model, const shader *sh, Vec3 light, Mat4x4 world, shadeVertices *vs)
+{
+    vs->lit = NULL;
+    vs->shadow = NULL;
+    if (sh->mode == SHADING_DEPTH) {
+        return 0;
+    }
+    if (sh->mode == SHADING_GOURAUD) {
+        double *lit = (double *)arenaAlloc(ctx->frame, (model->nnorm ? model->nnorm : model->nvert) * sizeof(double));
+        Vec3 *normals = model->nnorm ? NULL : (Vec3 *)arenaAlloc(ctx->frame, model->nvert * sizeof(Vec3));
+        if (!lit || (!model->nnorm && !normals)) {
+            return -1;
+        }
+        statsBegin(STAGE_TRANSFORM);
+        shadeLightVertices(model, light, lit, normals);
+        statsEnd(STAGE_TRANSFORM);
+        vs->lit = lit;
+    }
+    if (ctx->shadow) {
+        renderContext *sc = ctx->shadow;
+        Vec3 *shadow = (Vec3 *)arenaAlloc(ctx->frame, model->nvert * sizeof(Vec3));
+        Mat4x4 S;
+        unsigned int i, j, k;
+        if (!shadow) {
+            return -1;
+        }
+        statsBegin(STAGE_TRANSFORM);
+        for (i = 0; i < 4; ++i) {
+            for (j = 0; j < 4; ++j) {
+                S[i][j] = world ? 0.0 : sc->camera[i][j];
+                for (k = 0; world && k < 4; ++k) {
+                    S[i][j] += sc->camera[i][k]*world[k][j];
+                }
+            }
+        }
+        for (j = 0; j < model->nvert; ++j) {
+            Mat4x1 b = { model->vertices[j][0], model->vertices[j][1], model->vertices[j][2], 1.0 };
+            Mat4x1 V;
+            product_mat(S, b, &V);
+            if (V[3] <= 0) {
+                // behind the light camera, off the map and so lit
+                shadow[j][0] = shadow[j][1] = -1.0;
+                shadow[j][2] = 0.0;
+                continue;
+            }
+            shadow[j][0] = (V[0]/V[3] + 1)*sc->image->width/2;
+            shadow[j][1] = (V[1]/V[3] + 1)*sc->image->height/2;
+            shadow[j][2] = depthValue(sc->depth, 1/V[3]);
+        }
+        statsEnd(STAGE_TRANSFORM);
+        vs->shadow = shadow;
+    }
+    return 0;
+}
+
+/*
+ * Faces in order, the faces listed or all of them when list is NULL.
+ * Triangle counters are left to the caller for lists, a face may be
+ * listed in several tiles.
+ */
+static void drawFaces(renderContext *ctx, Model *model, const shader *sh, Vec3 light, Vec3 view,
+                      const shadeVertices *vs, Vector *screen, const double *z, const unsigned int *list,
+                      unsigned int count)
+{
+    depthBuffer *depth = ctx->depth;
+    int counted = list == NULL;
+    shadeFace face;
+    unsigned int n;
+
+    size_t mark = arenaMark(ctx->frame);
+    smallBatch *batch = ctx->samples == 1 && ctx->small_batches ?
+                        (smallBatch *)arenaAlloc(ctx->frame, sizeof(smallBatch)) : NULL;
+    if (batch) {
+        batch->count = 0;
+    }
+    for (n = 0; n < count; ++n) {
+        unsigned int j = list ? list[n] : n;
+        if (counted) {
+            STATS_ADD(CNT_TRI_SUBMITTED, 1);
+        }
+        unsigned int ia = getVertexIndex(model, j, 0);
+        unsigned int ib = getVertexIndex(model, j, 1);
+        unsigned int ic = getVertexIndex(model, j, 2);
+        int *A = screen[ia];
+        int *B = screen[ib];
+        int *C = screen[ic];
+        if (cull(ctx->image, A, B, C)) {
+            if (counted) {
+                STATS_ADD(CNT_TRI_CULLED, 1);
+            }
+            continue;
+        }
+        if (counted) {
+            STATS_ADD(CNT_TRI_RASTERIZED, 1);
+        }
+        if (batch && smallTriangle(A, B, C)) {
+            if (counted) {
+                STATS_ADD(CNT_TRI_SMALL, 1);
+            }
+            batch->face[batch->count] = j;
+            batch->vert[batch->count][0] = ia;
+            batch->vert[batch->count][1] = ib;
+            batch->vert[batch->count][2] = ic;
+            if (++batch->count == SMALL_BATCH) {
+                triangleBatchShaded(&ctx->target, model, batch, screen, z, sh, light, view, vs, depth);
+            }
+            continue;
+        }
+        // draw order decides depth ties, so the batch goes first
+        if (batch && batch->count) {
+            triangleBatchShaded(&ctx->target, model, batch, screen, z, sh, light, view, vs, depth);
+        }
+        shadeSetup(model, j, sh, light, view, vs, &face);
+        double Z[3] = { z[ia], z[ib], z[ic] };
+        triangleShaded(&ctx->target, model, A, B, C, Z, sh, &face, depth);
+    }
+    if (batch && batch->count) {
+        triangleBatchShaded(&ctx->target, model, batch, screen, z, sh, light, view, vs, depth);
+    }
+    arenaRewind(ctx->frame, mark);
+}
+
+/*
+ * Towards the viewer in the space M maps from: the third row of a lookAt
+ * camera is the view axis, and times a transform it is taken back into
+ * model space like the light. Directional, as if the viewer were far.
+ */
+static void viewDirection(Mat4x4 M, Vec3 view)
+{
+    Vec3 v = { M[2][0], M[2][1], M[2][2] };
+    normal_vec3(&v, v_length(v));
+    memcpy(view, v, sizeof(Vec3));
+}
+
+/* M maps model space to clip space, world to world space or NULL when the same, light is in model space */
+static int drawWith(renderContext *ctx, Model *model, int shading, Mat4x4 M, Mat4x4 world, Vec3 light)
+{
+    const shader *sh = shaderSelect(shading, shaderFeatures(model, shading), &ctx->target);
+    shader generic;
+    if (ctx->generic_shading) {
+        generic = shaderGeneric(sh);
+        sh = &generic;
+    }
+    size_t mark = arenaMark(ctx->frame);
+    Vector *screen;
+    double *z;
+    shadeVertices vs;
+    int rv = projectModel(ctx, model, M, &screen, &z);
+    if (!rv) {
+        rv = vertexStage(ctx, model, sh, light, world, &vs);
+    }
+    if (!rv) {
+        Vec3 view;
+        viewDirection(M, view);
+        drawFaces(ctx, model, sh, light, view, &vs, screen, z, NULL, model->nface);
+    }
+    arenaRewind(ctx->frame, mark);
+    return rv;
+}
+
+int renderDrawModel(renderContext *ctx, Model *model, int shading)
+{
+    return drawWith(ctx, model, shading, ctx->camera, NULL, ctx->light);
+}
+
+int renderDrawEdges(renderContext *ctx, Model *model, const modelEdges *edges, tgaColor color, int depth_test)
+{
+    size_t mark = arenaMark(ctx->frame);
+    Vector *screen;
+    double *z;
+    if (-1 == projectModel(ctx, model, ctx->camera, &screen, &z)) {
+        arenaRewind(ctx->frame, mark);
+        return -1;
+    }
+    statsBegin(STAGE_RASTER);
+    wireDraw(&ctx->target, edges, screen, z, color, depth_test ? ctx->depth : NULL);
+    statsEnd(STAGE_RASTER);
+    arenaRewind(ctx->frame, mark);
+    return 0;
+}
+
+int renderDrawInstance(renderContext *ctx, Model *model, int shading, Mat4x4 transform, Vec3 bounds[2])
+{
+    Mat4x4 M;
+    int i, j, k;
+    for (i = 0; i < 4; ++i) {
+        for (j = 0; j < 4; ++j) {
+            M[i][j] = 0.0;
+            for (k = 0; k < 4; ++k) {
+                M[i][j] += ctx->camera[i][k]*transform[k][j];
+            }
+        }
+    }
+    if (bounds) {
+        // the box projects inside the hull of its corners while all are in front
+        int behind = 0, left = 0, right = 0, below = 0, above = 0;
+        for (i = 0; i < 8; ++i) {
+            Mat4x1 corner = { bounds[i & 1][0], bounds[(i >> 1) & 1][1], bounds[(i >> 2) & 1][2], 1.0 };
+            Mat4x1 V;
+            product_mat(M, corner, &V);
+            if (V[3] <= 0) {
+                ++behind;
+                continue;
+            }
+            left += V[0] < -V[3];
+            right += V[0] > V[3];
+            below += V[1] < -V[3];
+            above += V[1] > V[3];
+        }
+        if (behind == 8 || (!behind && (left == 8 || right == 8 || below == 8 || above == 8))) {
+            STATS_ADD(CNT_INSTANCE_CULLED, 1);
+            return 1;
+        }
+    }
+    // rotation and uniform scale only: the transpose takes the light back to model space
+    Vec3 light;
+    for (i = 0; i < 3; ++i) {
+        light[i] = transform[0][i]*ctx->light[0] + transform[1][i]*ctx->light[1] + transform[2][i]*ctx->light[2];
+    }
+    normal_vec3(&light, v_length(light));
+    return drawWith(ctx, model, shading, M, transform, light);
+}
+
+void renderFitDepth(renderContext *ctx, Vec3 lo, Vec3 hi)
+{
+    double invw[8];
+    int i;
+    for (i = 0; i < 8; ++i) {
+        Mat4x1 corner = { i & 1 ? hi[0] : lo[0], i & 2 ? hi[1] : lo[1], i & 4 ? hi[2] : lo[2], 1.0 };
+        Mat4x1 V;
+        product_mat(ctx->camera, corner, &V);
+        invw[i] = V[3] != 0 ? 1.0 / V[3] : 0;
+    }
+    if (ctx->depth->format != DEPTH_LEGACY) {
+        depthFitRange(ctx->depth, invw, 8);
+    }
+    ctx->depth_fitted = 1;
+}
+
+int renderDrawLod(renderContext *ctx, modelLod *lod, int shading)
+{
+    return renderDrawModel(ctx, lodSelect(lod, ctx->camera, ctx->image->width, ctx->image->height), shading);
+}
+
+static void setClip(renderContext *ctx, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+    ctx->target.clip[0] = x0;
+    ctx->target.clip[1] = y0;
+    ctx->target.clip[2] = x1;
+    ctx->target.clip[3] = y1;
+}
+
+// color, samples and depth of the pixels in target.clip
+static void clearClip(renderContext *ctx, tgaColor color)
+{
+    tgaImage *image = ctx->image;
+    const int *clip = ctx->target.clip;
+    int x, y, k;
+    for (y = clip[1]; y <= clip[3]; ++y) {
+        for (x = clip[0]; x <= clip[2]; ++x) {
+            size_t i = (size_t)y * image->width + x;
+            memcpy(image->data + i * image->bpp, &color, image->bpp);
+            for (k = 0; ctx->samples > 1 && k < ctx->samples; ++k) {
+                ctx->target.sample_colors[i * ctx->samples + k] = color;
+            }
+        }
+    }
+    depthClearRect(ctx->depth, clip[0], clip[1], clip[2], clip[3]);
+}
+
+/*
+ * Bins the faces by the tiles their bounding boxes touch, then draws the
+ * tiles one at a time, from the top row of the image down. Faces keep
+ * their order within a tile, so every pixel sees the same writes as in a
+ * single pass. clear, when set, resets a tile just before it is drawn.
+ * -1 when the frame arena is out of memory, before any tile is drawn.
+ */
+static int drawTiles(renderContext *ctx, Model *model, int shading, unsigned int tile,
+                      const tgaColor *clear, renderTileFn done, void *user)
+{
+    tgaImage *image = ctx->image;
+    const shader *sh = shaderSelect(shading, shaderFeatures(model, shading), &ctx->target);
+    shader generic;
+    if (ctx->generic_shading) {
+        generic = shaderGeneric(sh);
+        sh = &generic;
+    }
+    unsigned int tx = (image->width + tile - 1) / tile;
+    unsigned int ty = (image->height + tile - 1) / tile;
+    unsigned int ntiles = tx * ty;
+    unsigned int j, pass, t;
+    assert(tile > 0);
+
+    size_t mark = arenaMark(ctx->frame);
+    Vector *screen;
+    double *z;
+    shadeVertices vs;
+    if (-1 == projectModel(ctx, model, ctx->camera, &screen, &z) ||
+        -1 == vertexStage(ctx, model, sh, ctx->light, NULL, &vs)) {
+        arenaRewind(ctx->frame, mark);
+        return -1;
+    }
+
+    Vec3 view;
+    viewDirection(ctx->camera, view);
+
+    // counts per tile, then a second pass fills the lists at their offsets
+    unsigned int *start = (unsigned int *)arenaAlloc(ctx->frame, (ntiles + 1) * sizeof(unsigned int));
+    unsigned int *fill = (unsigned int *)arenaAlloc(ctx->frame, ntiles * sizeof(unsigned int));
+    unsigned int *list = NULL;
+    if (!start || !fill) {
+        arenaRewind(ctx->frame, mark);
+        return -1;
+    }
+    memset(start, 0, (ntiles + 1) * sizeof(unsigned int));
+    for (pass = 0; pass < 2; ++pass) {
+        for (j = 0; j < model->nface; ++j) {
+            int *A = screen[getVertexIndex(model, j, 0)];
+            int *B = screen[getVertexIndex(model, j, 1)];
+            int *C = screen[getVertexIndex(model, j, 2)];
+            int culled = cull(image, A, B, C);
+            if (!pass) {
+                STATS_ADD(CNT_TRI_SUBMITTED, 1);
+                STATS_ADD(culled ? CNT_TRI_CULLED : CNT_TRI_RASTERIZED, 1);
+            }
+            if (culled) {
+                continue;
+            }
+            int x0, y0;
+            int x1 = c_length(A[0], B[0], C[0], &x0);
+            int y1 = c_length(A[1], B[1], C[1], &y0);
+            unsigned int c0 = x0 < 0 ? 0 : x0 / tile, c1 = x1 >= (int)image->width ? tx - 1 : x1 / tile;
+            unsigned int r0 = y0 < 0 ? 0 : y0 / tile, r1 = y1 >= (int)image->height ? ty - 1 : y1 / tile;
+            unsigned int r, c;
+            for (r = r0; r <= r1; ++r) {
+                for (c = c0; c <= c1; ++c) {
+                    if (pass) {
+                        list[fill[r * tx + c]++] = j;
+                    } else {
+                        ++start[r * tx + c + 1];
+                    }
+                }
+            }
+        }
+        if (!pass) {
+            for (t = 0; t < ntiles; ++t) {
+                start[t + 1] += start[t];
+                fill[t] = start[t];
+            }
+            list = (unsigned int *)arenaAlloc(ctx->frame, (start[ntiles] + 1) * sizeof(unsigned int));
+            if (!list) {
+                arenaRewind(ctx->frame, mark);
+                return -1;
+            }
+        }
+    }
+
+    int r, c;
+    for (r = ty - 1; r >= 0; --r) {
+        for (c = 0; c < (int)tx; ++c) {
+            unsigned int x0 = c * tile, y0 = r * tile;
+            unsigned int x1 = x0 + tile > image->width ? image->width - 1 : x0 + tile - 1;
+            unsigned int y1 = y0 + tile > image->height ? image->height - 1 : y0 + tile - 1;
+            t = r * tx + c;
+            setClip(ctx, x0, y0, x1, y1);
+            if (clear) {
+                clearClip(ctx, *clear);
+            }
+            drawFaces(ctx, model, sh, ctx->light, view, &vs, screen, z, list + start[t], start[t + 1] - start[t]);
+            if (ctx->samples > 1) {
+                statsBegin(STAGE_SHADE);
+                resolveSamples(&ctx->target);
+                statsEnd(STAGE_SHADE);
+            }
+            if (done) {
+                done(user, image, x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+            }
+        }
+    }
+    setClip(ctx, 0, 0, image->width - 1, image->height - 1);
+    arenaRewind(ctx->frame, mark);
+    return 0;
+}
+
+int renderDrawTiled(renderContext *ctx, Model *model, int shading, unsigned int tile, renderTileFn done, void *user)
+{
+    return drawTiles(ctx, model, shading, tile, NULL, done, user);
+}
+
+int renderProgressive(renderContext *ctx, Model *model, modelLod *lod, int shading, tgaColor background,
+                       unsigned int tile, renderTileFn done, void *user)
+{
+    assert(model || lod);
+    tgaImage *image = ctx->image;
+    unsigned int pw = (image->width + RENDER_PREVIEW_SCALE - 1) / RENDER_PREVIEW_SCALE;
+    unsigned int ph = (image->height + RENDER_PREVIEW_SCALE - 1) / RENDER_PREVIEW_SCALE;
+    renderContext *preview = renderNewContext(pw, ph, 1, ctx->depth->format);
+    if (preview) {
+        memcpy(preview->camera, ctx->camera, sizeof(Mat4x4));
+        memcpy(preview->light, ctx->light, sizeof(Vec3));
+        renderClear(preview, background);
+    }
+    // without a preview the tiles still come, just later
+    if (preview && 0 == renderDrawModel(preview, lod ? lodSelect(lod, ctx->camera, pw, ph) : model, shading)) {
+        // nearest neighbour, one preview pixel covers a scale x scale block
+        unsigned int x, y;
+        for (y = 0; y < image->height; ++y) {
+            for (x = 0; x < image->width; ++x) {
+                tgaColor c = tgaGetPixel(preview->image, x / RENDER_PREVIEW_SCALE, y / RENDER_PREVIEW_SCALE);
+                memcpy(image->data + ((size_t)y * image->width + x) * image->bpp, &c, image->bpp);
+            }
+        }
+        if (done) {
+            done(user, image, 0, 0, image->width, image->height);
+        }
+    }
+    if (preview) {
+        renderFreeContext(preview);
+    }
+    ctx->depth_fitted = 0;
+    return drawTiles(ctx, lod ? lodSelect(lod, ctx->camera, image->width, image->height) : model,
+              shading, tile, &background, done, user);
+}
+
+tgaImage * renderResolve(renderContext *ctx)
+{
+    if (ctx->samples > 1) {
+        statsBegin(STAGE_SHADE);
+        resolveSamples(&ctx->target);
+        statsEnd(STAGE_SHADE);
+    }
+    return ctx->image;
+}
+
+void renderModel(tgaImage *image, Model *model)
+{
+    renderModelShaded(image, model, SHADING_FLAT);
+}
+
+void renderModelPhong(tgaImage *image, Model *model)
+{
+    renderModelShaded(image, model, SHADING_PHONG);
+}
+
+void renderModelShaded(tgaImage *image, Model *model, int shading)
+{
+    renderModelMsaa(image, model, shading, 1);
+}
+
+void renderModelMsaa(tgaImage *image, Model *model, int shading, int samples)
+{
+    renderModelDepth(image, model, shading, samples, DEPTH_DEFAULT);
+}
+
+/*
+ * The one-shot calls keep a context per thread and point it at the
+ * caller's image, so repeated frames reuse the same pages instead of
+ * mapping fresh buffers every call. The context goes with its thread,
+ * or earlier with renderModelRelease; between calls it holds no image.
+ */
+static pthread_key_t oneshot_key;
+static pthread_once_t oneshot_once = PTHREAD_ONCE_INIT;
+static int oneshot_ready = 0;
+
+static void freeOneshot(void *ctx)
+{
+    renderFreeContext((renderContext *)ctx);
+}
+
+static void makeOneshotKey(void)
+{
+    oneshot_ready = !pthread_key_create(&oneshot_key, freeOneshot);
+}
+
+static renderContext * takeOneshot(void)
+{
+    pthread_once(&oneshot_once, makeOneshotKey);
+    if (!oneshot_ready) {
+        return NULL;
+    }
+    renderContext *ctx = (renderContext *)pthread_getspecific(oneshot_key);
+    pthread_setspecific(oneshot_key, NULL);
+    return ctx;
+}
+
+void renderModelRelease(void)
+{
+    renderFreeContext(takeOneshot());
+}
+
+void renderModelDepth(tgaImage *image, Model *model, int shading, int samples, int format)
+{
+    renderContext *ctx = takeOneshot();
+    if (ctx && (ctx->samples != samples || ctx->depth->format != format)) {
+        renderFreeContext(ctx);
+        ctx = NULL;
+    }
+    if (!ctx) {
+        ctx = renderNewContextForImage(image, samples, format);
+        if (!ctx) {
+            perror("renderNewContextForImage");
+            return;
+        }
+    } else {
+        // compare with the buffers, the context keeps no image between calls
+        int resized = ctx->depth->width != image->width || ctx->depth->height != image->height;
+        ctx->image = image;
+        if (resized && -1 == allocBuffers(ctx, format)) {
+            fprintf(stderr, "Can't allocate %ux%u buffers\n", image->width, image->height);
+            renderFreeContext(ctx);
+            return;
+        }
+        ctx->target.image = image;
+        defaultCamera(ctx->camera);
+        renderClearDepth(ctx);
+    }
+    if (-1 == renderDrawModel(ctx, model, shading)) {
+        fprintf(stderr, "Out of memory drawing %ux%u\n", image->width, image->height);
+    }
+    renderResolve(ctx);
+    ctx->image = ctx->target.image = NULL;
+    if (!oneshot_ready || pthread_setspecific(oneshot_key, ctx)) {
+        renderFreeContext(ctx);
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef CONTEXT_H_
+#define CONTEXT_H_
+
+#include "tga.h"
+#include "model.h"
+#include "raster.h"
+#include "depth.h"
+#include "arena.h"
+#include "lod.h"
+#include "wire.h"
+
+/*
+ * Everything a frame needs that outlives one draw: color and depth
+ * buffers, per-sample colors and the camera matrix. A long running caller
+ * keeps one context and goes through clear, draws and resolve for every
+ * frame. Depth and sample storage is carved from `buffers`, which is only
+ * re-carved on resize; per draw scratch such as transformed vertices comes
+ * from `frame`, rewound after every draw and reset by every clear in O(1).
+ */
+typedef struct renderContext {
+    tgaImage *image;
+    int own_image;
+    int samples;
+    arena *buffers;
+    arena *frame;
+    depthBuffer *depth;     // points at depth_storage
+    depthBuffer depth_storage;
+    int depth_fitted;       // range taken from the first draw after a clear
+    int small_batches;      // single sample small triangles go through triangleBatchShaded, on by default
+    int generic_shading;    // draws use shaderGeneric instead of the specialized loops, off by default
+    shadeTarget target;
+    Mat4x4 camera;
+    Vec3 light;             // normalized, towards the light
+    struct renderContext *shadow; // depth from the light, NULL without shadows
+    shadeShadowMap shadow_map;
+} renderContext;
+
+// first block of per frame scratch, the arena chains larger ones when a frame needs more
+#define RENDER_FRAME_BLOCK ((size_t)1 << 20)
+
+renderContext * renderNewContext(unsigned int width, unsigned int height, int samples, int depth_format);
+// draws go straight to `image`, which must outlive the context
+renderContext * renderNewContextForImage(tgaImage *image, int samples, int depth_format);
+void renderFreeContext(renderContext *ctx);
+
+// keeps the buffers when the size doesn't change, -1 for a borrowed image or out of
+// memory, which leave the context as it was
+int renderResize(renderContext *ctx, unsigned int width, unsigned int height);
+
+void renderSetCamera(renderContext *ctx, Vec3 eye, Vec3 center, Vec3 up);
+void renderSetLight(renderContext *ctx, Vec3 direction);
+
+/*
+ * Shadow maps: a single sample DEPTH_FLOAT context looks at the box lo, hi
+ * from far out along light, and a depth only draw of the casters fills it.
+ * Shaded draws into a context given it with renderSetShadow then look
+ * every fragment up in it, PCF over (2 pcf + 1)^2 texels. Set the shadow
+ * after its draws, the depth bias follows their range; NULL turns it off.
+ */
+#define RENDER_SHADOW_SIZE 1024
+#define RENDER_SHADOW_BIAS 0.01 // of the depth range of the map
+
+void renderSetLightCamera(renderContext *shadow, Vec3 light, Vec3 lo, Vec3 hi);
+void renderSetShadow(renderContext *ctx, renderContext *shadow, int pcf);
+
+// color, samples and depth
+void renderClear(renderContext *ctx, tgaColor color);
+// depth only, samples start from the image so draws compose over it
+void renderClearDepth(renderContext *ctx);
+
+// -1 when the per draw scratch can't be allocated, for every draw below
+int renderDrawModel(renderContext *ctx, Model *model, int shading);
+
+/*
+ * Draws model placed in the world by transform, made of rotation, uniform
+ * scale and translation only. With bounds (model space box, lo and hi) the
+ * instance is skipped when the box is entirely off screen; returns 1 then.
+ */
+int renderDrawInstance(renderContext *ctx, Model *model, int shading, Mat4x4 transform, Vec3 bounds[2]);
+
+/*
+ * Overlays the edges of model, from wireEdges, with the context camera.
+ * With depth_test only edges on faces already drawn into the depth buffer
+ * show, draw the model first; the depth buffer itself is left alone.
+ * Lines land in the samples like triangles, resolve afterwards.
+ */
+int renderDrawEdges(renderContext *ctx, Model *model, const modelEdges *edges, tgaColor color, int depth_test);
+
+/*
+ * Fixed point depth formats take their range from the first draw after a
+ * clear. When a frame is drawn in many pieces, fit it to the bounds of the
+ * whole scene first instead.
+ */
+void renderFitDepth(renderContext *ctx, Vec3 lo, Vec3 hi);
+// draws the level picked for the current camera and image size
+int renderDrawLod(renderContext *ctx, modelLod *lod, int shading);
+
+/*
+ * Called as soon as the pixels of a tile are final, with the rectangle
+ * in image coordinates (row 0 at the bottom, as drawn).
+ */
+typedef void (*renderTileFn)(void *user, tgaImage *image, unsigned int x, unsigned int y,
+                             unsigned int width, unsigned int height);
+
+#define RENDER_TILE 64          // default tile size in pixels
+#define RENDER_PREVIEW_SCALE 4  // preview is drawn at 1/scale of the size
+
+// same pixels as renderDrawModel, drawn and reported tile by tile
+int renderDrawTiled(renderContext *ctx, Model *model, int shading, unsigned int tile, renderTileFn done, void *user);
+
+/*
+ * For a low time to first pixel: draws a preview at 1/RENDER_PREVIEW_SCALE
+ * of the size, with the level of lod fitting it when lod is given, scales
+ * it up into the image and reports it as one tile covering everything.
+ * The full frame then replaces it tile by tile, every tile cleared to
+ * background just before it is drawn. Draw either model or lod.
+ */
+int renderProgressive(renderContext *ctx, Model *model, modelLod *lod, int shading, tgaColor background,
+                       unsigned int tile, renderTileFn done, void *user);
+
+// averages samples into the image when multisampling, returns the image
+tgaImage * renderResolve(renderContext *ctx);
+
+// one-shot draws into image with the default camera, image must be cleared by caller
+void renderModel(tgaImage *image, Model *model);
+
+void renderModelPhong(tgaImage *image, Model *model);
+
+void renderModelShaded(tgaImage *image, Model *model, int shading);
+
+// multisampled: depth and coverage per sample, shaded once per pixel and triangle
+void renderModelMsaa(tgaImage *image, Model *model, int shading, int samples);
+
+// with an explicit depth format, the others use DEPTH_DEFAULT
+void renderModelDepth(tgaImage *image, Model *model, int shading, int samples, int format);
+
+// frees the context the one-shot calls keep for this thread, thread exit does it too
+void renderModelRelease(void);
+
+#endif // CONTEXT_H_
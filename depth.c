@@ -0,0 +1,207 @@
+#include "depth.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static const struct {
+    const char *name;
+    size_t size;
+    double max; // largest fixed point value, kept one below 2^bits so rounding can't wrap
+} formats[DEPTH_FORMATS] = {
+    { "legacy", sizeof(int),      0 },
+    { "16",     sizeof(uint16_t), 65534.0 },
+    { "24",     sizeof(uint32_t), 16777214.0 },
+    { "32",     sizeof(uint32_t), 4294967294.0 },
+    { "float",  sizeof(float),    0 },
+};
+
+size_t depthBytes(unsigned int width, unsigned int height, unsigned int samples, int format)
+{
+    assert(format >= 0 && format < DEPTH_FORMATS);
+    return (size_t)width * height * samples * formats[format].size;
+}
+
+void depthInit(depthBuffer *depth, void *data, unsigned int width, unsigned int height, unsigned int samples, int format)
+{
+    assert(format >= 0 && format < DEPTH_FORMATS);
+    depth->format = format;
+    depth->width = width;
+    depth->height = height;
+    depth->samples = samples;
+    depth->count = (size_t)width * height * samples;
+    depth->data = data;
+    depth->nearest = 1.0;
+    depth->farthest = 0.0;
+}
+
+depthBuffer * depthNew(unsigned int width, unsigned int height, unsigned int samples, int format)
+{
+    depthBuffer *depth = (depthBuffer *)malloc(sizeof(depthBuffer));
+    if (!depth) {
+        return NULL;
+    }
+    void *data = malloc(depthBytes(width, height, samples, format));
+    if (!data) {
+        free(depth);
+        return NULL;
+    }
+    depthInit(depth, data, width, height, samples, format);
+    depthClear(depth);
+    return depth;
+}
+
+void depthFree(depthBuffer *depth)
+{
+    if (!depth) {
+        return;
+    }
+    free(depth->data);
+    free(depth);
+}
+
+void depthClear(depthBuffer *depth)
+{
+    if (depth->format != DEPTH_LEGACY) {
+        memset(depth->data, 0, depth->count * formats[depth->format].size);
+        return;
+    }
+    // plain loop over int, the compiler turns it into vector stores
+    int *d = (int *)depth->data;
+    size_t i;
+    for (i = 0; i < depth->count; ++i) {
+        d[i] = -10000;
+    }
+}
+
+void depthClearRect(depthBuffer *depth, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+    assert(x0 <= x1 && x1 < depth->width);
+    assert(y0 <= y1 && y1 < depth->height);
+    size_t n = (size_t)(x1 - x0 + 1) * depth->samples;
+    unsigned int y;
+    for (y = y0; y <= y1; ++y) {
+        size_t first = ((size_t)y * depth->width + x0) * depth->samples;
+        if (depth->format != DEPTH_LEGACY) {
+            memset((char *)depth->data + first * formats[depth->format].size, 0, n * formats[depth->format].size);
+            continue;
+        }
+        int *d = (int *)depth->data + first;
+        size_t i;
+        for (i = 0; i < n; ++i) {
+            d[i] = -10000;
+        }
+    }
+}
+
+const char * depthFormatName(int format)
+{
+    if (format < 0 || format >= DEPTH_FORMATS) {
+        return NULL;
+    }
+    return formats[format].name;
+}
+
+int depthParseFormat(const char *name)
+{
+    int i;
+    for (i = 0; i < DEPTH_FORMATS; ++i) {
+        if (!strcmp(name, formats[i].name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void depthFitRange(depthBuffer *depth, const double *invw, unsigned int n)
+{
+    double lo = 0, hi = 0;
+    int found = 0;
+    unsigned int i;
+    for (i = 0; i < n; ++i) {
+        if (invw[i] <= 0) {
+            continue;
+        }
+        if (!found || invw[i] < lo) lo = invw[i];
+        if (!found || invw[i] > hi) hi = invw[i];
+        found = 1;
+    }
+    if (!found) {
+        return;
+    }
+    depth->farthest = lo;
+    depth->nearest = hi;
+}
+
+double depthValue(const depthBuffer *depth, double invw)
+{
+    if (invw <= 0) {
+        return 0;
+    }
+    if (depth->format == DEPTH_FLOAT) {
+        return invw;
+    }
+    assert(depth->format != DEPTH_LEGACY);
+    double max = formats[depth->format].max;
+    double range = depth->nearest - depth->farthest;
+    if (range <= 0) {
+        return max;
+    }
+    double t = (invw - depth->farthest) / range;
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    return 1 + t * (max - 1);
+}
+
+double depthSpan(const depthBuffer *depth)
+{
+    if (depth->format == DEPTH_LEGACY) {
+        return 255.0;
+    }
+    if (depth->format == DEPTH_FLOAT) {
+        return depth->nearest - depth->farthest;
+    }
+    return formats[depth->format].max - 1;
+}
+
+void depthRowInvW(const depthBuffer *depth, unsigned int y, unsigned int x0, unsigned int x1, unsigned int step,
+                  float *out)
+{
+    assert(depth->format != DEPTH_LEGACY);
+    assert(y < depth->height && x0 <= x1 && x1 <= depth->width && step > 0);
+    size_t first = ((size_t)y * depth->width + x0) * depth->samples;
+    size_t stride = (size_t)step * depth->samples;
+    unsigned int n = (x1 - x0 + step - 1) / step;
+    unsigned int x;
+    if (depth->format == DEPTH_FLOAT) {
+        const float *d = (const float *)depth->data + first;
+        for (x = 0; x < n; ++x) {
+            out[x] = d[x * stride];
+        }
+        return;
+    }
+    // inverse of depthValue, 0 stays 0; float is plenty for a post pass and the loops vectorize
+    double max = formats[depth->format].max;
+    float scale = (depth->nearest - depth->farthest) / (max - 1);
+    float base = depth->farthest - scale;
+    if (depth->format == DEPTH_16) {
+        const uint16_t *d = (const uint16_t *)depth->data + first;
+        for (x = 0; x < n; ++x) {
+            float v = d[x * stride];
+            out[x] = v != 0 ? base + scale * v : 0.0f;
+        }
+    } else if (depth->format == DEPTH_24) {
+        // 24 bits fit a signed int, which converts without the unsigned fixup
+        const int32_t *d = (const int32_t *)depth->data + first;
+        for (x = 0; x < n; ++x) {
+            float v = d[x * stride];
+            out[x] = v != 0 ? base + scale * v : 0.0f;
+        }
+    } else {
+        const uint32_t *d = (const uint32_t *)depth->data + first;
+        for (x = 0; x < n; ++x) {
+            float v = d[x * stride];
+            out[x] = v != 0 ? base + scale * v : 0.0f;
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#ifndef DEPTH_H_
+#define DEPTH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Larger values are closer to the camera for every format, so the test is
+ * always `>` and every format but the legacy one clears to all zero bits.
+ */
+enum depthFormat {
+    DEPTH_LEGACY, // int, (z + 1)*255/2 like triangle(), about 256 levels
+    DEPTH_16,     // uint16_t, fixed point over the depth range
+    DEPTH_24,     // 24 bit fixed point kept in a uint32_t
+    DEPTH_32,     // uint32_t, fixed point over the depth range
+    DEPTH_FLOAT,  // float 1/w, reversed-Z: 0 at infinity
+    DEPTH_FORMATS
+};
+
+#define DEPTH_DEFAULT DEPTH_24
+
+typedef struct depthBuffer {
+    int format;
+    unsigned int width;
+    unsigned int height;
+    unsigned int samples; // per pixel, sample major within a pixel
+    size_t count;         // width * height * samples
+    void *data;
+    double nearest;       // 1/w mapped to the largest fixed point value
+    double farthest;      // 1/w mapped to 1
+} depthBuffer;
+
+depthBuffer * depthNew(unsigned int width, unsigned int height, unsigned int samples, int format);
+void depthFree(depthBuffer *depth);
+
+// bytes of storage a buffer needs, for callers that carve it out themselves
+size_t depthBytes(unsigned int width, unsigned int height, unsigned int samples, int format);
+// sets up a buffer over storage owned by the caller, not cleared, never depthFree'd
+void depthInit(depthBuffer *depth, void *data, unsigned int width, unsigned int height, unsigned int samples, int format);
+
+// memset for all formats but DEPTH_LEGACY
+void depthClear(depthBuffer *depth);
+// pixels [x0, x1] x [y0, y1], every sample
+void depthClearRect(depthBuffer *depth, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1);
+
+// "legacy", "16", "24", "32" or "float", NULL if out of range
+const char * depthFormatName(int format);
+// -1 if unknown
+int depthParseFormat(const char *name);
+
+/*
+ * Fixed point formats spend their levels on [farthest, nearest] in 1/w,
+ * fitted to the vertices of the draw. 1/w is affine in screen space so it
+ * is interpolated with the barycentric weights like the legacy depth.
+ */
+void depthFitRange(depthBuffer *depth, const double *invw, unsigned int n);
+
+// per vertex value in buffer units, clamped to the range; behind the camera maps to 0
+double depthValue(const depthBuffer *depth, double invw);
+/*
+ * 1/w of every step-th pixel of row y from x0 to before x1, first sample,
+ * 0 where nothing was drawn; out holds (x1 - x0 + step - 1) / step values.
+ * Not for DEPTH_LEGACY.
+ */
+void depthRowInvW(const depthBuffer *depth, unsigned int y, unsigned int x0, unsigned int x1, unsigned int step,
+                  float *out);
+// buffer units between the farthest and the nearest value, for offsets relative to the range
+double depthSpan(const depthBuffer *depth);
+
+/* test and write `z` (buffer units) at index `i`, 1 if it passed */
+static inline __attribute__((always_inline))
+int depthTestWrite(void *data, size_t i, double z, const int format)
+{
+    switch (format) {
+    case DEPTH_LEGACY: {
+        int *d = (int *)data;
+        int v = (int)(z + 0.5);
+        if (v > d[i]) {
+            d[i] = v;
+            return 1;
+        }
+        return 0;
+    }
+    case DEPTH_16: {
+        uint16_t *d = (uint16_t *)data;
+        uint16_t v = (uint16_t)(z + 0.5);
+        if (v > d[i]) {
+            d[i] = v;
+            return 1;
+        }
+        return 0;
+    }
+    case DEPTH_24:
+    case DEPTH_32: {
+        uint32_t *d = (uint32_t *)data;
+        uint32_t v = (uint32_t)(z + 0.5);
+        if (v > d[i]) {
+            d[i] = v;
+            return 1;
+        }
+        return 0;
+    }
+    case DEPTH_FLOAT: {
+        float *d = (float *)data;
+        float v = (float)z;
+        if (v > d[i]) {
+            d[i] = v;
+            return 1;
+        }
+        return 0;
+    }
+    }
+    return 0;
+}
+
+/* test only, `z` at index `i` is not behind the stored value */
+static inline __attribute__((always_inline))
+int depthTest(const void *data, size_t i, double z, const int format)
+{
+    switch (format) {
+    case DEPTH_LEGACY:
+        return (int)(z + 0.5) >= ((const int *)data)[i];
+    case DEPTH_16:
+        return z + 0.5 >= ((const uint16_t *)data)[i];
+    case DEPTH_24:
+    case DEPTH_32:
+        return z + 0.5 >= ((const uint32_t *)data)[i];
+    case DEPTH_FLOAT:
+        return (float)z >= ((const float *)data)[i];
+    }
+    return 0;
+}
+
+#endif // DEPTH_H_
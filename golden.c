@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "tga.h"
+#include "model.h"
+#include "raster.h"
+#include "context.h"
+#include "stream.h"
+
+#define GOLDEN_CHUNK_FACES 1000 // faces per chunk of the stream path
+#define GOLDEN_SPHERE "golden_out/sphere.obj"
+#define GOLDEN_NORMAL_MAP "cat_norm.tga"
+#define GOLDEN_SPECULAR_MAP "cat_diff.tga" /* blue is the exponent, obj/cat_spec.tga is truncated */
+
+/*
+ * Golden-image check: every bundled asset is rendered through the
+ * reference path (plain triangle() per face) and through each render path
+ * listed in `paths`, and the images are compared. Paths that must give
+ * the pixels of another one exactly are compared with that one instead.
+ * A path fails when too many pixels differ or PSNR/SSIM drop below its
+ * thresholds; the expected, actual and amplified difference images are
+ * then written to outdir.
+ */
+
+typedef void (*renderPath)(tgaImage *image, Model *model);
+
+typedef struct goldenPath {
+    const char *name;
+    renderPath render;
+    renderPath match;        /* expected image, NULL for the reference */
+    double max_bad_fraction; /* pixels with any channel off by more than `tolerance` */
+    int tolerance;
+    double min_psnr;         /* dB, ignored when images are identical */
+    double min_ssim;
+} goldenPath;
+
+typedef struct goldenAsset {
+    const char *name;
+    const char *obj;
+    const char *diffuse;
+    int reference;           /* also against the reference, whose tolerances assume triangles of many pixels */
+} goldenAsset;
+
+typedef struct imageDiff {
+    int max_diff;
+    double bad_fraction;
+    double psnr;
+    double ssim;
+} imageDiff;
+
+/* the baseline renderer: project the corners of every face and call triangle() */
+static void renderReference(tgaImage *image, Model *model)
+{
+    unsigned int i, j;
+	Vec3 light = { 0.0, 0.0, 1.0 };
+    int *zbuffer = (int *)malloc(image->width * image->height * sizeof(int));
+    for (i = 0; i < image->width * image->height; ++i) {
+        zbuffer[i] = -10000;
+    }
+    Vector *screen = (Vector *)malloc(model->nvert * sizeof(Vector));
+    projectVertices(image, model, screen);
+    for (j = 0; j < model->nface; ++j) {
+        double I = intension(getVertex(model, j, 0), getVertex(model, j, 1), getVertex(model, j, 2), light);
+        triangle(image, model,
+                 screen[getVertexIndex(model, j, 0)],
+                 screen[getVertexIndex(model, j, 1)],
+                 screen[getVertexIndex(model, j, 2)],
+                 *getDiffuseUV(model, j, 0), *getDiffuseUV(model, j, 1), *getDiffuseUV(model, j, 2),
+                 d_abs(I), zbuffer);
+    }
+    free(screen);
+    free(zbuffer);
+}
+
+static void renderLegacyDepth(tgaImage *image, Model *model)
+{
+    renderModelDepth(image, model, SHADING_FLAT, 1, DEPTH_LEGACY);
+}
+
+static void renderMsaa4(tgaImage *image, Model *model)
+{
+    renderModelMsaa(image, model, SHADING_FLAT, 4);
+}
+
+/* the frame of renderModel through a context over image, tile by tile */
+static void renderTiled(tgaImage *image, Model *model, unsigned int tile)
+{
+    renderContext *ctx = renderNewContextForImage(image, 1, DEPTH_DEFAULT);
+    if (!ctx) {
+        return;
+    }
+    renderDrawTiled(ctx, model, SHADING_FLAT, tile, NULL, NULL);
+    renderFreeContext(ctx);
+}
+
+static void renderTiled64(tgaImage *image, Model *model)
+{
+    renderTiled(image, model, 64);
+}
+
+/* tiles cut the image unevenly and faces straddle more of them */
+static void renderTiled37(tgaImage *image, Model *model)
+{
+    renderTiled(image, model, 37);
+}
+
+/* the frame of renderModel with small triangles going through the general loop one by one */
+static void renderUnbatched(tgaImage *image, Model *model)
+{
+    renderContext *ctx = renderNewContextForImage(image, 1, DEPTH_DEFAULT);
+    if (!ctx) {
+        return;
+    }
+    ctx->small_batches = 0;
+    renderDrawModel(ctx, model, SHADING_FLAT);
+    renderFreeContext(ctx);
+}
+
+/* directory of the assets, for the maps the shaded paths load */
+static const char *asset_dir = ".";
+
+/*
+ * A lit draw that reaches the variants renderModel doesn't: maps adds the
+ * normal and specular maps for phong, pcf >= 0 a shadow pass from a light
+ * off to the side. generic draws the same with shaderGeneric.
+ */
+static void renderShaded(tgaImage *image, Model *model, int shading, int maps, int pcf, int samples, int generic)
+{
+    char path[1024];
+    if (maps) {
+        snprintf(path, sizeof(path), "%s/%s", asset_dir, GOLDEN_NORMAL_MAP);
+        loadNormalMap(model, path);
+        snprintf(path, sizeof(path), "%s/%s", asset_dir, GOLDEN_SPECULAR_MAP);
+        loadSpecularMap(model, path);
+    }
+    renderContext *ctx = renderNewContextForImage(image, samples, DEPTH_DEFAULT);
+    renderContext *shadow = NULL;
+    if (ctx && pcf >= 0) {
+        Vec3 light = { 1.0, 1.0, 1.0 };
+        Vec3 bounds[2];
+        renderSetLight(ctx, light);
+        shadow = renderNewContext(RENDER_SHADOW_SIZE, RENDER_SHADOW_SIZE, 1, DEPTH_FLOAT);
+        if (shadow) {
+            modelBounds(model, bounds);
+            renderSetLightCamera(shadow, ctx->light, bounds[0], bounds[1]);
+            renderDrawModel(shadow, model, SHADING_DEPTH);
+            renderSetShadow(ctx, shadow, pcf);
+        }
+    }
+    if (ctx && (pcf < 0 || shadow)) {
+        ctx->generic_shading = generic;
+        renderDrawModel(ctx, model, shading);
+        renderResolve(ctx);
+    }
+    renderFreeContext(ctx);
+    renderFreeContext(shadow);
+    if (maps && model->normal_map) {
+        tgaFreeImage(model->normal_map);
+        model->normal_map = NULL;
+    }
+    if (maps && model->specular_map) {
+        tgaFreeImage(model->specular_map);
+        model->specular_map = NULL;
+    }
+}
+
+static void renderGouraud(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_GOURAUD, 0, -1, 1, 0);
+}
+
+static void renderGouraudGeneric(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_GOURAUD, 0, -1, 1, 1);
+}
+
+static void renderPhongMaps(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_PHONG, 1, -1, 1, 0);
+}
+
+static void renderPhongMapsGeneric(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_PHONG, 1, -1, 1, 1);
+}
+
+/* a single texel per lookup */
+static void renderFlatShadow(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_FLAT, 0, 0, 1, 0);
+}
+
+static void renderFlatShadowGeneric(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_FLAT, 0, 0, 1, 1);
+}
+
+static void renderGouraudShadow(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_GOURAUD, 0, 1, 1, 0);
+}
+
+static void renderGouraudShadowGeneric(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_GOURAUD, 0, 1, 1, 1);
+}
+
+/* every variant input at once, through the sample loops */
+static void renderPhongMapsShadowMsaa(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_PHONG, 1, 2, 4, 0);
+}
+
+static void renderPhongMapsShadowMsaaGeneric(tgaImage *image, Model *model)
+{
+    renderShaded(image, model, SHADING_PHONG, 1, 2, 4, 1);
+}
+
+/* every tile replaces the preview, cleared to the black of a new image */
+static void renderProgressiveFinal(tgaImage *image, Model *model)
+{
+    renderContext *ctx = renderNewContextForImage(image, 1, DEPTH_DEFAULT);
+    if (!ctx) {
+        return;
+    }
+    renderProgressive(ctx, model, NULL, SHADING_FLAT, tgaRGB(0, 0, 0), RENDER_TILE, NULL, NULL);
+    renderFreeContext(ctx);
+}
+
+/* obj file of the asset being checked, the stream reads it again */
+static const char *asset_obj = NULL;
+
+/* converted to a mesh and drawn in chunks small enough to hit their boundaries */
+static void renderStream(tgaImage *image, Model *model)
+{
+    char tmp[4096];
+    const char *dir = getenv("TMPDIR");
+    snprintf(tmp, sizeof(tmp), "%s/goldenXXXXXX", dir ? dir : "/tmp");
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror(tmp);
+        return;
+    }
+    close(fd);
+    meshStream *stream = NULL;
+    if (-1 == convertObjToMesh(asset_obj, tmp) || !(stream = streamOpen(tmp, GOLDEN_CHUNK_FACES))) {
+        fprintf(stderr, "Can't stream %s\n", asset_obj);
+        unlink(tmp);
+        return;
+    }
+    unlink(tmp);
+    renderContext *ctx = renderNewContextForImage(image, 1, DEPTH_DEFAULT);
+    if (ctx) {
+        // the maps are borrowed from the whole model for the chunks
+        stream->chunk->diffuse_map = model->diffuse_map;
+        renderFitDepth(ctx, stream->lo, stream->hi);
+        Model *chunk;
+        while ((chunk = streamNext(stream))) {
+            renderDrawModel(ctx, chunk, SHADING_FLAT);
+        }
+        if (stream->error) {
+            fprintf(stderr, "%s is truncated or has a bad index\n", asset_obj);
+        }
+        stream->chunk->diffuse_map = NULL;
+        renderFreeContext(ctx);
+    }
+    streamClose(stream);
+}
+
+static const goldenPath paths[] = {
+    /* name         render             match        bad    tol  psnr   ssim */
+    /* the reference quantizes depth to ~256 levels, only z-fighting pixels may differ */
+    { "renderModel", renderModel,       NULL,        0.002, 0,   40.0,  0.998 },
+    { "depthLegacy", renderLegacyDepth, NULL,        0.0,   0,   99.0,  1.0 },
+    /* edges are blended and interiors shade at sample centroids */
+    { "msaa4",       renderMsaa4,       NULL,        0.01,  16,  35.0,  0.99 },
+    /* the small triangle batches must cover exactly the pixels the general loop does */
+    { "smallBatch",  renderModel,       renderUnbatched, 0.0, 0, 99.0,  1.0 },
+    { "tiled64",     renderTiled64,     renderModel, 0.0,   0,   99.0,  1.0 },
+    { "tiled37",     renderTiled37,     renderModel, 0.0,   0,   99.0,  1.0 },
+    { "progressive", renderProgressiveFinal, renderModel, 0.0, 0, 99.0, 1.0 },
+    /* chunks renumber their vertices, the pixels mustn't move */
+    { "stream",      renderStream,      renderModel, 0.0,   0,   99.0,  1.0 },
+    /* the specialized shaders against the generic loop on the same input */
+    { "gouraud",     renderGouraud,     renderGouraudGeneric, 0.0, 0, 99.0, 1.0 },
+    { "phongMaps",   renderPhongMaps,   renderPhongMapsGeneric, 0.0, 0, 99.0, 1.0 },
+    { "flatShadow",  renderFlatShadow,  renderFlatShadowGeneric, 0.0, 0, 99.0, 1.0 },
+    { "gouraudShadow", renderGouraudShadow, renderGouraudShadowGeneric, 0.0, 0, 99.0, 1.0 },
+    { "phongAllMsaa4", renderPhongMapsShadowMsaa, renderPhongMapsShadowMsaaGeneric, 0.0, 0, 99.0, 1.0 },
+};
+
+static const goldenAsset assets[] = {
+    { "cat",    "cat.obj",        "cat_diff.tga", 1 },
+    { "africa", "obj/africa.obj", "cat_diff.tga", 1 },
+    /* written by `make check` with meshgen, triangles of about a pixel */
+    { "sphere", GOLDEN_SPHERE,    "cat_diff.tga", 0 },
+};
+
+static double luma(tgaImage *image, unsigned int x, unsigned int y)
+{
+    tgaColor c = tgaGetPixel(image, x, y);
+    if (image->bpp == GRAYSCALE) {
+        return c & 0xff;
+    }
+    return 0.299 * Red(c) + 0.587 * Green(c) + 0.114 * Blue(c);
+}
+
+/* mean SSIM over 8x8 luma windows with stride 4 */
+static double ssim(tgaImage *a, tgaImage *b)
+{
+    const double C1 = (0.01 * 255) * (0.01 * 255);
+    const double C2 = (0.03 * 255) * (0.03 * 255);
+    const unsigned int win = 8;
+    double total = 0.0;
+    unsigned int windows = 0;
+    unsigned int x0, y0, x, y;
+    for (y0 = 0; y0 + win <= a->height; y0 += win / 2) {
+        for (x0 = 0; x0 + win <= a->width; x0 += win / 2) {
+            double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+            for (y = y0; y < y0 + win; ++y) {
+                for (x = x0; x < x0 + win; ++x) {
+                    double la = luma(a, x, y);
+                    double lb = luma(b, x, y);
+                    sa += la;
+                    sb += lb;
+                    saa += la * la;
+                    sbb += lb * lb;
+                    sab += la * lb;
+                }
+            }
+            double n = win * win;
+            double ma = sa / n, mb = sb / n;
+            double va = saa / n - ma * ma;
+            double vb = sbb / n - mb * mb;
+            double cov = sab / n - ma * mb;
+            total += ((2 * ma * mb + C1) * (2 * cov + C2)) /
+                     ((ma * ma + mb * mb + C1) * (va + vb + C2));
+            ++windows;
+        }
+    }
+    return windows ? total / windows : 1.0;
+}
+
+static void compareImages(tgaImage *a, tgaImage *b, int tolerance, imageDiff *d)
+{
+    unsigned int i;
+    unsigned int size = a->width * a->height * a->bpp;
+    unsigned int bad = 0;
+    double se = 0.0;
+    d->max_diff = 0;
+    for (i = 0; i < a->width * a->height; ++i) {
+        unsigned int k;
+        int pixel_diff = 0;
+        for (k = 0; k < a->bpp; ++k) {
+            int diff = abs((int)a->data[i * a->bpp + k] - (int)b->data[i * a->bpp + k]);
+            se += diff * diff;
+            if (diff > pixel_diff) {
+                pixel_diff = diff;
+            }
+        }
+        if (pixel_diff > tolerance) {
+            ++bad;
+        }
+        if (pixel_diff > d->max_diff) {
+            d->max_diff = pixel_diff;
+        }
+    }
+    d->bad_fraction = (double)bad / (a->width * a->height);
+    double mse = se / size;
+    d->psnr = (mse > 0) ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+    d->ssim = (mse > 0) ? ssim(a, b) : 1.0;
+}
+
+/* |a - b| per channel, amplified so one-step differences are visible */
+static tgaImage * diffImage(tgaImage *a, tgaImage *b)
+{
+    tgaImage *d = tgaNewImage(a->height, a->width, a->bpp);
+    if (!d) {
+        return NULL;
+    }
+    unsigned int i;
+    for (i = 0; i < a->width * a->height * a->bpp; ++i) {
+        int diff = abs((int)a->data[i] - (int)b->data[i]) * 16;
+        d->data[i] = diff > 255 ? 255 : diff;
+    }
+    return d;
+}
+
+static void saveImage(tgaImage *image, const char *outdir, const char *asset, const char *path, const char *kind)
+{
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s/%s_%s_%s.tga", outdir, asset, path, kind);
+    tgaFlipVertically(image);
+    if (-1 == tgaSaveToFile(image, filename)) {
+        perror(filename);
+    }
+    tgaFlipVertically(image);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-d assetdir] [-o outdir] [-s size]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = ".";
+    const char *outdir = ".";
+    unsigned int size = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:o:s:")) != -1) {
+        switch (opt) {
+        case 'd': dir = asset_dir = optarg; break;
+        case 'o': outdir = optarg; break;
+        case 's': size = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!size) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    int failed = 0;
+    unsigned int a, p;
+    printf("%-8s %-16s %8s %9s %9s %8s\n", "asset", "path", "max diff", "bad %", "PSNR dB", "SSIM");
+    for (a = 0; a < sizeof(assets) / sizeof(assets[0]); ++a) {
+        char obj[1024], diffuse[1024];
+        snprintf(obj, sizeof(obj), "%s/%s", dir, assets[a].obj);
+        snprintf(diffuse, sizeof(diffuse), "%s/%s", dir, assets[a].diffuse);
+        Model *model = loadModel(obj);
+        if (!model) {
+            perror(obj);
+            return -1;
+        }
+        /* a missing map is fine, getDiffuseColor falls back to white */
+        loadDiffuseMap(model, diffuse);
+
+        asset_obj = obj;
+        tgaImage *reference = NULL;
+        if (assets[a].reference) {
+            reference = tgaNewImage(size, size, RGB);
+            renderReference(reference, model);
+        }
+        for (p = 0; p < sizeof(paths) / sizeof(paths[0]); ++p) {
+            const goldenPath *gp = &paths[p];
+            if (!gp->match && !assets[a].reference) {
+                continue;
+            }
+            tgaImage *expected = reference;
+            if (gp->match) {
+                expected = tgaNewImage(size, size, RGB);
+                gp->match(expected, model);
+            }
+            tgaImage *actual = tgaNewImage(size, size, RGB);
+            gp->render(actual, model);
+
+            imageDiff d;
+            compareImages(expected, actual, gp->tolerance, &d);
+            int ok = d.bad_fraction <= gp->max_bad_fraction &&
+                     (isinf(d.psnr) || d.psnr >= gp->min_psnr) &&
+                     d.ssim >= gp->min_ssim;
+            printf("%-8s %-16s %8d %9.4f %9.2f %8.5f %s\n", assets[a].name, gp->name,
+                   d.max_diff, d.bad_fraction * 100, d.psnr, d.ssim, ok ? "ok" : "FAIL");
+            if (!ok) {
+                failed = 1;
+                tgaImage *diff = diffImage(expected, actual);
+                saveImage(expected, outdir, assets[a].name, gp->name, "expected");
+                saveImage(actual, outdir, assets[a].name, gp->name, "actual");
+                if (diff) {
+                    saveImage(diff, outdir, assets[a].name, gp->name, "diff");
+                    tgaFreeImage(diff);
+                }
+            }
+            tgaFreeImage(actual);
+            if (expected != reference) {
+                tgaFreeImage(expected);
+            }
+        }
+        if (reference) {
+            tgaFreeImage(reference);
+        }
+        freeModel(model);
+    }
+    renderModelRelease();
+    return failed;
+}
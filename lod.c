@@ -0,0 +1,562 @@
+#include "lod.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+
+#define BOUNDARY_WEIGHT 100.0 // how hard open borders resist moving
+#define MIN_NORMAL_DOT 0.2    // a collapse may not turn a face further than this
+
+typedef struct quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+} quadric;
+
+typedef struct collapse {
+    double cost;
+    unsigned int a, b;
+    unsigned int stamp_a, stamp_b; // stale once either vertex changed
+} collapse;
+
+typedef struct collapseHeap {
+    collapse *data;
+    size_t count;
+    size_t cap;
+} collapseHeap;
+
+/* faces around each vertex, lists are rewritten at the end of `pool` on merge */
+typedef struct faceLists {
+    unsigned int *pool;
+    size_t used;
+    size_t cap;
+    size_t *start;
+    unsigned int *count;
+} faceLists;
+
+static void addPlane(quadric *q, double a, double b, double c, double d, double w)
+{
+    q->a2 += w*a*a; q->ab += w*a*b; q->ac += w*a*c; q->ad += w*a*d;
+    q->b2 += w*b*b; q->bc += w*b*c; q->bd += w*b*d;
+    q->c2 += w*c*c; q->cd += w*c*d;
+    q->d2 += w*d*d;
+}
+
+static void addQuadric(quadric *q, const quadric *r)
+{
+    q->a2 += r->a2; q->ab += r->ab; q->ac += r->ac; q->ad += r->ad;
+    q->b2 += r->b2; q->bc += r->bc; q->bd += r->bd;
+    q->c2 += r->c2; q->cd += r->cd;
+    q->d2 += r->d2;
+}
+
+static double quadricError(const quadric *q, const Vec3 v)
+{
+    double x = v[0], y = v[1], z = v[2];
+    return q->a2*x*x + 2*q->ab*x*y + 2*q->ac*x*z + 2*q->ad*x
+         + q->b2*y*y + 2*q->bc*y*z + 2*q->bd*y
+         + q->c2*z*z + 2*q->cd*z
+         + q->d2;
+}
+
+/* position minimizing the summed quadric, or the best of the ends and middle */
+static double collapseTarget(const quadric *qa, const quadric *qb, const Vec3 pa, const Vec3 pb, Vec3 out)
+{
+    quadric q = *qa;
+    addQuadric(&q, qb);
+    double det = q.a2*(q.b2*q.c2 - q.bc*q.bc) - q.ab*(q.ab*q.c2 - q.bc*q.ac) + q.ac*(q.ab*q.bc - q.b2*q.ac);
+    if (fabs(det) > 1e-12) {
+        // Cramer's rule on the upper 3x3 block against -(ad, bd, cd)
+        double bx = -q.ad, by = -q.bd, bz = -q.cd;
+        out[0] = (bx*(q.b2*q.c2 - q.bc*q.bc) - q.ab*(by*q.c2 - q.bc*bz) + q.ac*(by*q.bc - q.b2*bz)) / det;
+        out[1] = (q.a2*(by*q.c2 - q.bc*bz) - bx*(q.ab*q.c2 - q.bc*q.ac) + q.ac*(q.ab*bz - by*q.ac)) / det;
+        out[2] = (q.a2*(q.b2*bz - by*q.bc) - q.ab*(q.ab*bz - by*q.ac) + bx*(q.ab*q.bc - q.b2*q.ac)) / det;
+        return quadricError(&q, out);
+    }
+    Vec3 mid = { (pa[0] + pb[0]) / 2, (pa[1] + pb[1]) / 2, (pa[2] + pb[2]) / 2 };
+    const double *candidates[3] = { pa, pb, mid };
+    double best = 0;
+    int i;
+    for (i = 0; i < 3; ++i) {
+        double e = quadricError(&q, candidates[i]);
+        if (i == 0 || e < best) {
+            best = e;
+            memcpy(out, candidates[i], sizeof(Vec3));
+        }
+    }
+    return best;
+}
+
+static int heapPush(collapseHeap *h, const collapse *c)
+{
+    if (h->count == h->cap) {
+        size_t cap = h->cap ? h->cap * 2 : 1024;
+        collapse *data = (collapse *)realloc(h->data, cap * sizeof(collapse));
+        if (!data) {
+            return -1;
+        }
+        h->data = data;
+        h->cap = cap;
+    }
+    size_t i = h->count++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (h->data[parent].cost <= c->cost) {
+            break;
+        }
+        h->data[i] = h->data[parent];
+        i = parent;
+    }
+    h->data[i] = *c;
+    return 0;
+}
+
+static void heapPop(collapseHeap *h, collapse *out)
+{
+    *out = h->data[0];
+    collapse last = h->data[--h->count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= h->count) {
+            break;
+        }
+        if (child + 1 < h->count && h->data[child + 1].cost < h->data[child].cost) {
+            ++child;
+        }
+        if (last.cost <= h->data[child].cost) {
+            break;
+        }
+        h->data[i] = h->data[child];
+        i = child;
+    }
+    if (h->count) {
+        h->data[i] = last;
+    }
+}
+
+static int compareKeys(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t edgeKey(unsigned int a, unsigned int b)
+{
+    return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+static void faceNormal(const Vec3 *pos, const Face f, Vec3 n)
+{
+    const double *p0 = pos[f[0]], *p1 = pos[f[3]], *p2 = pos[f[6]];
+    Vec3 e1 = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    Vec3 e2 = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    product_vec3(e1, e2, (Vec3 *)n);
+}
+
+static int listsAppend(faceLists *l, unsigned int face)
+{
+    if (l->used == l->cap) {
+        unsigned int *pool = (unsigned int *)realloc(l->pool, l->cap * 2 * sizeof(unsigned int));
+        if (!pool) {
+            return -1;
+        }
+        l->pool = pool;
+        l->cap *= 2;
+    }
+    l->pool[l->used++] = face;
+    return 0;
+}
+
+static int pushEdge(collapseHeap *heap, const quadric *Q, const Vec3 *pos, const unsigned int *stamp,
+                     unsigned int a, unsigned int b)
+{
+    collapse c;
+    Vec3 target;
+    c.cost = collapseTarget(&Q[a], &Q[b], pos[a], pos[b], target);
+    c.a = a;
+    c.b = b;
+    c.stamp_a = stamp[a];
+    c.stamp_b = stamp[b];
+    return heapPush(heap, &c);
+}
+
+/* 1 if moving a and b to target turns any surviving face around them over */
+static int flips(const faceLists *lists, const Face *faces, const unsigned char *dead, const Vec3 *pos,
+                 unsigned int a, unsigned int b, const Vec3 target)
+{
+    unsigned int ends[2] = { a, b };
+    int e;
+    for (e = 0; e < 2; ++e) {
+        unsigned int v = ends[e];
+        unsigned int k;
+        for (k = 0; k < lists->count[v]; ++k) {
+            unsigned int f = lists->pool[lists->start[v] + k];
+            if (dead[f]) {
+                continue;
+            }
+            const unsigned int *F = faces[f];
+            if ((F[0] == a || F[3] == a || F[6] == a) && (F[0] == b || F[3] == b || F[6] == b)) {
+                continue; // removed by the collapse
+            }
+            Vec3 before, after;
+            faceNormal(pos, faces[f], before);
+            Vec3 p[3];
+            int c;
+            for (c = 0; c < 3; ++c) {
+                memcpy(p[c], F[c * 3] == v ? target : pos[F[c * 3]], sizeof(Vec3));
+            }
+            Vec3 e1 = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+            Vec3 e2 = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+            product_vec3(e1, e2, &after);
+            double lb = v_length(before), la = v_length(after);
+            if (la == 0 || (lb > 0 && product_dot(before, after) < MIN_NORMAL_DOT * lb * la)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+Model * simplifyModel(Model *model, unsigned int target_faces)
+{
+    assert(model);
+    unsigned int n = model->nvert;
+    unsigned int m = model->nface;
+    unsigned int i, k;
+
+    Vec3 *pos = (Vec3 *)malloc((n + 1) * sizeof(Vec3));
+    Face *faces = (Face *)malloc((m + 1) * sizeof(Face));
+    quadric *Q = (quadric *)calloc(n + 1, sizeof(quadric));
+    unsigned int *stamp = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+    unsigned int *mark = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+    unsigned char *removed = (unsigned char *)calloc(n + 1, 1);
+    unsigned char *dead = (unsigned char *)calloc(m + 1, 1);
+    uint64_t *keys = (uint64_t *)malloc(((size_t)3 * m + 1) * sizeof(uint64_t));
+    faceLists lists;
+    lists.cap = (size_t)3 * m + 64;
+    lists.used = 0;
+    lists.pool = (unsigned int *)malloc(lists.cap * sizeof(unsigned int));
+    lists.start = (size_t *)calloc(n + 1, sizeof(size_t));
+    lists.count = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+    collapseHeap heap = { NULL, 0, 0 };
+    Model *out = NULL;
+    if (!pos || !faces || !Q || !stamp || !mark || !removed || !dead || !keys ||
+        !lists.pool || !lists.start || !lists.count) {
+        goto out;
+    }
+    memcpy(pos, model->vertices, n * sizeof(Vec3));
+    memcpy(faces, model->faces, m * sizeof(Face));
+
+    // area weighted plane of every face into its corners
+    for (i = 0; i < m; ++i) {
+        Vec3 normal;
+        faceNormal(pos, faces[i], normal);
+        double len = v_length(normal);
+        for (k = 0; k < 3; ++k) {
+            keys[3 * i + k] = edgeKey(faces[i][k * 3], faces[i][((k + 1) % 3) * 3]);
+        }
+        if (len == 0) {
+            continue;
+        }
+        normal_vec3(&normal, len);
+        double d = -product_dot(normal, pos[faces[i][0]]);
+        for (k = 0; k < 3; ++k) {
+            addPlane(&Q[faces[i][k * 3]], normal[0], normal[1], normal[2], d, len / 2);
+        }
+    }
+    qsort(keys, (size_t)3 * m, sizeof(uint64_t), compareKeys);
+
+    // an edge used by only one face is on a border: add a plane through it
+    // perpendicular to the face so collapses keep the outline
+    for (i = 0; i < m; ++i) {
+        Vec3 normal;
+        faceNormal(pos, faces[i], normal);
+        double len = v_length(normal);
+        if (len == 0) {
+            continue;
+        }
+        normal_vec3(&normal, len);
+        for (k = 0; k < 3; ++k) {
+            unsigned int a = faces[i][k * 3], b = faces[i][((k + 1) % 3) * 3];
+            uint64_t key = edgeKey(a, b);
+            uint64_t *at = (uint64_t *)bsearch(&key, keys, (size_t)3 * m, sizeof(uint64_t), compareKeys);
+            if ((at > keys && at[-1] == key) || (at + 1 < keys + (size_t)3 * m && at[1] == key)) {
+                continue;
+            }
+            Vec3 edge = { pos[b][0] - pos[a][0], pos[b][1] - pos[a][1], pos[b][2] - pos[a][2] };
+            Vec3 side;
+            product_vec3(edge, normal, &side);
+            double sl = v_length(side);
+            if (sl == 0) {
+                continue;
+            }
+            normal_vec3(&side, sl);
+            double d = -product_dot(side, pos[a]);
+            double w = BOUNDARY_WEIGHT * product_dot(edge, edge);
+            addPlane(&Q[a], side[0], side[1], side[2], d, w);
+            addPlane(&Q[b], side[0], side[1], side[2], d, w);
+        }
+    }
+
+    // faces around every vertex, counted then filled
+    for (i = 0; i < m; ++i) {
+        for (k = 0; k < 3; ++k) {
+            ++lists.count[faces[i][k * 3]];
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        lists.start[i] = lists.used;
+        lists.used += lists.count[i];
+        lists.count[i] = 0;
+    }
+    for (i = 0; i < m; ++i) {
+        for (k = 0; k < 3; ++k) {
+            unsigned int v = faces[i][k * 3];
+            lists.pool[lists.start[v] + lists.count[v]++] = i;
+        }
+    }
+
+    size_t e;
+    for (e = 0; e < (size_t)3 * m; ++e) {
+        if (e && keys[e] == keys[e - 1]) {
+            continue;
+        }
+        unsigned int a = keys[e] >> 32, b = keys[e] & 0xffffffffu;
+        if (a != b && -1 == pushEdge(&heap, Q, pos, stamp, a, b)) {
+            goto out;
+        }
+    }
+    free(keys);
+    keys = NULL;
+
+    unsigned int alive = m;
+    unsigned int round = 0;
+    while (alive > target_faces && heap.count) {
+        collapse c;
+        heapPop(&heap, &c);
+        unsigned int a = c.a, b = c.b;
+        if (removed[a] || removed[b] || stamp[a] != c.stamp_a || stamp[b] != c.stamp_b) {
+            continue;
+        }
+        Vec3 target;
+        collapseTarget(&Q[a], &Q[b], pos[a], pos[b], target);
+        if (flips(&lists, faces, dead, pos, a, b, target)) {
+            continue;
+        }
+
+        // b goes into a
+        memcpy(pos[a], target, sizeof(Vec3));
+        addQuadric(&Q[a], &Q[b]);
+        removed[b] = 1;
+        ++stamp[a];
+        size_t start = lists.used;
+        unsigned int count = 0;
+        unsigned int ends[2] = { a, b };
+        int t;
+        for (t = 0; t < 2; ++t) {
+            unsigned int v = ends[t];
+            unsigned int nv = lists.count[v];
+            size_t sv = lists.start[v];
+            for (k = 0; k < nv; ++k) {
+                unsigned int f = lists.pool[sv + k];
+                if (dead[f]) {
+                    continue;
+                }
+                unsigned int *F = faces[f];
+                int has_a = F[0] == a || F[3] == a || F[6] == a;
+                int has_b = F[0] == b || F[3] == b || F[6] == b;
+                if (has_a && has_b) {
+                    dead[f] = 1;
+                    --alive;
+                    continue;
+                }
+                if (has_b) {
+                    int c3;
+                    for (c3 = 0; c3 < 9; c3 += 3) {
+                        if (F[c3] == b) {
+                            F[c3] = a;
+                        }
+                    }
+                }
+                if (-1 == listsAppend(&lists, f)) {
+                    goto out;
+                }
+                // lists.pool may have moved
+                ++count;
+            }
+        }
+        lists.start[a] = start;
+        lists.count[a] = count;
+        lists.count[b] = 0;
+
+        // new costs for every edge around a, once per neighbour
+        ++round;
+        for (k = 0; k < count; ++k) {
+            const unsigned int *F = faces[lists.pool[start + k]];
+            int c3;
+            for (c3 = 0; c3 < 9; c3 += 3) {
+                unsigned int w = F[c3];
+                if (w != a && mark[w] != round) {
+                    mark[w] = round;
+                    if (-1 == pushEdge(&heap, Q, pos, stamp, a, w)) {
+                        goto out;
+                    }
+                }
+            }
+        }
+    }
+
+    // compact the surviving vertices in order
+    unsigned int *remap = mark; // reused, no longer needed for rounds
+    unsigned int nvert = 0, nface = 0;
+    for (i = 0; i < n; ++i) {
+        remap[i] = removed[i] ? UINT32_MAX : nvert++;
+    }
+    for (i = 0; i < m; ++i) {
+        if (!dead[i] && faces[i][0] != faces[i][3] && faces[i][3] != faces[i][6] && faces[i][0] != faces[i][6]) {
+            ++nface;
+        }
+    }
+    out = createModel(nvert, model->ntext, model->nnorm, nface);
+    if (out) {
+        for (i = 0; i < n; ++i) {
+            if (!removed[i]) {
+                memcpy(out->vertices[remap[i]], pos[i], sizeof(Vec3));
+            }
+        }
+        memcpy(out->textures, model->textures, model->ntext * sizeof(Vec3));
+        memcpy(out->normals, model->normals, model->nnorm * sizeof(Vec3));
+        unsigned int j = 0;
+        for (i = 0; i < m; ++i) {
+            if (dead[i] || faces[i][0] == faces[i][3] || faces[i][3] == faces[i][6] || faces[i][0] == faces[i][6]) {
+                continue;
+            }
+            memcpy(out->faces[j], faces[i], sizeof(Face));
+            for (k = 0; k < 9; k += 3) {
+                out->faces[j][k] = remap[faces[i][k]];
+            }
+            ++j;
+        }
+    }
+
+out:
+    free(keys);
+    free(heap.data);
+    free(lists.pool);
+    free(lists.start);
+    free(lists.count);
+    free(dead);
+    free(removed);
+    free(mark);
+    free(stamp);
+    free(Q);
+    free(faces);
+    free(pos);
+    return out;
+}
+
+static void shareMaps(Model *level, Model *model)
+{
+    level->diffuse_map = model->diffuse_map;
+    level->normal_map = model->normal_map;
+    level->specular_map = model->specular_map;
+    if ((model->normal_map || model->tangents) && level->textures && level->ntext) {
+        computeTangents(level);
+    }
+}
+
+modelLod * buildLod(Model *model)
+{
+    assert(model);
+    modelLod *lod = (modelLod *)calloc(1, sizeof(modelLod));
+    if (!lod) {
+        return NULL;
+    }
+    lod->levels[0] = model;
+    lod->nlevels = 1;
+
+    unsigned int i;
+    Vec3 lo, hi;
+    for (i = 0; i < model->nvert; ++i) {
+        int k;
+        for (k = 0; k < 3; ++k) {
+            if (!i || model->vertices[i][k] < lo[k]) lo[k] = model->vertices[i][k];
+            if (!i || model->vertices[i][k] > hi[k]) hi[k] = model->vertices[i][k];
+        }
+    }
+    if (model->nvert) {
+        for (i = 0; i < 3; ++i) {
+            lod->center[i] = (lo[i] + hi[i]) / 2;
+        }
+    }
+    for (i = 0; i < model->nvert; ++i) {
+        Vec3 d = { model->vertices[i][0] - lod->center[0],
+                   model->vertices[i][1] - lod->center[1],
+                   model->vertices[i][2] - lod->center[2] };
+        double r = v_length(d);
+        if (r > lod->radius) {
+            lod->radius = r;
+        }
+    }
+
+    while (lod->nlevels < LOD_MAX_LEVELS) {
+        Model *prev = lod->levels[lod->nlevels - 1];
+        if (prev->nface / 2 < LOD_MIN_FACES) {
+            break;
+        }
+        Model *level = simplifyModel(prev, prev->nface / 2);
+        if (!level) {
+            // out of memory, the caller still owns model
+            lod->levels[0] = NULL;
+            freeLod(lod);
+            return NULL;
+        }
+        if (level->nface > prev->nface * 3 / 4) { // stuck on borders or flips
+            freeModel(level);
+            break;
+        }
+        shareMaps(level, model);
+        lod->levels[lod->nlevels++] = level;
+    }
+    return lod;
+}
+
+void freeLod(modelLod *lod)
+{
+    if (!lod) {
+        return;
+    }
+    unsigned int i;
+    for (i = 1; i < lod->nlevels; ++i) {
+        // maps belong to levels[0]
+        lod->levels[i]->diffuse_map = NULL;
+        lod->levels[i]->normal_map = NULL;
+        lod->levels[i]->specular_map = NULL;
+        freeModel(lod->levels[i]);
+    }
+    if (lod->levels[0]) {
+        freeModel(lod->levels[0]);
+    }
+    free(lod);
+}
+
+Model * lodSelect(modelLod *lod, Mat4x4 camera, unsigned int width, unsigned int height)
+{
+    Mat4x1 c = { lod->center[0], lod->center[1], lod->center[2], 1.0 };
+    Mat4x1 V;
+    product_mat(camera, c, &V);
+    if (V[3] <= 0) {
+        return lod->levels[0];
+    }
+    // ndc units are half the image, the camera matrix keeps lengths
+    double r = lod->radius / V[3] * (width > height ? width : height) / 2;
+    double budget = M_PI * r * r * LOD_FACES_PER_PIXEL;
+    int i;
+    for (i = lod->nlevels - 1; i > 0; --i) {
+        if (lod->levels[i]->nface >= budget) {
+            return lod->levels[i];
+        }
+    }
+    return lod->levels[0];
+}
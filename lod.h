@@ -0,0 +1,40 @@
+#ifndef LOD_H_
+#define LOD_H_
+
+#include "model.h"
+#include "raster.h"
+
+#define LOD_MAX_LEVELS 16
+#define LOD_MIN_FACES 256       // the chain stops below this
+#define LOD_FACES_PER_PIXEL 1.0 // budget over the projected bounding disc
+
+/*
+ * Quadric error metric edge collapse (Garland and Heckbert) down to about
+ * target_faces. Boundary edges are held in place by extra constraint
+ * planes and collapses that would flip a face are skipped, so the result
+ * can keep more faces than asked for. Texture and normal indices of the
+ * surviving corners are kept as they are. Maps are not copied. NULL when
+ * out of memory.
+ */
+Model * simplifyModel(Model *model, unsigned int target_faces);
+
+/* levels[0] is the full model, every next level has about half the faces */
+typedef struct modelLod {
+    unsigned int nlevels;
+    Model *levels[LOD_MAX_LEVELS];
+    Vec3 center;   // bounding sphere of levels[0]
+    double radius;
+} modelLod;
+
+/*
+ * Takes ownership of model. Maps already loaded on it are shared by every
+ * level, tangents are computed per level when it has them or a normal map.
+ * NULL when out of memory, model then stays with the caller.
+ */
+modelLod * buildLod(Model *model);
+void freeLod(modelLod *lod);
+
+// coarsest level with enough faces for the projected size under the camera
+Model * lodSelect(modelLod *lod, Mat4x4 camera, unsigned int width, unsigned int height);
+
+#endif // LOD_H_
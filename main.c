@@ -1,318 +1,754 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
 #include <math.h>
 #include "tga.h"
 #include "model.h"
+#include "raster.h"
+#include "context.h"
+#include "optimize.h"
+#include "stream.h"
+#include "scene.h"
+#include "ssao.h"
+#include "scale.h"
+#include "output.h"
+#include "stats.h"
 
-typedef int Vector[3];
-typedef double Mat4x4[4][4];
-typedef double Mat4x1[4];
- 
-void swap(int *a, int *b);
-int abs(int a);
-double d_abs(double a);
-int Round(double a);
-int c_length(int a, int b, int c, int *s);
-void product_vec3(Vec3 A, Vec3 B, Vec3 *W);
-double v_length(Vec3 A);
-double product_dot(Vec3 A, Vec3 B);
-double intension (Vec3* v0, Vec3* v1, Vec3* v2, Vec3 light);
-void normal_vec3(Vec3* A, double l);
-void product_mat(Mat4x4 A, Mat4x1 B, Mat4x1* C);
+enum wireMode { WIRE_NONE, WIRE_OVERLAY, WIRE_XRAY, WIRE_ONLY };
 
+#define WIRE_COLOR tgaRGB(255, 255, 255)
 
-void line (tgaImage *image, 
-           int x0, int y0,
-           int x1, int y1,
-           tgaColor color);
-void triangle(tgaImage *image, Model* model, Vector a, Vector b, Vector c, Vec3 UVa, Vec3 UVb, Vec3 UVc, double I, int* zbuffer);
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] model.obj|model.mesh diffuse.tga outfile.tga\n"
+                    "       %s [options] --scene file outfile.tga\n"
+                    "       %s [options] --scaling file.csv model.obj diffuse.tga\n"
+                    "  --shading mode         depth|flat|gouraud|phong (default flat)\n"
+                    "  --normal-map file      tangent space normal map, implies phong\n"
+                    "  --specular-map file    specular map, implies phong\n"
+                    "  --depth format         legacy|16|24|32|float depth buffer (default 24)\n"
+                    "  --size WxH             output size (default 1000x1000)\n"
+                    "  --format name          tga|tga-rle|ppm|pam|png|png-stored|raw, default from\n"
+                    "                         the outfile extension, - as outfile writes to stdout\n"
+                    "  --turntable frames     orbit the camera around the y axis, every frame goes\n"
+                    "                         to the outfile in turn (stdout or a fifo, raw by\n"
+                    "                         default) or to numbered files with a %%d outfile\n"
+                    "  --optimize             reorder faces and vertices for locality after loading\n"
+                    "  --stream               draw the mesh in chunks without loading it whole,\n"
+                    "                         obj files are converted to a temporary mesh first\n"
+                    "  --lod                  build a simplified chain and draw the level fitting the size\n"
+                    "  --scene file           draw the meshes and instances listed in file\n"
+                    "  --msaa samples         anti-aliasing with 2, 4 or 8 samples per pixel\n"
+                    "  --progressive          write a low resolution preview first, then refine it\n"
+                    "                         tile by tile, in place for an uncompressed tga\n"
+                    "  --tile size            tile size of --progressive (default 64)\n"
+                    "  --light x,y,z          direction towards the light (default 0,0,1)\n"
+                    "  --shadows pcf          shadow map pass from the light, softened over\n"
+                    "                         (2 pcf + 1)^2 texels, 0 for hard edges\n"
+                    "  --ssao radius          darken creases and contacts within radius (world\n"
+                    "                         units, try 0.05) by screen space ambient occlusion\n"
+                    "  --ssao-full            work out the occlusion at full resolution, not half\n"
+                    "  --wireframe mode       draw the edges of the model: overlay (visible edges\n"
+                    "                         over the shaded model), xray (every edge over it) or\n"
+                    "                         only (visible edges on black)\n"
+                    "  --scaling file.csv     time the frame from %ux%u up to the largest size with\n"
+                    "                         1 to the most threads, one context with threaded\n"
+                    "                         ssao and encoding and one context per thread, with\n"
+                    "                         peak memory and allocation counts; --ssao sets the\n"
+                    "                         radius (default %g), --format the encoder (png)\n"
+                    "  --threads n            most threads of --scaling (default every online cpu)\n"
+                    "  --scaling-max size     largest square size of --scaling (default %u)\n"
+                    "  --stats                print stage times and counters to stderr\n"
+                    "  --stats-json file      write stage times and counters as json, - for stdout\n"
+                    "                         (stderr when the image goes to stdout)\n",
+            prog, prog, prog, SCALE_MIN_SIZE, SCALE_MIN_SIZE, SCALE_SSAO_RADIUS, SCALE_MAX_SIZE);
+}
 
-int main(int argc, char **argv)
+static void loadMaps(Model *model, const char *diffuse_path, const char *normal_path, const char *specular_path)
 {
-    int rv = 0;
-    if (argc < 4) {
-        fprintf(stderr, "Usage: %s directory to obj or outfile \n ", argv[0]);
-        return -1;
+    statsBegin(STAGE_TEXTURE);
+    if (!loadDiffuseMap(model, diffuse_path)) {
+        fprintf(stderr, "Can't load diffuse map %s\n", diffuse_path);
     }
-    tgaImage * image = tgaNewImage(1000, 1000, RGB);
-    Model *model = loadFromObj(argv[1]);
-	int DiffuseMap = loadDiffuseMap(model, argv[2]); printf("%d", DiffuseMap);
-    int i,j;
-    double I;
-    double coef = 3.0;
-    double r = -1/coef;
-	Vec3 h = {0.0,1.0,0.0};
-	normal_vec3(&h,v_length(h));
-	Vec3 e = {1.0,0.0,0.0};
-	normal_vec3(&e,v_length(e));
-	Vec3 c = {0.0,0.5,0.0};
-	Vec3 l = {0.0,0.0,0.0};
-	Vec3 light = { 0.0, 0.0, 100.0 };
-	normal_vec3(&light,v_length(light));
-	product_vec3(e,h,&l);
-	normal_vec3(&l,v_length(l));
-    Mat4x4 vw1 = {
-               {e[0], h[0], l[0], 0.0},
-               {e[1], h[1], l[1], 0.0},
-               {e[2], h[2], l[2], 0.0},
-               {0.0, 0.0, 0.0, 1.0}
-               };
-    Mat4x4 vw2 = {
-               {1.0, 0.0, 0.0, -c[0]},
-               {0.0, 1.0, 0.0, -c[1]},
-               {0.0, 0.0, 1.0, -c[2]},
-               {0.0, 0.0, 0.0, 1.0}
-               };
-    Mat4x4 a = {
-               {1.0, 0.0, 0.0, 0.0},
-               {0.0, 1.0, 0.0, 0.0},
-               {0.0, 0.0, 1.0, 0.0},
-               {0.0, 0.0,   r, 1.0}
-               };
-    Mat4x1 b, V,newV = {0.0,0.0,0.0};
-    Vector A, B, C;
-    int* z_buffer = malloc(image->width*image->height*sizeof(int));
-        for (i = 0; i < image->height; ++i) {
-            for (j = 0; j < image->width; ++j) {
-                z_buffer[j + i*image->width] = -10000;
-            }
-        } 
-    for(j = 0; j < model->nface; ++j) {
-	Vec3 *v0 = getVertex(model, j, 0);
-	Vec3 *v1 = getVertex(model, j, 1);
-	Vec3 *v2 = getVertex(model, j, 2);
-	Vec3 *uv0 = getDiffuseUV(model, j, 0);
-	Vec3 *uv1 = getDiffuseUV(model, j, 1);
-	Vec3 *uv2 = getDiffuseUV(model, j, 2);
-	Vec3 UVa, UVb, UVc;
-	UVa[0] = (*uv0)[0];
-	UVa[1] = (*uv0)[1];
-	UVa[2] = (*uv0)[2];
-	UVb[0] = (*uv1)[0];
-	UVb[1] = (*uv1)[1];
-    	UVb[2] = (*uv1)[2];
-	UVc[0] = (*uv2)[0];
-   	UVc[1] = (*uv2)[1];
-   	UVc[2] = (*uv2)[2];
-
-        for(i = 0; i < 3; ++i) {
-            b[i] = (*v0)[i];
-        }
-        b[3] = 1;
-
-	product_mat(vw2,b,&V);
-	product_mat(vw1,V,&b);
-        product_mat(a, b, &V);
+    if (normal_path && !loadNormalMap(model, normal_path)) {
+        fprintf(stderr, "Can't load normal map %s\n", normal_path);
+    }
+    if (specular_path && !loadSpecularMap(model, specular_path)) {
+        fprintf(stderr, "Can't load specular map %s\n", specular_path);
+    }
+    statsEnd(STAGE_TEXTURE);
+}
 
-        A[0] = (V[0]/V[3] + 1)*image->width/2;
-		A[1] = (V[1]/V[3] + 1)*image->height / 2;
-		A[2] = (V[2]/V[3] + 1)*255/2;
-        for(i = 0; i < 3; ++i) {
-            b[i] = (*v1)[i];
+/*
+ * 1 when path takes the frame number in a single %d, other percent signs
+ * written %%; 0 without any percent sign, -1 for anything else.
+ */
+static int framePattern(const char *path)
+{
+    int digits = 0;
+    const char *p;
+    if (!strchr(path, '%')) {
+        return 0;
+    }
+    for (p = path; *p; ++p) {
+        if (*p != '%') {
+            continue;
         }
-        b[3] = 1;
-
-	product_mat(vw2,b,&V);
-	product_mat(vw1,V,&b);
-        product_mat(a, b, &V);
-
-		B[0] = (V[0]/V[3] + 1)*image->width / 2;
-		B[1] = (V[1]/V[3] + 1)*image->height / 2;
-		B[2] = (V[2]/V[3] + 1) *255/2;
-        for(i = 0; i < 3; ++i) {
-            b[i] = (*v2)[i];
+        ++p;
+        if (*p == 'd') {
+            ++digits;
+        } else if (*p != '%') {
+            return -1;
         }
-        b[3] = 1;
-
-	product_mat(vw2,b,&V);
-	product_mat(vw1,V,&b);
-        product_mat(a, b, &V);
-
-		C[0] = (V[0]/V[3] + 1)*image->width / 2;
-		C[1] = (V[1]/V[3] + 1)*image->height / 2;
-        C[2] = (V[2]/V[3] + 1)*255/2; 
-        I = intension(v0, v1, v2, light);  
-		triangle(image, model, A, B, C,UVa, UVb, UVc, d_abs(I), z_buffer);
-    }
-    tgaFlipVertically(image);
-    if (-1 == tgaSaveToFile(image, argv[3])) {
-        perror("tgaSateToFile");
-        rv = -1;
     }
-    free(z_buffer);
-    tgaFreeImage(image); 
-	freeModel(model);
-    return rv;
+    return digits == 1 ? 1 : -1;
 }
 
-void line (tgaImage *image, 
-           int x0, int y0,
-           int x1, int y1,
-           tgaColor color)
-{  
-    int flag = 0;
-    int dx = abs(x1 - x0);
-    int dy = abs(y1 - y0);
-    if (dx < dy) {
-	    swap(&x0,&y0);
-	    swap(&x1,&y1);
-	    swap(&dx,&dy);
-        flag = 1;
-    }
-    if (x0 > x1) {
-        swap(&x0,&x1);
-	    swap(&y0,&y1);
-    }
-    int e = 0;
-    int de = 2*abs(y1 - y0);
-    int i;
-    int x = x0;
-    int y = y0;	
-    for (i = 0;i <= dx; ++i) {
-	if (e >= dx) {
-        e -= 2*dx;
-	    if (y1 < y0) { 	
-            y -= 1;
-	    } else {
-	        y += 1;
-	    }
-        }
-	if (flag) {
-	    tgaSetPixel(image, y, x, color);
-	} else {
-	    tgaSetPixel(image, x, y, color);
-	}
-	x += 1;
-	e += de;
+/* pattern checked by framePattern, expanded by hand so it is never a format string */
+static void framePath(char *path, size_t size, const char *pattern, int frame)
+{
+    size_t n = 0;
+    const char *p;
+    for (p = pattern; *p && n + 1 < size; ++p) {
+        if (*p != '%') {
+            path[n++] = *p;
+        } else if (*++p == '%') {
+            path[n++] = '%';
+        } else {
+            n += snprintf(path + n, size - n, "%d", frame);
+            if (n >= size) {
+                n = size - 1;
+            }
+        }
     }
+    path[n] = '\0';
 }
 
-void triangle(tgaImage *image, Model* model, Vector a, Vector b, Vector c, Vec3 UVa, Vec3 UVb, Vec3 UVc, double I, int* zbuffer) {
-    int i0 = 0;
-    int i1 = c_length(a[1], b[1], c[1], &i0);
-    int j0 = 0;
-    int j1 = c_length(a[0], b[0], c[0], &j0);
-    Vector P;
-	Vec3 Puv, X, Y, W;
-    tgaColor col;
-    int i,j;
-    double U = 0;
-    double V = 0;
-    for (i = i0; i <= i1; ++i) {
-       P[1] = i; 
-       for (j = j0; j <= j1; ++j) {
-           P[0] = j;
-           X[0] = a[0] - P[0]; 
-           X[1] = b[0] - a[0]; 
-           X[2] = c[0] - a[0];
-           Y[0] = a[1] - P[1]; 
-           Y[1] = b[1] - a[1]; 
-           Y[2] = c[1] - a[1]; 
-           product_vec3(X, Y, &W);
-           U = W[1]/W[0];
-           V = W[2]/W[0];
-           if ((U < 0) || (V < 0) || ((1 - U - V) < 0)) {
-               continue;
-           }
-           P[2] = (int)((1 - U - V)*a[2] + U*b[2] + V*c[2] + 0.5);
-		   Puv[0] = (1 - U - V)*UVa[0] + U*UVb[0] + V*UVc[0];
-		   Puv[1] = (1 - U - V)*UVa[1] + U*UVb[1] + V*UVc[1];
-               if (P[2] > zbuffer[j + i*image->width]) {
-                   zbuffer[j + i*image->width] = P[2];
-		   col=getDiffuseColor(model, &Puv);
-                   tgaSetPixel(image, P[0], P[1], tgaRGB(I*Red(col), I*Green(col), I*Blue(col)) );
-               }
-       }
+static int isMesh(const char *path)
+{
+    FILE *fd = fopen(path, "rb");
+    if (!fd) {
+        return 0;
     }
-}
-void swap(int *a, int *b) {
-    int t = *a;
-    *a = *b;
-    *b = t;
+    char magic[4];
+    int is_mesh = (1 == fread(magic, sizeof(magic), 1, fd)) && !memcmp(magic, MESH_MAGIC, 4);
+    fclose(fd);
+    return is_mesh;
 }
 
-int c_length(int A, int B, int C, int *s) {
-    int a = A;
-    int b = B;
-    int c = C;
-    if (a >= b) {
-        swap(&a, &b);
+/* obj files are converted to a temporary mesh, unlinked once open */
+static meshStream * openStream(const char *path, const char *diffuse_path,
+                               const char *normal_path, const char *specular_path)
+{
+    const char *mesh_path = path;
+    char tmp[4096];
+    if (!isMesh(path)) {
+        const char *dir = getenv("TMPDIR");
+        snprintf(tmp, sizeof(tmp), "%s/renderXXXXXX", dir ? dir : "/tmp");
+        int fd = mkstemp(tmp);
+        if (fd < 0) {
+            perror(tmp);
+            return NULL;
+        }
+        close(fd);
+        statsBegin(STAGE_PARSE);
+        int rv = convertObjToMesh(path, tmp);
+        statsEnd(STAGE_PARSE);
+        if (-1 == rv) {
+            fprintf(stderr, "Can't convert %s\n", path);
+            unlink(tmp);
+            return NULL;
+        }
+        mesh_path = tmp;
     }
-    if (a >= c) {
-        swap(&a, &c);
+    meshStream *stream = streamOpen(mesh_path, STREAM_CHUNK_FACES);
+    if (mesh_path != path) {
+        unlink(tmp); // the open descriptor keeps it readable
     }
-    if (b >= c) {
-        swap(&b, &c);
+    if (!stream) {
+        perror("streamOpen");
+        return NULL;
     }
-    *s = a;
-    return c ;
+    loadMaps(stream->chunk, diffuse_path, normal_path, specular_path);
+    return stream;
 }
 
-int abs(int a) {
-    return (a > 0) ? a : -a;
+/* the memory used stays the same whatever the size of the mesh */
+static int drawStream(renderContext *ctx, meshStream *stream, const char *path, int shading)
+{
+    streamRewind(stream);
+    renderFitDepth(ctx, stream->lo, stream->hi);
+    for (;;) {
+        statsBegin(STAGE_PARSE);
+        Model *chunk = streamNext(stream);
+        statsEnd(STAGE_PARSE);
+        if (!chunk) {
+            break;
+        }
+        if (-1 == renderDrawModel(ctx, chunk, shading)) {
+            fprintf(stderr, "Out of memory drawing %s\n", path);
+            return -1;
+        }
+    }
+    if (stream->error) {
+        fprintf(stderr, "%s is truncated or has a bad index\n", path);
+        return -1;
+    }
+    return 0;
 }
 
-double d_abs(double a) {
-    return (a > 0) ? a : -a;
+/* the preview is written whole, tiles then go in place when the file is an uncompressed tga */
+typedef struct progressOut {
+    const char *path;
+    int format;
+    FILE *fd;
+    double first;       // wall time of the preview
+    int error;
+} progressOut;
+
+static void writeProgress(void *user, tgaImage *image, unsigned int x, unsigned int y,
+                          unsigned int width, unsigned int height)
+{
+    progressOut *po = (progressOut *)user;
+    if (po->error) {
+        return;
+    }
+    if (x == 0 && y == 0 && width == image->width && height == image->height) {
+        if (!po->first) {
+            po->first = statsWallTime();
+        }
+        if (po->format == OUTPUT_TGA && strcmp(po->path, "-")) {
+            if (!po->fd && !(po->fd = fopen(po->path, "wb"))) {
+                po->error = -1;
+                return;
+            }
+            rewind(po->fd);
+            po->error = outputWrite(image, po->fd, po->format, 0, OUTPUT_BOTTOM_UP);
+        } else {
+            po->error = outputSave(image, po->path, po->format, 0, OUTPUT_BOTTOM_UP);
+        }
+    } else if (po->fd) {
+        // rows are stored top first after the 18 byte header
+        size_t len = (size_t)width * image->bpp;
+        unsigned int j;
+        for (j = y; j < y + height && !po->error; ++j) {
+            long offset = 18 + ((long)(image->height - 1 - j) * image->width + x) * image->bpp;
+            if (-1 == fseek(po->fd, offset, SEEK_SET) ||
+                1 != fwrite(image->data + ((size_t)j * image->width + x) * image->bpp, len, 1, po->fd)) {
+                po->error = -1;
+            }
+        }
+    }
+    if (po->fd && EOF == fflush(po->fd)) {
+        po->error = -1;
+    }
 }
 
-int Round(double a) {
-    int b = a;
-    if ((a - b) >= 0.5) {
-        return (b + 1);
+static int scaling(const scaleParams *params, const char *model_path, const char *diffuse_path,
+                   const char *normal_path, const char *specular_path, const char *csv_path)
+{
+    Model *model = loadModel(model_path);
+    if (!model) {
+        perror("loadModel");
+        return -1;
+    }
+    loadMaps(model, diffuse_path, normal_path, specular_path);
+    FILE *csv = strcmp(csv_path, "-") ? fopen(csv_path, "w") : stdout;
+    int rv = -1;
+    if (!csv) {
+        perror(csv_path);
     } else {
-	return b;
+        rv = scaleRun(model, params, csv);
+        if ((csv != stdout && EOF == fclose(csv)) || (csv == stdout && EOF == fflush(csv))) {
+            perror(csv_path);
+            rv = -1;
+        }
     }
+    freeModel(model);
+    return rv;
 }
 
-void product_vec3(Vec3 A, Vec3 B, Vec3* W) {
-    (*W)[0] = A[1]*B[2] - A[2]*B[1];
-    (*W)[1] = B[0]*A[2] - A[0]*B[2];
-    (*W)[2] = A[0]*B[1] - A[1]*B[0];
-}
+int main(int argc, char **argv)
+{
+    int rv = 0;
+    int print_stats = 0;
+    const char *stats_json = NULL;
+    const char *normal_path = NULL;
+    const char *specular_path = NULL;
+    int shading = SHADING_FLAT;
+    int samples = 1;
+    int depth = DEPTH_DEFAULT;
+    int use_lod = 0;
+    int optimize = 0;
+    int stream = 0;
+    const char *scene_path = NULL;
+    int format = -1;
+    int frames = 1;
+    int progressive = 0;
+    unsigned int tile = RENDER_TILE;
+    int wireframe = WIRE_NONE;
+    int shadows = -1;
+    ssaoParams ssao = { 0.0, 1.0, 0, 0 };
+    int has_light = 0;
+    Vec3 light;
+    unsigned int width = 1000, height = 1000;
+    const char *scaling_path = NULL;
+    unsigned int scaling_threads = 0, scaling_max = SCALE_MAX_SIZE;
+    static struct option long_options[] = {
+        {"stats",        no_argument,       0, 's'},
+        {"stats-json",   required_argument, 0, 'j'},
+        {"shading",      required_argument, 0, 'S'},
+        {"normal-map",   required_argument, 0, 'n'},
+        {"specular-map", required_argument, 0, 'p'},
+        {"msaa",         required_argument, 0, 'm'},
+        {"depth",        required_argument, 0, 'd'},
+        {"size",         required_argument, 0, 'z'},
+        {"lod",          no_argument,       0, 'l'},
+        {"optimize",     no_argument,       0, 'O'},
+        {"stream",       no_argument,       0, 'T'},
+        {"scene",        required_argument, 0, 'c'},
+        {"format",       required_argument, 0, 'f'},
+        {"turntable",    required_argument, 0, 'r'},
+        {"progressive",  no_argument,       0, 'P'},
+        {"tile",         required_argument, 0, 't'},
+        {"wireframe",    required_argument, 0, 'w'},
+        {"light",        required_argument, 0, 'L'},
+        {"shadows",      required_argument, 0, 'H'},
+        {"ssao",         required_argument, 0, 'a'},
+        {"ssao-full",    no_argument,       0, 'A'},
+        {"scaling",      required_argument, 0, 'B'},
+        {"threads",      required_argument, 0, 'N'},
+        {"scaling-max",  required_argument, 0, 'X'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            print_stats = 1;
+            break;
+        case 'j':
+            stats_json = optarg;
+            break;
+        case 'S':
+            if (!strcmp(optarg, "depth")) {
+                shading = SHADING_DEPTH;
+            } else if (!strcmp(optarg, "flat")) {
+                shading = SHADING_FLAT;
+            } else if (!strcmp(optarg, "gouraud")) {
+                shading = SHADING_GOURAUD;
+            } else if (!strcmp(optarg, "phong")) {
+                shading = SHADING_PHONG;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'n':
+            normal_path = optarg;
+            shading = SHADING_PHONG;
+            break;
+        case 'p':
+            specular_path = optarg;
+            shading = SHADING_PHONG;
+            break;
+        case 'm':
+            samples = atoi(optarg);
+            if (!validSampleCount(samples)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'd':
+            depth = depthParseFormat(optarg);
+            if (depth < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'z':
+            if (2 != sscanf(optarg, "%ux%u", &width, &height) || !width || !height) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'l':
+            use_lod = 1;
+            break;
+        case 'L':
+            if (3 != sscanf(optarg, "%lf,%lf,%lf", &light[0], &light[1], &light[2]) ||
+                (!light[0] && !light[1] && !light[2])) {
+                usage(argv[0]);
+                return -1;
+            }
+            has_light = 1;
+            break;
+        case 'a':
+            ssao.radius = atof(optarg);
+            if (ssao.radius <= 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'A':
+            ssao.full = 1;
+            break;
+        case 'B':
+            scaling_path = optarg;
+            break;
+        case 'N':
+            scaling_threads = atoi(optarg);
+            if (!scaling_threads) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'X':
+            scaling_max = atoi(optarg);
+            if (scaling_max < SCALE_MIN_SIZE) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'H':
+            shadows = atoi(optarg);
+            if (shadows < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'O':
+            optimize = 1;
+            break;
+        case 'T':
+            stream = 1;
+            break;
+        case 'c':
+            scene_path = optarg;
+            break;
+        case 'r':
+            frames = atoi(optarg);
+            if (frames < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'P':
+            progressive = 1;
+            break;
+        case 't':
+            tile = atoi(optarg);
+            if (!tile) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'w':
+            if (!strcmp(optarg, "overlay")) {
+                wireframe = WIRE_OVERLAY;
+            } else if (!strcmp(optarg, "xray")) {
+                wireframe = WIRE_XRAY;
+            } else if (!strcmp(optarg, "only")) {
+                wireframe = WIRE_ONLY;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'f':
+            format = outputParseFormat(optarg);
+            if (format < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (scaling_path) {
+        if (argc - optind < 2) {
+            usage(argv[0]);
+            return -1;
+        }
+        scaleParams params = { shading, samples, depth, format < 0 ? OUTPUT_PNG : format, ssao,
+                               scaling_threads, scaling_max };
+        if (params.ssao.radius <= 0) {
+            params.ssao.radius = SCALE_SSAO_RADIUS;
+        }
+        return scaling(&params, argv[optind], argv[optind + 1], normal_path, specular_path, scaling_path);
+    }
+    if (argc - optind < (scene_path ? 1 : 3)) {
+        usage(argv[0]);
+        return -1;
+    }
+    const char *model_path = scene_path ? NULL : argv[optind];
+    const char *diffuse_path = scene_path ? NULL : argv[optind + 1];
+    const char *out_path = scene_path ? argv[optind] : argv[optind + 2];
+    statsEnable(print_stats || stats_json);
+    double start = statsWallTime();
 
-double product_dot(Vec3 A, Vec3 B) {
-    double dot = A[0]*B[0] + A[1]*B[1] + A[2]*B[2];
-    return dot;
-} 
+    renderContext *ctx = renderNewContext(width, height, samples, depth);
+    if (!ctx) {
+        perror("renderNewContext");
+        return -1;
+    }
+    Model *model = NULL;
+    modelLod *lod = NULL;
+    scene *sc = NULL;
+    meshStream *ms = NULL;
+    Vec3 eye = { 0.0, 0.5, 3.0 }, center = { 0.0, 0.5, 0.0 }, up = { 0.0, 1.0, 0.0 };
+    if (scene_path) {
+        if (use_lod || optimize || stream) {
+            fprintf(stderr, "--lod, --optimize and --stream are ignored with --scene\n");
+        }
+        statsBegin(STAGE_PARSE);
+        sc = sceneLoad(scene_path);
+        statsEnd(STAGE_PARSE);
+        if (!sc) {
+            renderFreeContext(ctx);
+            return -1;
+        }
+        if (sc->has_camera) {
+            memcpy(eye, sc->eye, sizeof(Vec3));
+            memcpy(center, sc->center, sizeof(Vec3));
+            memcpy(up, sc->up, sizeof(Vec3));
+        }
+        if (sc->has_light) {
+            renderSetLight(ctx, sc->light);
+        }
+    } else if (stream) {
+        if (use_lod || optimize) {
+            fprintf(stderr, "--lod and --optimize need the whole mesh, ignored with --stream\n");
+        }
+        ms = openStream(model_path, diffuse_path, normal_path, specular_path);
+        if (!ms) {
+            renderFreeContext(ctx);
+            return -1;
+        }
+    } else {
+        statsBegin(STAGE_PARSE);
+        model = loadModel(model_path);
+        if (model && optimize && -1 == optimizeModel(model)) {
+            fprintf(stderr, "Can't optimize %s, drawing it in file order\n", model_path);
+        }
+        statsEnd(STAGE_PARSE);
+        if (!model) {
+            perror("loadModel");
+            renderFreeContext(ctx);
+            return -1;
+        }
+        loadMaps(model, diffuse_path, normal_path, specular_path);
 
-double v_length(Vec3 A) {
-    double length = sqrt(A[0]*A[0] + A[1]*A[1] + A[2]*A[2]);
-    return length;
-}
-double intension (Vec3* v0, Vec3* v1, Vec3* v2, Vec3 light) {
-    Vec3 AB, AC;
-    AB[0] = (*v1)[0] - (*v0)[0];
-    AB[1] = (*v1)[1] - (*v0)[1];
-    AB[2] = (*v1)[2] - (*v0)[2];
-    AC[0] = (*v2)[0] - (*v0)[0];
-    AC[1] = (*v2)[1] - (*v0)[1];
-    AC[2] = (*v2)[2] - (*v0)[2];
-    Vec3 W;
-    product_vec3(AB, AC, &W);
-    W[0] = -W[0];
-    W[1] = -W[1];
-    W[2] = -W[2];
-    normal_vec3(&W, v_length(W));
-    return product_dot(light, W); 
-}
+        if (use_lod) {
+            statsBegin(STAGE_PARSE);
+            lod = buildLod(model);
+            statsEnd(STAGE_PARSE);
+            if (!lod) {
+                perror("buildLod");
+                renderFreeContext(ctx);
+                freeModel(model);
+                return -1;
+            }
+        }
+    }
 
-void normal_vec3(Vec3* A, double l) {
-    (*A)[0] = (*A)[0]/l;
-    (*A)[1] = (*A)[1]/l;
-    (*A)[2] = (*A)[2]/l;
-}
+    if (progressive && (sc || ms || frames > 1)) {
+        fprintf(stderr, "--progressive draws a single model, ignored with --scene, --stream and --turntable\n");
+        progressive = 0;
+    }
+    if (progressive && ssao.radius > 0) {
+        fprintf(stderr, "--ssao needs the finished frame, ignored with --progressive\n");
+        ssao.radius = 0;
+    }
+    if (has_light) {
+        renderSetLight(ctx, light);
+    }
 
-void product_mat(Mat4x4 A, Mat4x1 B, Mat4x1* C) {
-    int i,j;
-    Mat4x1 V = {0.0, 0.0, 0.0, 0.0};
-    for(i=0; i < 4; ++i) {
-        for(j=0; j < 4; ++j) {
-            V[i] = V[i] + A[i][j]*B[j];
+    // the light and the world don't move between frames, one shadow pass does for all
+    renderContext *shadow = NULL;
+    double shadow_time = 0.0;
+    if (shadows >= 0 && ms) {
+        fprintf(stderr, "--shadows needs the bounds of the whole mesh, ignored with --stream\n");
+    } else if (shadows >= 0) {
+        shadow = renderNewContext(RENDER_SHADOW_SIZE, RENDER_SHADOW_SIZE, 1, DEPTH_FLOAT);
+        if (!shadow) {
+            perror("renderNewContext");
+            rv = -1;
+        } else {
+            Vec3 bounds[2];
+            int drawn;
+            shadow_time = statsWallTime();
+            if (sc) {
+                sceneBounds(sc, bounds[0], bounds[1]);
+                renderSetLightCamera(shadow, ctx->light, bounds[0], bounds[1]);
+                drawn = sceneDraw(shadow, sc, SHADING_DEPTH);
+            } else {
+                modelBounds(model, bounds);
+                renderSetLightCamera(shadow, ctx->light, bounds[0], bounds[1]);
+                drawn = renderDrawModel(shadow, model, SHADING_DEPTH);
+            }
+            shadow_time = statsWallTime() - shadow_time;
+            if (drawn < 0) {
+                fprintf(stderr, "Out of memory for the shadow pass\n");
+                rv = -1;
+            }
+            renderSetShadow(ctx, shadow, shadows);
+        }
+    }
+
+    modelEdges *edges = NULL;
+    if (wireframe != WIRE_NONE) {
+        if (!model || lod || progressive) {
+            fprintf(stderr, "--wireframe draws a single model, ignored with --scene, --stream, --lod and --progressive\n");
+            wireframe = WIRE_NONE;
+        } else {
+            statsBegin(STAGE_PARSE);
+            edges = wireEdges(model);
+            statsEnd(STAGE_PARSE);
+            if (!edges) {
+                perror("wireEdges");
+                rv = -1;
+                frames = 0;
+            }
+        }
+        if (wireframe == WIRE_ONLY) {
+            shading = SHADING_DEPTH;
         }
-        (*C)[i] = V[i];
     }
-}
 
+    // one file per frame with a %d pattern, otherwise every frame follows the last
+    int numbered = frames > 1 ? framePattern(out_path) : 0;
+    if (numbered < 0) {
+        fprintf(stderr, "%s: a --turntable outfile takes one %%d for the frame, write other percent signs as %%%%\n",
+                out_path);
+        rv = -1;
+        frames = 0;
+    }
+    FILE *out = NULL;
+    if (format < 0) {
+        format = frames > 1 && !numbered ? OUTPUT_RAW : outputFormatFromPath(out_path);
+    }
+    if (frames > 1 && !numbered) {
+        out = strcmp(out_path, "-") ? fopen(out_path, "wb") : stdout;
+        if (!out) {
+            perror(out_path);
+            rv = -1;
+            frames = 0;
+        }
+    }
+    progressOut progress = { out_path, format, NULL, 0.0, 0 };
+    int frame;
+    for (frame = 0; frame < frames && !rv; ++frame) {
+        if (frames > 1) {
+            double a = 2 * M_PI * frame / frames;
+            double x = eye[0] - center[0], z = eye[2] - center[2];
+            Vec3 orbit = { center[0] + x * cos(a) + z * sin(a), eye[1], center[2] - x * sin(a) + z * cos(a) };
+            renderClear(ctx, tgaRGB(0, 0, 0));
+            renderSetCamera(ctx, orbit, center, up);
+        } else if (sc && sc->has_camera) {
+            renderSetCamera(ctx, eye, center, up);
+        }
+        int drawn;
+        if (sc) {
+            drawn = sceneDraw(ctx, sc, shading);
+        } else if (ms) {
+            drawn = drawStream(ctx, ms, model_path, shading);
+        } else if (progressive) {
+            drawn = renderProgressive(ctx, lod ? NULL : model, lod, shading, tgaRGB(0, 0, 0), tile,
+                                      writeProgress, &progress);
+        } else if (lod) {
+            drawn = renderDrawLod(ctx, lod, shading);
+        } else {
+            drawn = renderDrawModel(ctx, model, shading);
+        }
+        if (drawn >= 0 && edges) {
+            drawn = renderDrawEdges(ctx, model, edges, WIRE_COLOR, wireframe != WIRE_XRAY);
+        }
+        if (drawn < 0) {
+            if (!ms) {
+                fprintf(stderr, "Out of memory drawing frame %d\n", frame);
+            }
+            rv = -1;
+            break;
+        }
+        tgaImage *image = renderResolve(ctx);
+        if (ssao.radius > 0 && -1 == ssaoApply(ctx, &ssao)) {
+            fprintf(stderr, "Out of memory for --ssao, frame %d left without it\n", frame);
+        }
 
- 
+        statsBegin(STAGE_OUTPUT);
+        if (progress.fd) {
+            // complete already, tiles were written in place
+            if (progress.error || EOF == fclose(progress.fd)) {
+                perror(out_path);
+                rv = -1;
+            }
+        } else if (out) {
+            // flushed per frame so a reading encoder never waits on a partial one
+            if (-1 == outputWrite(image, out, format, 0, OUTPUT_BOTTOM_UP) || EOF == fflush(out)) {
+                perror(out_path);
+                rv = -1;
+            }
+        } else {
+            const char *path = out_path;
+            char numbered_path[4096];
+            if (numbered) {
+                framePath(numbered_path, sizeof(numbered_path), out_path, frame);
+                path = numbered_path;
+            }
+            if (-1 == outputSave(image, path, format, 0, OUTPUT_BOTTOM_UP)) {
+                perror("outputSave");
+                rv = -1;
+            }
+        }
+        statsEnd(STAGE_OUTPUT);
+    }
+    if (out && out != stdout && EOF == fclose(out)) {
+        perror(out_path);
+        rv = -1;
+    }
+
+    if (print_stats) {
+        if (progress.first) {
+            fprintf(stderr, "preview written after %.3f ms\n", (progress.first - start) * 1e3);
+        }
+        if (shadow) {
+            // also counted in the stages below
+            fprintf(stderr, "shadow pass %.3f ms\n", shadow_time * 1e3);
+        }
+        statsPrintText(stderr);
+    }
+    if (stats_json) {
+        // never into the image or frames going to stdout
+        FILE *std = strcmp(out_path, "-") ? stdout : stderr;
+        FILE *fd = strcmp(stats_json, "-") ? fopen(stats_json, "w") : std;
+        if (fd) {
+            statsPrintJson(fd);
+            if (fd != std) {
+                fclose(fd);
+            }
+        } else {
+            perror("stats-json");
+            rv = -1;
+        }
+    }
+    renderFreeContext(ctx);
+    if (shadow) {
+        renderFreeContext(shadow);
+    }
+    wireFreeEdges(edges);
+    sceneFree(sc);
+    if (ms) {
+        streamClose(ms);
+    }
+    if (lod) {
+        freeLod(lod);
+    } else if (model) {
+        freeModel(model);
+    }
+    return rv;
+}
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "model.h"
+
+/*
+ * Procedural meshes for scaling benchmarks. Every generator gives random
+ * access to its i-th vertex and face, so writers can stream any number of
+ * faces in several passes without keeping the mesh in memory. Each vertex
+ * carries its own position, uv and normal, so faces are written as
+ * i/i/i j/j/j k/k/k.
+ */
+
+typedef struct genVertex {
+    Vec3 pos;
+    Vec3 uv;
+    Vec3 norm;
+} genVertex;
+
+typedef struct generator {
+    uint64_t nvert;
+    uint64_t nface;
+    uint64_t n;    /* subdivision level / grid size */
+    uint64_t seed;
+    void (*vertex)(struct generator *, uint64_t i, genVertex *);
+    void (*face)(struct generator *, uint64_t i, uint64_t idx[3]);
+} generator;
+
+static uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* deterministic uniform [0, 1) for the given stream position */
+static double hashUnit(uint64_t seed, uint64_t i)
+{
+    return (splitmix64(seed ^ splitmix64(i)) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* getDiffuseColor scales uv by the map size, 1.0 would address one texel past the end */
+static double clampUV(double x)
+{
+    if (x < 0.0) return 0.0;
+    if (x > 0.999999) return 0.999999;
+    return x;
+}
+
+static void normalize(Vec3 v)
+{
+    double l = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    if (l > 0) {
+        v[0] /= l;
+        v[1] /= l;
+        v[2] /= l;
+    }
+}
+
+/* sphere: octahedron with every face split into n*n triangles, projected on the unit sphere */
+
+static void octantCorners(uint64_t octant, Vec3 p0, Vec3 p1, Vec3 p2)
+{
+    double sx = (octant & 1) ? -1.0 : 1.0;
+    double sy = (octant & 2) ? -1.0 : 1.0;
+    double sz = (octant & 4) ? -1.0 : 1.0;
+    p0[0] = 0.0; p0[1] = 0.0; p0[2] = sz;
+    p1[0] = sx;  p1[1] = 0.0; p1[2] = 0.0;
+    p2[0] = 0.0; p2[1] = sy;  p2[2] = 0.0;
+}
+
+static void sphereVertex(generator *g, uint64_t i, genVertex *v)
+{
+    uint64_t per_octant = (g->n + 1) * (g->n + 2) / 2;
+    uint64_t octant = i / per_octant;
+    uint64_t k = i % per_octant;
+    /* row r of the triangular lattice holds r + 1 vertices */
+    uint64_t r = (uint64_t)((sqrt(8.0 * k + 1.0) - 1.0) / 2.0);
+    while (r * (r + 1) / 2 > k) --r;
+    while ((r + 1) * (r + 2) / 2 <= k) ++r;
+    uint64_t c = k - r * (r + 1) / 2;
+
+    Vec3 p0, p1, p2;
+    octantCorners(octant, p0, p1, p2);
+    double a = (double)r / g->n;
+    double b = (double)c / g->n;
+    int j;
+    for (j = 0; j < 3; ++j) {
+        v->pos[j] = p0[j] + a * (p1[j] - p0[j]) + b * (p2[j] - p1[j]);
+    }
+    normalize(v->pos);
+    memcpy(v->norm, v->pos, sizeof(Vec3));
+    v->uv[0] = clampUV(atan2(v->pos[1], v->pos[0]) / (2 * M_PI) + 0.5);
+    v->uv[1] = clampUV(acos(v->pos[2]) / M_PI);
+    v->uv[2] = 0.0;
+}
+
+static void sphereFace(generator *g, uint64_t i, uint64_t idx[3])
+{
+    uint64_t per_octant_v = (g->n + 1) * (g->n + 2) / 2;
+    uint64_t per_octant_f = g->n * g->n;
+    uint64_t octant = i / per_octant_f;
+    uint64_t k = i % per_octant_f;
+    /* row r between lattice rows r and r + 1 holds 2r + 1 faces */
+    uint64_t r = (uint64_t)sqrt((double)k);
+    while (r * r > k) --r;
+    while ((r + 1) * (r + 1) <= k) ++r;
+    uint64_t t = k - r * r;
+    uint64_t c = t / 2;
+    uint64_t base = octant * per_octant_v;
+    uint64_t row = base + r * (r + 1) / 2;
+    uint64_t next = base + (r + 1) * (r + 2) / 2;
+    if (t % 2 == 0) {
+        idx[0] = row + c;
+        idx[1] = next + c;
+        idx[2] = next + c + 1;
+    } else {
+        idx[0] = row + c;
+        idx[1] = next + c + 1;
+        idx[2] = row + c + 1;
+    }
+    /* keep the winding outward in mirrored octants */
+    double sx = (octant & 1) ? -1.0 : 1.0;
+    double sy = (octant & 2) ? -1.0 : 1.0;
+    double sz = (octant & 4) ? -1.0 : 1.0;
+    if (sx * sy * sz < 0) {
+        uint64_t tmp = idx[1];
+        idx[1] = idx[2];
+        idx[2] = tmp;
+    }
+}
+
+/* terrain: n*n grid in the xy plane, height along z */
+
+static double terrainHeight(uint64_t seed, double x, double y)
+{
+    double phase = hashUnit(seed, 0) * 2 * M_PI;
+    return 0.15 * sin(3.0 * x + phase) * cos(2.0 * y) +
+           0.05 * sin(11.0 * x + 7.0 * y + phase) +
+           0.02 * cos(29.0 * y - 23.0 * x);
+}
+
+static void terrainVertex(generator *g, uint64_t i, genVertex *v)
+{
+    uint64_t row = i / (g->n + 1);
+    uint64_t col = i % (g->n + 1);
+    double x = 2.0 * col / g->n - 1.0;
+    double y = 2.0 * row / g->n - 1.0;
+    double eps = 1e-4;
+    v->pos[0] = x;
+    v->pos[1] = y;
+    v->pos[2] = terrainHeight(g->seed, x, y);
+    v->norm[0] = -(terrainHeight(g->seed, x + eps, y) - terrainHeight(g->seed, x - eps, y)) / (2 * eps);
+    v->norm[1] = -(terrainHeight(g->seed, x, y + eps) - terrainHeight(g->seed, x, y - eps)) / (2 * eps);
+    v->norm[2] = 1.0;
+    normalize(v->norm);
+    v->uv[0] = clampUV((x + 1.0) / 2.0);
+    v->uv[1] = clampUV((y + 1.0) / 2.0);
+    v->uv[2] = 0.0;
+}
+
+static void terrainFace(generator *g, uint64_t i, uint64_t idx[3])
+{
+    uint64_t cell = i / 2;
+    uint64_t row = cell / g->n;
+    uint64_t col = cell % g->n;
+    uint64_t v00 = row * (g->n + 1) + col;
+    uint64_t v10 = v00 + 1;
+    uint64_t v01 = v00 + g->n + 1;
+    uint64_t v11 = v01 + 1;
+    if (i % 2 == 0) {
+        idx[0] = v00; idx[1] = v10; idx[2] = v11;
+    } else {
+        idx[0] = v00; idx[1] = v11; idx[2] = v01;
+    }
+}
+
+/* soup: independent small triangles scattered through [-1, 1]^3 */
+
+static void soupCorner(generator *g, uint64_t tri, int corner, Vec3 p)
+{
+    double size = 3.0 / sqrt((double)g->nface);
+    int j;
+    for (j = 0; j < 3; ++j) {
+        double center = 2.0 * hashUnit(g->seed, tri * 16 + j) - 1.0;
+        double offset = corner ? size * (hashUnit(g->seed, tri * 16 + 3 * corner + j) - 0.5) : 0.0;
+        p[j] = center + offset;
+    }
+}
+
+static void soupVertex(generator *g, uint64_t i, genVertex *v)
+{
+    uint64_t tri = i / 3;
+    Vec3 p[3];
+    int k;
+    for (k = 0; k < 3; ++k) {
+        soupCorner(g, tri, k, p[k]);
+    }
+    memcpy(v->pos, p[i % 3], sizeof(Vec3));
+    Vec3 e1 = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+    Vec3 e2 = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+    v->norm[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    v->norm[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    v->norm[2] = e1[0]*e2[1] - e1[1]*e2[0];
+    normalize(v->norm);
+    v->uv[0] = clampUV(hashUnit(g->seed, i * 16 + 10));
+    v->uv[1] = clampUV(hashUnit(g->seed, i * 16 + 11));
+    v->uv[2] = 0.0;
+}
+
+static void soupFace(generator *g, uint64_t i, uint64_t idx[3])
+{
+    idx[0] = 3 * i;
+    idx[1] = 3 * i + 1;
+    idx[2] = 3 * i + 2;
+}
+
+static int setupGenerator(generator *g, const char *type, double faces, uint64_t seed)
+{
+    memset(g, 0, sizeof(*g));
+    g->seed = seed;
+    if (!strcmp(type, "sphere")) {
+        g->n = (uint64_t)(sqrt(faces / 8.0) + 0.5);
+        if (g->n < 1) g->n = 1;
+        g->nvert = 8 * (g->n + 1) * (g->n + 2) / 2;
+        g->nface = 8 * g->n * g->n;
+        g->vertex = sphereVertex;
+        g->face = sphereFace;
+    } else if (!strcmp(type, "terrain")) {
+        g->n = (uint64_t)(sqrt(faces / 2.0) + 0.5);
+        if (g->n < 1) g->n = 1;
+        g->nvert = (g->n + 1) * (g->n + 1);
+        g->nface = 2 * g->n * g->n;
+        g->vertex = terrainVertex;
+        g->face = terrainFace;
+    } else if (!strcmp(type, "soup")) {
+        g->nface = (uint64_t)(faces + 0.5);
+        if (g->nface < 1) g->nface = 1;
+        g->nvert = 3 * g->nface;
+        g->vertex = soupVertex;
+        g->face = soupFace;
+    } else {
+        return -1;
+    }
+    /* Face stores 32 bit indices */
+    if (g->nvert > UINT32_MAX || g->nface > UINT32_MAX) {
+        return -1;
+    }
+    return 0;
+}
+
+static int writeObj(generator *g, const char *filename)
+{
+    FILE *fd = fopen(filename, "w");
+    if (!fd) {
+        return -1;
+    }
+    setvbuf(fd, NULL, _IOFBF, 1 << 20);
+    fprintf(fd, "# meshgen: %llu vertices, %llu faces\n",
+            (unsigned long long)g->nvert, (unsigned long long)g->nface);
+    genVertex v;
+    uint64_t i;
+    for (i = 0; i < g->nvert; ++i) {
+        g->vertex(g, i, &v);
+        fprintf(fd, "v %.6f %.6f %.6f\n", v.pos[0], v.pos[1], v.pos[2]);
+    }
+    for (i = 0; i < g->nvert; ++i) {
+        g->vertex(g, i, &v);
+        fprintf(fd, "vt %.6f %.6f %.6f\n", v.uv[0], v.uv[1], v.uv[2]);
+    }
+    for (i = 0; i < g->nvert; ++i) {
+        g->vertex(g, i, &v);
+        fprintf(fd, "vn %.6f %.6f %.6f\n", v.norm[0], v.norm[1], v.norm[2]);
+    }
+    for (i = 0; i < g->nface; ++i) {
+        uint64_t idx[3];
+        g->face(g, i, idx);
+        unsigned long long a = idx[0] + 1, b = idx[1] + 1, c = idx[2] + 1;
+        fprintf(fd, "f %llu/%llu/%llu %llu/%llu/%llu %llu/%llu/%llu\n", a, a, a, b, b, b, c, c, c);
+    }
+    return fclose(fd) ? -1 : 0;
+}
+
+#define MESH_CHUNK 4096
+
+static int writeMesh(generator *g, const char *filename)
+{
+    FILE *fd = fopen(filename, "wb");
+    if (!fd) {
+        return -1;
+    }
+    meshHeader header;
+    memcpy(header.magic, MESH_MAGIC, 4);
+    header.version = MESH_VERSION;
+    header.nvert = g->nvert;
+    header.ntext = g->nvert;
+    header.nnorm = g->nvert;
+    header.nface = g->nface;
+    int rv = (1 == fwrite(&header, sizeof(header), 1, fd)) ? 0 : -1;
+
+    static Vec3 vbuf[MESH_CHUNK];
+    static Face fbuf[MESH_CHUNK];
+    genVertex v;
+    uint64_t i;
+    int pass;
+    /* one pass per array: positions, uvs, normals */
+    for (pass = 0; pass < 3 && !rv; ++pass) {
+        size_t n = 0;
+        for (i = 0; i < g->nvert && !rv; ++i) {
+            g->vertex(g, i, &v);
+            double *src = (pass == 0) ? v.pos : (pass == 1) ? v.uv : v.norm;
+            memcpy(vbuf[n++], src, sizeof(Vec3));
+            if (n == MESH_CHUNK || i + 1 == g->nvert) {
+                rv = (n == fwrite(vbuf, sizeof(Vec3), n, fd)) ? 0 : -1;
+                n = 0;
+            }
+        }
+    }
+    size_t n = 0;
+    for (i = 0; i < g->nface && !rv; ++i) {
+        uint64_t idx[3];
+        int k;
+        g->face(g, i, idx);
+        for (k = 0; k < 3; ++k) {
+            fbuf[n][3 * k + 0] = idx[k];
+            fbuf[n][3 * k + 1] = idx[k];
+            fbuf[n][3 * k + 2] = idx[k];
+        }
+        ++n;
+        if (n == MESH_CHUNK || i + 1 == g->nface) {
+            rv = (n == fwrite(fbuf, sizeof(Face), n, fd)) ? 0 : -1;
+            n = 0;
+        }
+    }
+    if (fclose(fd)) {
+        rv = -1;
+    }
+    return rv;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-s seed] sphere|terrain|soup faces out.obj|out.mesh ...\n"
+                    "faces may use exponent notation, e.g. 1e6\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        switch (opt) {
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (argc - optind < 3) {
+        usage(argv[0]);
+        return -1;
+    }
+    const char *type = argv[optind];
+    double faces = strtod(argv[optind + 1], NULL);
+    generator g;
+    if (faces < 1 || -1 == setupGenerator(&g, type, faces, seed)) {
+        usage(argv[0]);
+        return -1;
+    }
+    fprintf(stderr, "%s: %llu vertices, %llu faces\n", type,
+            (unsigned long long)g.nvert, (unsigned long long)g.nface);
+
+    int rv = 0;
+    int i;
+    for (i = optind + 2; i < argc; ++i) {
+        const char *out = argv[i];
+        size_t len = strlen(out);
+        int mesh = len > 5 && !strcmp(out + len - 5, ".mesh");
+        if (-1 == (mesh ? writeMesh(&g, out) : writeObj(&g, out))) {
+            perror(out);
+            rv = -1;
+        }
+    }
+    return rv;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "model.h"
+#include "optimize.h"
+
+/*
+ * Offline locality pass: loads an obj or mesh, reorders faces for vertex
+ * reuse and renumbers vertices in first use order, then writes a binary
+ * mesh that loads and draws in that order without paying for the pass.
+ * With -s an obj is only converted, streaming, for meshes too large to
+ * load; the result can be drawn with render --stream.
+ */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c cache_size] in.obj|in.mesh out.mesh\n"
+                    "       %s -s in.obj out.mesh\n", prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int cache_size = OPTIMIZE_CACHE_SIZE;
+    int convert_only = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s")) != -1) {
+        switch (opt) {
+        case 'c':
+            cache_size = atoi(optarg);
+            break;
+        case 's':
+            convert_only = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (argc - optind < 2 || !cache_size) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (convert_only) {
+        if (-1 == convertObjToMesh(argv[optind], argv[optind + 1])) {
+            fprintf(stderr, "Can't convert %s to %s\n", argv[optind], argv[optind + 1]);
+            return -1;
+        }
+        return 0;
+    }
+    Model *model = loadModel(argv[optind]);
+    if (!model) {
+        perror(argv[optind]);
+        return -1;
+    }
+    double before = cacheMissRatio(model, cache_size);
+    if (-1 == optimizeFaceOrder(model, cache_size) || -1 == optimizeVertexOrder(model)) {
+        fprintf(stderr, "Out of memory optimizing %s\n", argv[optind]);
+        freeModel(model);
+        return -1;
+    }
+    fprintf(stderr, "%u faces, transforms per face %.3f -> %.3f with %u entries\n",
+            model->nface, before, cacheMissRatio(model, cache_size), cache_size);
+    int rv = 0;
+    if (-1 == saveToMesh(model, argv[optind + 1])) {
+        perror(argv[optind + 1]);
+        rv = -1;
+    }
+    freeModel(model);
+    return rv;
+}
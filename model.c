@@ -1,10 +1,323 @@
 #include "model.h"
+#include "stats.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
+
+static Model * newModel(void)
+{
+    Model *model = (Model *)malloc(sizeof(Model));
+    if (!model) {
+        return NULL;
+    }
+    memset(model, 0, sizeof(Model));
+    return model;
+}
+
+enum objLine {
+    OBJ_NORMAL,
+    OBJ_TEXTURE,
+    OBJ_VERTEX,
+    OBJ_FACE,
+    OBJ_SKIP,
+    OBJ_UNSUPPORTED
+};
+
+static int objBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0';
+}
+
+/* groups, smoothing and materials: nothing the renderer draws differently */
+static const char *obj_skipped[] = { "mtllib", "usemtl", "s", "g", "o" };
+
+static int objKeyword(const char *line, const char *keyword)
+{
+    size_t len = strlen(keyword);
+    return !strncmp(line, keyword, len) && objBlank(line[len]);
+}
+
+/* kind of the line by its keyword, *rest points past the keyword */
+static int objLineKind(const char *line, const char **rest)
+{
+    while (*line == ' ' || *line == '\t') {
+        ++line;
+    }
+    *rest = line + 1;
+    if (line[0] == 'v' && line[1] == 'n' && objBlank(line[2])) {
+        *rest = line + 2;
+        return OBJ_NORMAL;
+    } else if (line[0] == 'v' && line[1] == 't' && objBlank(line[2])) {
+        *rest = line + 2;
+        return OBJ_TEXTURE;
+    } else if (line[0] == 'v' && objBlank(line[1])) {
+        return OBJ_VERTEX;
+    } else if (line[0] == 'f' && objBlank(line[1])) {
+        return OBJ_FACE;
+    } else if (line[0] == '#' || objBlank(line[0])) {
+        // skip comments and empty lines
+        return OBJ_SKIP;
+    }
+    unsigned int i;
+    for (i = 0; i < sizeof(obj_skipped) / sizeof(obj_skipped[0]); ++i) {
+        if (objKeyword(line, obj_skipped[i])) {
+            return OBJ_SKIP;
+        }
+    }
+    return OBJ_UNSUPPORTED;
+}
+
+/* up to most numbers into out, how many there were */
+static int objNumbers(const char *p, double *out, int most)
+{
+    int n = 0;
+    while (n < most) {
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p) {
+            break;
+        }
+        out[n++] = v;
+        p = end;
+    }
+    return n;
+}
+
+/* a nonzero index, negative ones count back from the last record read */
+static int objIndex(const char **p, long long *out)
+{
+    const char *s = *p;
+    int negative = *s == '-';
+    if (negative || *s == '+') {
+        ++s;
+    }
+    if (*s < '0' || *s > '9') {
+        return 0;
+    }
+    long long v = 0;
+    while (*s >= '0' && *s <= '9') {
+        v = v * 10 + (*s++ - '0');
+        if (v > UINT_MAX) {
+            return 0;
+        }
+    }
+    if (!v) {
+        return 0;
+    }
+    *out = negative ? -v : v;
+    *p = s;
+    return 1;
+}
+
+/*
+ * The state of a pass over an obj file. Faces are triangulated as fans
+ * around their first corner, so a polygon of n corners counts n - 2.
+ * Corners may leave out vt, vn or both: without vt they take an extra
+ * (0, 0) uv appended after the file's own, and when any corner has no vn
+ * the normals are dropped and every face is lit from its positions, as
+ * for a file without vn.
+ */
+typedef struct objScan {
+    const char *name;
+    unsigned long long lineno;
+    size_t counts[OBJ_FACE + 1];   // records of each kind, triangles for faces
+    size_t seen[OBJ_FACE + 1];     // records read so far in the second pass
+    int uv_missing;
+    int normals_missing;
+    long long (*corners)[3];       // of the current face line, grown as needed
+    size_t cap;
+} objScan;
+
+static int objError(objScan *scan, const char *what)
+{
+    fprintf(stderr, "%s:%llu: %s\n", scan->name, scan->lineno, what);
+    return -1;
+}
+
+/* a line of a kind the loader doesn't know, reported by its keyword and skipped */
+static void objUnsupported(objScan *scan, const char *line)
+{
+    line += strspn(line, " \t");
+    fprintf(stderr, "%s:%llu: unsupported '%.*s', skipped\n", scan->name, scan->lineno,
+            (int)strcspn(line, " \t\r\n"), line);
+}
+
+/*
+ * Corners v, v/vt, v//vn or v/vt/vn of a face line into scan->corners,
+ * 0 for a missing attribute. The number of corners, -1 when malformed.
+ */
+static int objFace(objScan *scan, const char *p)
+{
+    size_t n = 0;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') {
+            ++p;
+        }
+        if (*p == '\n' || *p == '\0' || *p == '#') {
+            break;
+        }
+        if (n == scan->cap) {
+            size_t cap = scan->cap ? 2 * scan->cap : 16;
+            long long (*grown)[3] = (long long (*)[3])realloc(scan->corners, cap * sizeof(*grown));
+            if (!grown) {
+                return objError(scan, "out of memory");
+            }
+            scan->corners = grown;
+            scan->cap = cap;
+        }
+        long long *c = scan->corners[n];
+        int k;
+        c[1] = c[2] = 0;
+        if (!objIndex(&p, &c[0])) {
+            return objError(scan, "malformed face corner");
+        }
+        for (k = 1; k < 3 && *p == '/'; ++k) {
+            ++p;
+            // v//vn leaves vt out
+            if (k == 1 && *p == '/') {
+                continue;
+            }
+            if (!objIndex(&p, &c[k])) {
+                return objError(scan, "malformed face corner");
+            }
+        }
+        if (!objBlank(*p) && *p != '#') {
+            return objError(scan, "malformed face corner");
+        }
+        ++n;
+    }
+    if (n < 3) {
+        return objError(scan, "face with fewer than 3 corners");
+    }
+    if (n > INT_MAX) {
+        return objError(scan, "face with too many corners");
+    }
+    return (int)n;
+}
+
+/* index into 0 based against the records read so far and the file totals */
+static int objResolve(objScan *scan, long long *index, int kind)
+{
+    long long i = *index < 0 ? (long long)scan->seen[kind] + *index : *index - 1;
+    if (i < 0 || i >= (long long)scan->counts[kind]) {
+        return objError(scan, "index out of range");
+    }
+    *index = i;
+    return 0;
+}
+
+/* the face line resolved in place, -1 when malformed or out of range */
+static int objResolveFace(objScan *scan, const char *p)
+{
+    int n = objFace(scan, p);
+    int i;
+    if (n < 0) {
+        return -1;
+    }
+    for (i = 0; i < n; ++i) {
+        long long *c = scan->corners[i];
+        if (-1 == objResolve(scan, &c[0], OBJ_VERTEX)) {
+            return -1;
+        }
+        if (!c[1]) {
+            c[1] = scan->counts[OBJ_TEXTURE];
+        } else if (-1 == objResolve(scan, &c[1], OBJ_TEXTURE)) {
+            return -1;
+        }
+        if (scan->normals_missing) {
+            c[2] = 0;
+        } else if (-1 == objResolve(scan, &c[2], OBJ_NORMAL)) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+/* triangle t of the fan over the resolved corners */
+static void objTriangle(const objScan *scan, int t, Face f)
+{
+    const int corner[3] = { 0, t + 1, t + 2 };
+    int k, a;
+    for (k = 0; k < 3; ++k) {
+        for (a = 0; a < 3; ++a) {
+            f[3 * k + a] = (unsigned int)scan->corners[corner[k]][a];
+        }
+    }
+}
+
+/* first pass: counts and missing attributes, -1 with a message on a malformed face */
+static int objCount(objScan *scan, FILE *fd, char **line, size_t *linecap)
+{
+    const char *rest;
+    int kind;
+    scan->lineno = 0;
+    while (getline(line, linecap, fd) > 0) {
+        ++scan->lineno;
+        kind = objLineKind(*line, &rest);
+        if (kind == OBJ_FACE) {
+            int n = objFace(scan, rest);
+            int i;
+            if (n < 0) {
+                return -1;
+            }
+            for (i = 0; i < n; ++i) {
+                scan->uv_missing |= !scan->corners[i][1];
+                scan->normals_missing |= !scan->corners[i][2];
+            }
+            scan->counts[OBJ_FACE] += n - 2;
+        } else if (kind < OBJ_FACE) {
+            ++scan->counts[kind];
+        }
+    }
+    for (kind = 0; kind <= OBJ_FACE; ++kind) {
+        if (scan->counts[kind] + 1 > UINT_MAX) {
+            fprintf(stderr, "%s has more than %u records of a kind\n", scan->name, UINT_MAX - 1);
+            return -1;
+        }
+    }
+    scan->lineno = 0;
+    return 0;
+}
+
+/*
+ * Carves the four arrays out of one arena sized for them, freeModel then
+ * releases them at once. +1 keeps zero sized arrays distinct.
+ */
+static int allocModelArrays(Model *model, size_t nvert, size_t ntext, size_t nnorm, size_t nface)
+{
+    size_t bytes = (nvert + ntext + nnorm + 3) * sizeof(Vec3) + (nface + 1) * sizeof(Face) + 4 * ARENA_ALIGN;
+    model->arena = arenaNew(bytes);
+    if (!model->arena) {
+        return -1;
+    }
+    model->vertices = (Vec3 *)arenaAlloc(model->arena, (nvert + 1) * sizeof(Vec3));
+    model->textures = (Vec3 *)arenaAlloc(model->arena, (ntext + 1) * sizeof(Vec3));
+    model->normals = (Vec3 *)arenaAlloc(model->arena, (nnorm + 1) * sizeof(Vec3));
+    model->faces = (Face *)arenaAlloc(model->arena, (nface + 1) * sizeof(Face));
+    assert(model->vertices && model->textures && model->normals && model->faces);
+    return 0;
+}
+
+Model * createModel(unsigned int nvert, unsigned int ntext, unsigned int nnorm, unsigned int nface)
+{
+    Model *model = newModel();
+    if (!model) {
+        return NULL;
+    }
+    if (-1 == allocModelArrays(model, nvert, ntext, nnorm, nface)) {
+        freeModel(model);
+        return NULL;
+    }
+    model->nvert = nvert;
+    model->ntext = ntext;
+    model->nnorm = nnorm;
+    model->nface = nface;
+    return model;
+}
 
 Model * loadFromObj(const char *filename)
 {
@@ -15,108 +328,329 @@ Model * loadFromObj(const char *filename)
         return NULL;
     }
 
-    Model *model = (Model *)malloc(sizeof(Model));
-    model->nvert = 0;
-    model->ntext = 0;
-    model->nnorm = 0;
-    model->nface = 0;
-    model->diffuse_map = NULL;
-    model->normal_map = NULL;
-    model->specular_map = NULL;
-
-    size_t vertcap = 1;
-    size_t textcap = 1;
-    size_t normcap = 1;
-    size_t facecap = 1;
-
-    model->vertices = (Vec3 *)malloc(vertcap * sizeof(Vec3));
-    model->textures = (Vec3 *)malloc(textcap * sizeof(Vec3));
-    model->normals = (Vec3 *)malloc(normcap * sizeof(Vec3));
-    model->faces = (Face *)malloc(facecap * sizeof(Face));
-
+    Model *model = newModel();
+    if (!model) {
+        fclose(fd);
+        return NULL;
+    }
 
+    // count first so every array is allocated once at its final size
+    objScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.name = filename;
     char *line = NULL;
     size_t linecap = 0;
-    ssize_t linelen;
-    while ((linelen = getline(&line, &linecap, fd)) > 0) {
-        if (!strncmp(line, "vn", 2)) {
-            if (model->nnorm >= normcap) { // realloc
-                normcap *= 2;
-                model->normals = (Vec3 *)realloc(model->normals, normcap * sizeof(Vec3));
-                assert(model->normals);
-            }
+    int rv = objCount(&scan, fd, &line, &linecap);
+    size_t nnorm = scan.normals_missing ? 0 : scan.counts[OBJ_NORMAL];
+    if (rv == 0) {
+        rv = allocModelArrays(model, scan.counts[OBJ_VERTEX], scan.counts[OBJ_TEXTURE] + scan.uv_missing,
+                              nnorm, scan.counts[OBJ_FACE]);
+    }
+    rewind(fd);
+
+    const char *rest;
+    while (rv == 0 && getline(&line, &linecap, fd) > 0) {
+        ++scan.lineno;
+        int kind = objLineKind(line, &rest);
+        switch (kind) {
+        case OBJ_NORMAL: {
             Vec3 *vn = &model->normals[model->nnorm];
-            assert(3 == sscanf(line + 2, "%lg %lg %lg\n", &(*vn)[0], &(*vn)[1], &(*vn)[2]));
-            model->nnorm += 1;
-        } else if (!strncmp(line, "vt", 2)) {
-            if (model->ntext >= textcap) { // realloc
-                textcap *= 2;
-                model->textures = (Vec3 *)realloc(model->textures, textcap * sizeof(Vec3));
-                assert(model->textures);
+            if (3 != objNumbers(rest, *vn, 3)) {
+                rv = objError(&scan, "malformed normal");
+            } else if (nnorm) {
+                model->nnorm += 1;
             }
+            break;
+        }
+        case OBJ_TEXTURE: {
             Vec3 *vt = &model->textures[model->ntext];
-            (*vt)[0] = 0.0;
             (*vt)[1] = 0.0;
             (*vt)[2] = 0.0;
-            assert(1 < sscanf(line + 2, "%lg %lg\n", &(*vt)[0], &(*vt)[1]));
-            model->ntext += 1;
-        } else if (!strncmp(line, "v", 1)) {
-            if (model->nvert >= vertcap) { // realloc
-                vertcap *= 2;
-                model->vertices = (Vec3 *)realloc(model->vertices, vertcap * sizeof(Vec3));
-                assert(model->vertices);
+            if (1 > objNumbers(rest, *vt, 2)) {
+                rv = objError(&scan, "malformed texture coordinate");
             }
+            model->ntext += 1;
+            break;
+        }
+        case OBJ_VERTEX: {
             Vec3 *v = &model->vertices[model->nvert];
-            assert(3 == sscanf(line + 1, "%lg %lg %lg\n", &(*v)[0], &(*v)[1], &(*v)[2]));
+            if (3 != objNumbers(rest, *v, 3)) {
+                rv = objError(&scan, "malformed vertex");
+            }
             model->nvert += 1;
-        } else if (!strncmp(line, "f", 1)) {
-            if (model->nface >= facecap) { // realloc
-                facecap *= 2;
-                model->faces = (Face *)realloc(model->faces, facecap * sizeof(Face));
-                assert(model->faces);
-            }
-            Face *f = &model->faces[model->nface];
-            assert(9 == sscanf(line + 1, "%u/%u/%u %u/%u/%u %u/%u/%u", &(*f)[0], &(*f)[1], &(*f)[2],
-                                                                       &(*f)[3], &(*f)[4], &(*f)[5],
-                                                                       &(*f)[6], &(*f)[7], &(*f)[8]));
-            assert((*f)[0] <= model->nvert &&
-                   (*f)[1] <= model->ntext &&
-                   (*f)[2] <= model->nnorm);
-            assert((*f)[3] <= model->nvert &&
-                   (*f)[4] <= model->ntext &&
-                   (*f)[5] <= model->nnorm);
-            assert((*f)[6] <= model->nvert &&
-                   (*f)[7] <= model->ntext &&
-                   (*f)[8] <= model->nnorm);
-            int i;
-            for (i = 0; i < sizeof(Face)/sizeof(unsigned int); ++i) {
-                (*f)[i] -= 1;
+            break;
+        }
+        case OBJ_FACE: {
+            int n = objResolveFace(&scan, rest);
+            int t;
+            if (n < 0) {
+                rv = -1;
+                break;
             }
-            model->nface += 1;
-        } else if (!strncmp(line, "#", 1) ||
-                   !strncmp(line, "\n", 1)) {
-            // skip comments and empty lines
-        } else {
-            fprintf(stderr, "Warning! Unsupported obj format: %s", line);
+            for (t = 0; t < n - 2; ++t) {
+                objTriangle(&scan, t, model->faces[model->nface++]);
+            }
+            break;
+        }
+        case OBJ_SKIP:
+            break;
+        default:
+            objUnsupported(&scan, line);
+        }
+        if (kind < OBJ_FACE) {
+            ++scan.seen[kind];
         }
     }
+    if (rv == 0 && scan.uv_missing) {
+        Vec3 *vt = &model->textures[model->ntext++];
+        (*vt)[0] = (*vt)[1] = (*vt)[2] = 0.0;
+    }
 
-    if (line) {
-        free(line);
+    free(scan.corners);
+    free(line);
+    fclose(fd);
+    if (rv == -1) {
+        freeModel(model);
+        return NULL;
+    }
+    return model;
+}
+
+Model * loadFromMesh(const char *filename)
+{
+    assert(filename);
+
+    FILE *fd = fopen(filename, "rb");
+    if (!fd) {
+        return NULL;
+    }
+
+    meshHeader header;
+    if (1 != fread(&header, sizeof(header), 1, fd) ||
+            memcmp(header.magic, MESH_MAGIC, 4) ||
+            header.version != MESH_VERSION) {
+        fprintf(stderr, "%s is not a mesh file\n", filename);
+        fclose(fd);
+        return NULL;
+    }
+
+    Model *model = newModel();
+    if (!model) {
+        fclose(fd);
+        return NULL;
     }
+    model->nvert = header.nvert;
+    model->ntext = header.ntext;
+    model->nnorm = header.nnorm;
+    model->nface = header.nface;
+    int ok = 0 == allocModelArrays(model, header.nvert, header.ntext, header.nnorm, header.nface);
+    ok = ok && header.nvert == fread(model->vertices, sizeof(Vec3), header.nvert, fd);
+    ok = ok && header.ntext == fread(model->textures, sizeof(Vec3), header.ntext, fd);
+    ok = ok && header.nnorm == fread(model->normals, sizeof(Vec3), header.nnorm, fd);
+    ok = ok && header.nface == fread(model->faces, sizeof(Face), header.nface, fd);
     fclose(fd);
+    if (!ok) {
+        fprintf(stderr, "%s is truncated\n", filename);
+        freeModel(model);
+        return NULL;
+    }
+    // a missing section is read through the spare entry at 0, like the obj loader leaves it
+    unsigned int limit[3] = { header.nvert, header.ntext ? header.ntext : 1, header.nnorm ? header.nnorm : 1 };
+    unsigned int i, k;
+    for (i = 0; i < header.nface; ++i) {
+        for (k = 0; k < 9; ++k) {
+            if (model->faces[i][k] >= limit[k % 3]) {
+                fprintf(stderr, "%s has a bad index in face %u\n", filename, i);
+                freeModel(model);
+                return NULL;
+            }
+        }
+    }
     return model;
 }
 
-int loadDiffuseMap(Model *model, const char *filename)
+int saveToMesh(Model *model, const char *filename)
 {
     assert(model);
     assert(filename);
-    model->diffuse_map = tgaLoadFromFile(filename);
-    if (model->diffuse_map) {
-        tgaFlipVertically(model->diffuse_map);
-        tgaFlipHorizontally(model->diffuse_map);
+
+    FILE *fd = fopen(filename, "wb");
+    if (!fd) {
+        return -1;
+    }
+
+    meshHeader header;
+    memcpy(header.magic, MESH_MAGIC, 4);
+    header.version = MESH_VERSION;
+    header.nvert = model->nvert;
+    header.ntext = model->ntext;
+    header.nnorm = model->nnorm;
+    header.nface = model->nface;
+
+    int rv = 0;
+    if (1 != fwrite(&header, sizeof(header), 1, fd) ||
+            model->nvert != fwrite(model->vertices, sizeof(Vec3), model->nvert, fd) ||
+            model->ntext != fwrite(model->textures, sizeof(Vec3), model->ntext, fd) ||
+            model->nnorm != fwrite(model->normals, sizeof(Vec3), model->nnorm, fd) ||
+            model->nface != fwrite(model->faces, sizeof(Face), model->nface, fd)) {
+        rv = -1;
+    }
+    if (fclose(fd)) {
+        rv = -1;
+    }
+    return rv;
+}
+
+int convertObjToMesh(const char *objname, const char *meshname)
+{
+    assert(objname);
+    assert(meshname);
+
+    FILE *in = fopen(objname, "r");
+    if (!in) {
+        return -1;
+    }
+    objScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.name = objname;
+    char *line = NULL;
+    size_t linecap = 0;
+    int kind;
+    if (-1 == objCount(&scan, in, &line, &linecap)) {
+        free(scan.corners);
+        free(line);
+        fclose(in);
+        return -1;
+    }
+
+    meshHeader header;
+    memcpy(header.magic, MESH_MAGIC, 4);
+    header.version = MESH_VERSION;
+    header.nvert = scan.counts[OBJ_VERTEX];
+    header.ntext = scan.counts[OBJ_TEXTURE] + scan.uv_missing;
+    header.nnorm = scan.normals_missing ? 0 : scan.counts[OBJ_NORMAL];
+    header.nface = scan.counts[OBJ_FACE];
+    off_t offsets[OBJ_FACE + 1];
+    offsets[OBJ_VERTEX] = sizeof(header);
+    offsets[OBJ_TEXTURE] = offsets[OBJ_VERTEX] + (off_t)header.nvert * sizeof(Vec3);
+    offsets[OBJ_NORMAL] = offsets[OBJ_TEXTURE] + (off_t)header.ntext * sizeof(Vec3);
+    offsets[OBJ_FACE] = offsets[OBJ_NORMAL] + (off_t)header.nnorm * sizeof(Vec3);
+
+    // every section gets its own buffered handle, so both passes stay sequential
+    FILE *out[OBJ_FACE + 1] = { NULL, NULL, NULL, NULL };
+    int rv = 0;
+    out[OBJ_VERTEX] = fopen(meshname, "wb");
+    if (!out[OBJ_VERTEX] || 1 != fwrite(&header, sizeof(header), 1, out[OBJ_VERTEX])) {
+        rv = -1;
+    }
+    for (kind = 0; kind <= OBJ_FACE && rv == 0; ++kind) {
+        if (kind != OBJ_VERTEX) {
+            fflush(out[OBJ_VERTEX]);
+            out[kind] = fopen(meshname, "r+b");
+            if (!out[kind] || fseeko(out[kind], offsets[kind], SEEK_SET)) {
+                rv = -1;
+            }
+        }
     }
+
+    rewind(in);
+    const char *rest;
+    while (rv == 0 && getline(&line, &linecap, in) > 0) {
+        ++scan.lineno;
+        kind = objLineKind(line, &rest);
+        Vec3 v = { 0.0, 0.0, 0.0 };
+        switch (kind) {
+        case OBJ_NORMAL:
+            if (3 != objNumbers(rest, v, 3)) {
+                rv = objError(&scan, "malformed normal");
+            } else if (header.nnorm && 1 != fwrite(v, sizeof(Vec3), 1, out[kind])) {
+                rv = -1;
+            }
+            break;
+        case OBJ_TEXTURE:
+            if (1 > objNumbers(rest, v, 2)) {
+                rv = objError(&scan, "malformed texture coordinate");
+            } else if (1 != fwrite(v, sizeof(Vec3), 1, out[kind])) {
+                rv = -1;
+            }
+            break;
+        case OBJ_VERTEX:
+            if (3 != objNumbers(rest, v, 3)) {
+                rv = objError(&scan, "malformed vertex");
+            } else if (1 != fwrite(v, sizeof(Vec3), 1, out[kind])) {
+                rv = -1;
+            }
+            break;
+        case OBJ_FACE: {
+            int n = objResolveFace(&scan, rest);
+            int t;
+            for (t = 0; t < n - 2 && rv == 0; ++t) {
+                Face f;
+                objTriangle(&scan, t, f);
+                if (1 != fwrite(f, sizeof(Face), 1, out[kind])) {
+                    rv = -1;
+                }
+            }
+            if (n < 0) {
+                rv = -1;
+            }
+            break;
+        }
+        case OBJ_UNSUPPORTED:
+            objUnsupported(&scan, line);
+            break;
+        }
+        if (kind < OBJ_FACE) {
+            ++scan.seen[kind];
+        }
+    }
+    if (rv == 0 && scan.uv_missing) {
+        Vec3 v = { 0.0, 0.0, 0.0 };
+        if (1 != fwrite(v, sizeof(Vec3), 1, out[OBJ_TEXTURE])) {
+            rv = -1;
+        }
+    }
+    for (kind = 0; kind <= OBJ_FACE; ++kind) {
+        if (out[kind] && fclose(out[kind])) {
+            rv = -1;
+        }
+    }
+    free(scan.corners);
+    free(line);
+    fclose(in);
+    return rv;
+}
+
+Model * loadModel(const char *filename)
+{
+    assert(filename);
+
+    FILE *fd = fopen(filename, "rb");
+    if (!fd) {
+        return NULL;
+    }
+    char magic[4];
+    int is_mesh = (1 == fread(magic, sizeof(magic), 1, fd)) && !memcmp(magic, MESH_MAGIC, 4);
+    fclose(fd);
+    return is_mesh ? loadFromMesh(filename) : loadFromObj(filename);
+}
+
+tgaImage * loadTextureMap(const char *filename)
+{
+    assert(filename);
+    tgaImage *map = tgaLoadFromFile(filename);
+    if (map) {
+        tgaFlipVertically(map);
+        tgaFlipHorizontally(map);
+    }
+    return map;
+}
+
+int loadDiffuseMap(Model *model, const char *filename)
+{
+    assert(model);
+    assert(filename);
+    model->diffuse_map = loadTextureMap(filename);
     return model->diffuse_map != NULL;
 }
 
@@ -124,10 +658,12 @@ int loadNormalMap(Model *model, const char *filename)
 {
     assert(model);
     assert(filename);
-    model->normal_map = tgaLoadFromFile(filename);
+    model->normal_map = loadTextureMap(filename);
     if (model->normal_map) {
-        tgaFlipVertically(model->normal_map);
-        tgaFlipHorizontally(model->normal_map);
+        if (-1 == computeTangents(model)) {
+            tgaFreeImage(model->normal_map);
+            model->normal_map = NULL;
+        }
     }
     return model->normal_map != NULL;
 }
@@ -136,11 +672,7 @@ int loadSpecularMap(Model *model, const char *filename)
 {
     assert(model);
     assert(filename);
-    model->specular_map = tgaLoadFromFile(filename);
-    if (model->specular_map) {
-        tgaFlipVertically(model->specular_map);
-        tgaFlipHorizontally(model->specular_map);
-    }
+    model->specular_map = loadTextureMap(filename);
     return model->specular_map != NULL;
 }
 
@@ -153,6 +685,15 @@ Vec3 *getVertex(Model *model, unsigned int nface, unsigned int nvert)
     return &model->vertices[model->faces[nface][0 + nvert * 3]];  
 }
 
+unsigned int getVertexIndex(Model *model, unsigned int nface, unsigned int nvert)
+{
+    assert(model);
+    assert(nface < model->nface);
+    assert(nvert < 3);
+
+    return model->faces[nface][0 + nvert * 3];
+}
+
 Vec3 *getDiffuseUV(Model *model, unsigned int nface, unsigned int nvert)
 {
     assert(model);
@@ -192,6 +733,7 @@ tgaColor getDiffuseColor(Model *model, Vec3 *uv)
     }
     unsigned int h = model->diffuse_map->height;
     unsigned int w = model->diffuse_map->width;
+    STATS_ADD(CNT_TEXEL_FETCHED, 1);
     return tgaGetPixel(model->diffuse_map, w * (*uv)[0], h * (*uv)[1]);
 }
 
@@ -201,15 +743,94 @@ int getNormal(Model *model, Vec3 *n, Vec3 *uv)
     assert(uv);
 
     if (!model->normal_map) {
-        fprintf(stderr, "Diffuse map not loaded\n");
+        fprintf(stderr, "Normal map not loaded\n");
         return -1;
     }
     unsigned int h = model->normal_map->height;
     unsigned int w = model->normal_map->width;
+    STATS_ADD(CNT_TEXEL_FETCHED, 1);
     tgaColor c = tgaGetPixel(model->normal_map, w * (*uv)[0], h * (*uv)[1]);
-    (*n)[2] = (double)Red(c)/255.0 * 2.0 - 1.0;
+    // tangent space: x in red, y in green, z (mostly up) in blue
+    (*n)[0] = (double)Red(c)/255.0 * 2.0 - 1.0;
     (*n)[1] = (double)Green(c)/255.0 * 2.0 - 1.0;
-    (*n)[0] = (double)Blue(c)/255.0 * 2.0 - 1.0;
+    (*n)[2] = (double)Blue(c)/255.0 * 2.0 - 1.0;
+    return 0;
+}
+
+double getSpecular(Model *model, Vec3 *uv)
+{
+    assert(model);
+    assert(uv);
+
+    if (!model->specular_map) {
+        fprintf(stderr, "Specular map not loaded\n");
+        return 0.0;
+    }
+    unsigned int h = model->specular_map->height;
+    unsigned int w = model->specular_map->width;
+    STATS_ADD(CNT_TEXEL_FETCHED, 1);
+    tgaColor c = tgaGetPixel(model->specular_map, w * (*uv)[0], h * (*uv)[1]);
+    return Blue(c);
+}
+
+void modelBounds(Model *model, Vec3 bounds[2])
+{
+    unsigned int i;
+    int c;
+    for (c = 0; c < 3; ++c) {
+        bounds[0][c] = model->nvert ? model->vertices[0][c] : 0.0;
+        bounds[1][c] = bounds[0][c];
+    }
+    for (i = 1; i < model->nvert; ++i) {
+        for (c = 0; c < 3; ++c) {
+            if (model->vertices[i][c] < bounds[0][c]) bounds[0][c] = model->vertices[i][c];
+            if (model->vertices[i][c] > bounds[1][c]) bounds[1][c] = model->vertices[i][c];
+        }
+    }
+}
+
+int computeTangents(Model *model)
+{
+    assert(model);
+
+    free(model->tangents);
+    free(model->bitangents);
+    model->tangents = (Vec3 *)malloc((model->nface + 1) * sizeof(Vec3));
+    model->bitangents = (Vec3 *)malloc((model->nface + 1) * sizeof(Vec3));
+    if (!model->tangents || !model->bitangents) {
+        free(model->tangents);
+        free(model->bitangents);
+        model->tangents = NULL;
+        model->bitangents = NULL;
+        return -1;
+    }
+
+    unsigned int i, k;
+    for (i = 0; i < model->nface; ++i) {
+        Vec3 *v0 = getVertex(model, i, 0);
+        Vec3 *v1 = getVertex(model, i, 1);
+        Vec3 *v2 = getVertex(model, i, 2);
+        Vec3 *t0 = getDiffuseUV(model, i, 0);
+        Vec3 *t1 = getDiffuseUV(model, i, 1);
+        Vec3 *t2 = getDiffuseUV(model, i, 2);
+        double du1 = (*t1)[0] - (*t0)[0], dv1 = (*t1)[1] - (*t0)[1];
+        double du2 = (*t2)[0] - (*t0)[0], dv2 = (*t2)[1] - (*t0)[1];
+        double det = du1 * dv2 - du2 * dv1;
+        Vec3 *T = &model->tangents[i];
+        Vec3 *B = &model->bitangents[i];
+        if (det == 0.0) { // no uv parametrization, any frame will do
+            (*T)[0] = 1.0; (*T)[1] = 0.0; (*T)[2] = 0.0;
+            (*B)[0] = 0.0; (*B)[1] = 1.0; (*B)[2] = 0.0;
+            continue;
+        }
+        double r = 1.0 / det;
+        for (k = 0; k < 3; ++k) {
+            double e1 = (*v1)[k] - (*v0)[k];
+            double e2 = (*v2)[k] - (*v0)[k];
+            (*T)[k] = (e1 * dv2 - e2 * dv1) * r;
+            (*B)[k] = (e2 * du1 - e1 * du2) * r;
+        }
+    }
     return 0;
 }
 
@@ -218,14 +839,18 @@ void freeModel(Model *model)
 {
     assert(model);
 
-    if (model->vertices) 
+    if (model->arena) {
+        arenaFree(model->arena);
+    } else {
         free(model->vertices);
-    if (model->textures)
         free(model->textures);
-    if (model->normals)
         free(model->normals);
-    if (model->faces)
         free(model->faces);
+    }
+    if (model->tangents)
+        free(model->tangents);
+    if (model->bitangents)
+        free(model->bitangents);
     if (model->diffuse_map)
         tgaFreeImage(model->diffuse_map);
     if (model->normal_map)
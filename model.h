@@ -2,6 +2,7 @@
 #define MODEL_H_
 
 #include "tga.h"
+#include "arena.h"
 
 typedef unsigned int Face[9];
 typedef double Vec3[3];
@@ -15,13 +16,50 @@ typedef struct Model {
     Vec3 *textures;
     Vec3 *normals;
     Face *faces;
+    Vec3 *tangents;   // per face, filled by loadNormalMap
+    Vec3 *bitangents; // per face, filled by loadNormalMap
+    arena *arena;     // holds vertices, textures, normals and faces when set
     tgaImage *diffuse_map;
     tgaImage *normal_map;
     tgaImage *specular_map;
 } Model;
 
+/* binary mesh: header followed by the raw vertices, textures, normals and faces arrays */
+#define MESH_MAGIC "RMSH"
+#define MESH_VERSION 1
+
+typedef struct meshHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int nvert;
+    unsigned int ntext;
+    unsigned int nnorm;
+    unsigned int nface;
+} meshHeader;
+
+/* arrays allocated for the given sizes and left uninitialized, no maps */
+Model * createModel(unsigned int nvert, unsigned int ntext, unsigned int nnorm, unsigned int nface);
+
+/*
+ * Faces may be v, v/vt, v//vn or v/vt/vn, with any number of corners
+ * (fans around the first) and indices counting back from -1. NULL with
+ * file:line and the reason on stderr when a record is malformed.
+ */
 Model * loadFromObj(const char *filename);
 
+Model * loadFromMesh(const char *filename);
+
+int saveToMesh(Model *model, const char *filename);
+
+/* obj to binary mesh in two passes over the file, memory use doesn't grow with the mesh */
+int convertObjToMesh(const char *objname, const char *meshname);
+
+/* picks the obj or binary loader by looking at the file magic */
+Model * loadModel(const char *filename);
+
+/* a texture flipped the way the get* lookups expect */
+tgaImage * loadTextureMap(const char *filename);
+
 int loadDiffuseMap(Model *model, const char *filename);
 int loadNormalMap(Model *model, const char *filename);
 int loadSpecularMap(Model *model, const char *filename);
@@ -30,12 +68,22 @@ Vec3 * getDiffuseUV(Model *model, unsigned int nface, unsigned int nvert);
 
 Vec3 * getVertex(Model *model, unsigned int nface, unsigned int nvert);
 
+unsigned int getVertexIndex(Model *model, unsigned int nface, unsigned int nvert);
+
 Vec3 * getNorm(Model *model, unsigned int nface, unsigned int nvert);
 
 tgaColor getDiffuseColor(Model *model, Vec3 *uv);
 
 int getNormal(Model *model, Vec3 *n, Vec3 *uv);
 
+double getSpecular(Model *model, Vec3 *uv);
+
+// box around every position, lo and hi
+void modelBounds(Model *model, Vec3 bounds[2]);
+
+/* per face tangent frame from positions and uvs, needed for tangent space normal maps */
+int computeTangents(Model *model);
+
 void freeModel(Model *);
 
 #endif // MODEL_H_
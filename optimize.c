@@ -0,0 +1,259 @@
+#include "optimize.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* faces around every position, compressed rows */
+typedef struct adjacency {
+    unsigned int *offsets; // nvert + 1
+    unsigned int *faces;   // 3 * nface
+    unsigned int max_degree;
+} adjacency;
+
+static int buildAdjacency(Model *model, adjacency *adj)
+{
+    unsigned int i, k;
+    adj->offsets = (unsigned int *)calloc(model->nvert + 1, sizeof(unsigned int));
+    adj->faces = (unsigned int *)malloc(((size_t)3 * model->nface + 1) * sizeof(unsigned int));
+    if (!adj->offsets || !adj->faces) {
+        free(adj->offsets);
+        free(adj->faces);
+        return -1;
+    }
+    for (i = 0; i < model->nface; ++i) {
+        for (k = 0; k < 9; k += 3) {
+            ++adj->offsets[model->faces[i][k] + 1];
+        }
+    }
+    adj->max_degree = 0;
+    for (i = 0; i < model->nvert; ++i) {
+        if (adj->offsets[i + 1] > adj->max_degree) {
+            adj->max_degree = adj->offsets[i + 1];
+        }
+        adj->offsets[i + 1] += adj->offsets[i];
+    }
+    // fill from the back so every row ends up in face order
+    for (i = model->nface; i-- > 0;) {
+        for (k = 0; k < 9; k += 3) {
+            unsigned int v = model->faces[i][k];
+            adj->faces[adj->offsets[v + 1] - 1] = i;
+            --adj->offsets[v + 1];
+        }
+    }
+    // offsets[v + 1] now holds the start of row v, shift back
+    memmove(adj->offsets, adj->offsets + 1, model->nvert * sizeof(unsigned int));
+    adj->offsets[model->nvert] = 3 * model->nface;
+    return 0;
+}
+
+static int permute(void *data, size_t size, const unsigned int *order, unsigned int n)
+{
+    unsigned char *tmp = (unsigned char *)malloc((size_t)n * size + 1);
+    if (!tmp) {
+        return -1;
+    }
+    unsigned int i;
+    for (i = 0; i < n; ++i) {
+        memcpy(tmp + (size_t)i * size, (unsigned char *)data + (size_t)order[i] * size, size);
+    }
+    memcpy(data, tmp, (size_t)n * size);
+    free(tmp);
+    return 0;
+}
+
+int optimizeFaceOrder(Model *model, unsigned int cache_size)
+{
+    assert(model);
+    assert(cache_size > 0);
+    unsigned int n = model->nvert, m = model->nface;
+    if (!m) {
+        return 0;
+    }
+    adjacency adj;
+    if (-1 == buildAdjacency(model, &adj)) {
+        return -1;
+    }
+    unsigned int *live = (unsigned int *)malloc((n + 1) * sizeof(unsigned int));
+    unsigned int *stamp = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+    unsigned int *dead_end = (unsigned int *)malloc(((size_t)3 * m + 1) * sizeof(unsigned int));
+    unsigned int *candidates = (unsigned int *)malloc(((size_t)3 * adj.max_degree + 1) * sizeof(unsigned int));
+    unsigned int *order = (unsigned int *)malloc((m + 1) * sizeof(unsigned int));
+    unsigned char *emitted = (unsigned char *)calloc(m + 1, 1);
+    int rv = -1;
+    if (!live || !stamp || !dead_end || !candidates || !order || !emitted) {
+        goto out;
+    }
+    unsigned int i, k;
+    for (i = 0; i < n; ++i) {
+        live[i] = adj.offsets[i + 1] - adj.offsets[i];
+    }
+
+    size_t ndead = 0;
+    unsigned int norder = 0;
+    unsigned int time = cache_size + 1;
+    unsigned int scan = 0; // next vertex to try once fans and dead ends run out
+    long fan = 0;
+    while (fan >= 0) {
+        unsigned int ncand = 0;
+        for (i = adj.offsets[fan]; i < adj.offsets[fan + 1]; ++i) {
+            unsigned int f = adj.faces[i];
+            if (emitted[f]) {
+                continue;
+            }
+            emitted[f] = 1;
+            order[norder++] = f;
+            for (k = 0; k < 9; k += 3) {
+                unsigned int v = model->faces[f][k];
+                dead_end[ndead++] = v;
+                candidates[ncand++] = v;
+                --live[v];
+                if (time - stamp[v] > cache_size) {
+                    stamp[v] = time++;
+                }
+            }
+        }
+
+        // the candidate still in cache after its remaining fan, oldest first
+        long best = -1, next = -1;
+        for (i = 0; i < ncand; ++i) {
+            unsigned int v = candidates[i];
+            if (!live[v]) {
+                continue;
+            }
+            long priority = 0;
+            if (time - stamp[v] + 2 * live[v] <= cache_size) {
+                priority = time - stamp[v];
+            }
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+        while (next < 0 && ndead) {
+            unsigned int v = dead_end[--ndead];
+            if (live[v]) {
+                next = v;
+            }
+        }
+        while (next < 0 && scan < n) {
+            if (live[scan]) {
+                next = scan;
+            }
+            ++scan;
+        }
+        fan = next;
+    }
+    assert(norder == m);
+
+    if (-1 == permute(model->faces, sizeof(Face), order, m)) {
+        goto out;
+    }
+    if (model->tangents && model->bitangents &&
+        (-1 == permute(model->tangents, sizeof(Vec3), order, m) ||
+         -1 == permute(model->bitangents, sizeof(Vec3), order, m))) {
+        // faces moved already, frames are cheap to redo
+        computeTangents(model);
+    }
+    rv = 0;
+out:
+    free(emitted);
+    free(order);
+    free(candidates);
+    free(dead_end);
+    free(stamp);
+    free(live);
+    free(adj.offsets);
+    free(adj.faces);
+    return rv;
+}
+
+/* first use renumbering of one attribute, `corner` is 0, 1 or 2 within a Face triple */
+static int renumber(Model *model, Vec3 *values, unsigned int count, int corner)
+{
+    if (!count) {
+        return 0;
+    }
+    unsigned int *remap = (unsigned int *)malloc((size_t)count * sizeof(unsigned int));
+    unsigned int *order = (unsigned int *)malloc((size_t)count * sizeof(unsigned int));
+    if (!remap || !order) {
+        free(remap);
+        free(order);
+        return -1;
+    }
+    unsigned int i, k, next = 0;
+    for (i = 0; i < count; ++i) {
+        remap[i] = count;
+    }
+    for (i = 0; i < model->nface; ++i) {
+        for (k = corner; k < 9; k += 3) {
+            unsigned int v = model->faces[i][k];
+            if (v < count && remap[v] == count) {
+                order[next] = v;
+                remap[v] = next++;
+            }
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        if (remap[i] == count) {
+            order[next] = i;
+            remap[i] = next++;
+        }
+    }
+    int rv = permute(values, sizeof(Vec3), order, count);
+    if (rv == 0) {
+        for (i = 0; i < model->nface; ++i) {
+            for (k = corner; k < 9; k += 3) {
+                if (model->faces[i][k] < count) {
+                    model->faces[i][k] = remap[model->faces[i][k]];
+                }
+            }
+        }
+    }
+    free(order);
+    free(remap);
+    return rv;
+}
+
+int optimizeVertexOrder(Model *model)
+{
+    assert(model);
+    if (-1 == renumber(model, model->vertices, model->nvert, 0) ||
+        -1 == renumber(model, model->textures, model->ntext, 1) ||
+        -1 == renumber(model, model->normals, model->nnorm, 2)) {
+        return -1;
+    }
+    return 0;
+}
+
+int optimizeModel(Model *model)
+{
+    if (-1 == optimizeFaceOrder(model, OPTIMIZE_CACHE_SIZE)) {
+        return -1;
+    }
+    return optimizeVertexOrder(model);
+}
+
+double cacheMissRatio(Model *model, unsigned int cache_size)
+{
+    assert(model);
+    if (!model->nface) {
+        return 0;
+    }
+    unsigned int *stamp = (unsigned int *)calloc(model->nvert + 1, sizeof(unsigned int));
+    if (!stamp) {
+        return -1;
+    }
+    // a vertex is in the fifo when it went in less than cache_size misses ago
+    unsigned int misses = 0, i, k;
+    for (i = 0; i < model->nface; ++i) {
+        for (k = 0; k < 9; k += 3) {
+            unsigned int v = model->faces[i][k];
+            if (!stamp[v] || misses - stamp[v] >= cache_size) {
+                stamp[v] = ++misses;
+            }
+        }
+    }
+    free(stamp);
+    return (double)misses / model->nface;
+}
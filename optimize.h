@@ -0,0 +1,29 @@
+#ifndef OPTIMIZE_H_
+#define OPTIMIZE_H_
+
+#include "model.h"
+
+#define OPTIMIZE_CACHE_SIZE 16 // fifo entries the face order is tuned for
+
+/*
+ * Tipsify (Sander, Nehab, Barczak 2007): fans around recently used
+ * vertices so a small fifo of transformed vertices keeps hitting, and
+ * consecutive faces touch neighbouring memory. Per face tangents follow
+ * their faces. -1 when out of memory, the model is then unchanged.
+ */
+int optimizeFaceOrder(Model *model, unsigned int cache_size);
+
+/*
+ * Renumbers positions, uvs and normals in the order faces first use them,
+ * so walking the faces walks the attribute arrays forwards. Entries no face
+ * uses keep their relative order at the end.
+ */
+int optimizeVertexOrder(Model *model);
+
+// both, faces first
+int optimizeModel(Model *model);
+
+// average transforms per face through a fifo of cache_size positions, 0.5 is ideal
+double cacheMissRatio(Model *model, unsigned int cache_size);
+
+#endif // OPTIMIZE_H_
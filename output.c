@@ -0,0 +1,657 @@
+#include "output.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define ADLER_MOD 65521
+#define HASH_BITS 15
+#define WINDOW 32768
+#define MAX_MATCH 258
+#define MIN_MATCH 3
+#define INSERT_MATCH 16  // longer matches don't feed the hash, as in zlib's fastest level
+
+static const char *format_names[OUTPUT_FORMATS] = {
+    "tga", "tga-rle", "ppm", "pam", "png", "png-stored", "raw"
+};
+
+static const unsigned short length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// filled once: crc32 table and the fixed Huffman codes, bit reversed for LSB first output
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+static uint32_t crc_table[8][256];    // slicing by 8
+static unsigned short lit_code[288];
+static unsigned char lit_bits[288];
+static unsigned char dist_code[30];
+static unsigned char length_symbol[MAX_MATCH + 1];
+static unsigned char dist_symbol_small[257];   // distances 1..256
+static unsigned char dist_symbol_large[256];   // (distance - 1) >> 7 above that
+
+static unsigned int reverseBits(unsigned int code, unsigned int n)
+{
+    unsigned int r = 0, i;
+    for (i = 0; i < n; ++i) {
+        r = (r << 1) | ((code >> i) & 1);
+    }
+    return r;
+}
+
+static void initTables(void)
+{
+    unsigned int i, k;
+    for (i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (k = 0; k < 8; ++k) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (i = 0; i < 256; ++i) {
+        for (k = 1; k < 8; ++k) {
+            crc_table[k][i] = crc_table[0][crc_table[k - 1][i] & 0xff] ^ (crc_table[k - 1][i] >> 8);
+        }
+    }
+    for (i = 0; i < 288; ++i) {
+        unsigned int code, bits;
+        if (i < 144) {
+            code = 0x30 + i, bits = 8;
+        } else if (i < 256) {
+            code = 0x190 + i - 144, bits = 9;
+        } else if (i < 280) {
+            code = i - 256, bits = 7;
+        } else {
+            code = 0xc0 + i - 280, bits = 8;
+        }
+        lit_code[i] = reverseBits(code, bits);
+        lit_bits[i] = bits;
+    }
+    for (i = 0; i < 30; ++i) {
+        dist_code[i] = reverseBits(i, 5);
+    }
+    for (i = 0, k = MIN_MATCH; k <= MAX_MATCH; ++k) {
+        while (i < 28 && length_base[i + 1] <= k) {
+            ++i;
+        }
+        length_symbol[k] = i;
+    }
+    for (i = 0, k = 1; k <= 256; ++k) {
+        while (i < 29 && dist_base[i + 1] <= k) {
+            ++i;
+        }
+        dist_symbol_small[k] = i;
+    }
+    for (k = 0; k < 256; ++k) {
+        unsigned int d = (k << 7) + 1;
+        for (i = 0; i < 29 && dist_base[i + 1] <= d; ++i)
+            ;
+        dist_symbol_large[k] = i;
+    }
+}
+
+static uint32_t crc32Update(uint32_t crc, const unsigned char *p, size_t n)
+{
+    crc = ~crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+              crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][p[4]] ^ crc_table[2][p[5]] ^ crc_table[1][p[6]] ^ crc_table[0][p[7]];
+    }
+    while (n--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32Update(uint32_t adler, const unsigned char *p, size_t n)
+{
+    uint32_t s1 = adler & 0xffff, s2 = adler >> 16;
+    while (n) {
+        size_t chunk = n < 5552 ? n : 5552; // largest run without overflowing s2
+        n -= chunk;
+        while (chunk--) {
+            s1 += *p++;
+            s2 += s1;
+        }
+        s1 %= ADLER_MOD;
+        s2 %= ADLER_MOD;
+    }
+    return s2 << 16 | s1;
+}
+
+// adler32 of a followed by b, from the checksums of each and the length of b
+static uint32_t adler32Combine(uint32_t a, uint32_t b, size_t len_b)
+{
+    uint64_t rem = len_b % ADLER_MOD;
+    uint64_t a1 = a & 0xffff, a2 = a >> 16, b1 = b & 0xffff, b2 = b >> 16;
+    uint32_t s1 = (a1 + b1 + ADLER_MOD - 1) % ADLER_MOD;
+    uint32_t s2 = (rem * a1 + a2 + b2 + ADLER_MOD - rem) % ADLER_MOD;
+    return s2 << 16 | s1;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+typedef struct bitWriter {
+    unsigned char *out;
+    uint64_t bits;
+    unsigned int count;
+} bitWriter;
+
+static void putBits(bitWriter *w, uint32_t value, unsigned int n)
+{
+    w->bits |= (uint64_t)value << w->count;
+    w->count += n;
+    while (w->count >= 8) {
+        *w->out++ = w->bits;
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+static unsigned int hash3(const unsigned char *p)
+{
+    return ((uint32_t)(p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/*
+ * One fixed Huffman block over in, then an empty stored block so the
+ * output ends byte aligned and the next strip can follow it. head holds
+ * the last position + 1 seen for every hash, 0 for none.
+ */
+static unsigned char * deflateFast(const unsigned char *in, size_t n, unsigned char *out, uint32_t *head)
+{
+    bitWriter w = { out, 0, 0 };
+    size_t i = 0;
+    memset(head, 0, sizeof(uint32_t) << HASH_BITS);
+    putBits(&w, 1 << 1, 3); // not final, fixed codes
+    while (i < n) {
+        size_t len = 0, dist = 0;
+        if (i + MIN_MATCH <= n) {
+            unsigned int h = hash3(in + i);
+            size_t cand = head[h];
+            head[h] = i + 1;
+            if (cand && i - (cand - 1) <= WINDOW) {
+                const unsigned char *a = in + cand - 1, *b = in + i;
+                size_t max = n - i < MAX_MATCH ? n - i : MAX_MATCH;
+                while (len < max && a[len] == b[len]) {
+                    ++len;
+                }
+                dist = i - (cand - 1);
+            }
+        }
+        if (len >= MIN_MATCH) {
+            unsigned int s = length_symbol[len];
+            putBits(&w, lit_code[257 + s], lit_bits[257 + s]);
+            putBits(&w, len - length_base[s], length_extra[s]);
+            unsigned int d = dist <= 256 ? dist_symbol_small[dist] : dist_symbol_large[(dist - 1) >> 7];
+            putBits(&w, dist_code[d], 5);
+            putBits(&w, dist - dist_base[d], dist_extra[d]);
+            if (len <= INSERT_MATCH) {
+                size_t k;
+                for (k = 1; k < len && i + k + MIN_MATCH <= n; ++k) {
+                    head[hash3(in + i + k)] = i + k + 1;
+                }
+            }
+            i += len;
+        } else {
+            putBits(&w, lit_code[in[i]], lit_bits[in[i]]);
+            ++i;
+        }
+    }
+    putBits(&w, lit_code[256], lit_bits[256]);
+    putBits(&w, 0, 3); // not final, stored
+    if (w.count) {
+        *w.out++ = w.bits;
+    }
+    memcpy(w.out, "\x00\x00\xff\xff", 4);
+    return w.out + 4;
+}
+
+static unsigned char * deflateStored(const unsigned char *in, size_t n, unsigned char *out)
+{
+    while (n) {
+        size_t len = n < OUTPUT_STORED_BLOCK ? n : OUTPUT_STORED_BLOCK;
+        out[0] = 0; // not final, stored
+        out[1] = len;
+        out[2] = len >> 8;
+        out[3] = ~len;
+        out[4] = ~len >> 8;
+        memcpy(out + 5, in, len);
+        out += 5 + len;
+        in += len;
+        n -= len;
+    }
+    return out;
+}
+
+// tga rows are BGR(A), every other format wants RGB(A)
+static void swizzleRow(const unsigned char *src, unsigned char *dst, unsigned int width, unsigned int bpp, unsigned int out_bpp)
+{
+    unsigned int x;
+    if (bpp == GRAYSCALE) {
+        memcpy(dst, src, width);
+        return;
+    }
+    for (x = 0; x < width; ++x, src += bpp, dst += out_bpp) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        if (out_bpp == 4) {
+            dst[3] = src[3];
+        }
+    }
+}
+
+static unsigned char paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+static void applyFilter(int type, const unsigned char *cur, const unsigned char *prev, size_t len,
+                        unsigned int bpp, unsigned char *f)
+{
+    size_t i;
+    switch (type) {
+    case 0:
+        memcpy(f, cur, len);
+        break;
+    case 1:
+        memcpy(f, cur, bpp);
+        for (i = bpp; i < len; ++i) {
+            f[i] = cur[i] - cur[i - bpp];
+        }
+        break;
+    case 2:
+        for (i = 0; i < len; ++i) {
+            f[i] = cur[i] - prev[i];
+        }
+        break;
+    case 3:
+        for (i = 0; i < bpp; ++i) {
+            f[i] = cur[i] - (prev[i] >> 1);
+        }
+        for (; i < len; ++i) {
+            f[i] = cur[i] - ((cur[i - bpp] + prev[i]) >> 1);
+        }
+        break;
+    default:
+        for (i = 0; i < bpp; ++i) {
+            f[i] = cur[i] - prev[i];
+        }
+        for (; i < len; ++i) {
+            f[i] = cur[i] - paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+        }
+        break;
+    }
+}
+
+/* the filter with the smallest sum of signed bytes, the usual png heuristic */
+static void filterRow(const unsigned char *cur, const unsigned char *prev, size_t len, unsigned int bpp,
+                      unsigned char *out, unsigned char *scratch)
+{
+    unsigned long best = ~0ul;
+    int type;
+    for (type = 0; type < 5; ++type) {
+        unsigned char *f = type ? scratch : out + 1;
+        unsigned long sum = 0;
+        size_t i;
+        applyFilter(type, cur, prev, len, bpp, f);
+        for (i = 0; i < len; ++i) {
+            sum += abs((signed char)f[i]);
+        }
+        if (sum < best) {
+            best = sum;
+            out[0] = type;
+            if (type) {
+                memcpy(out + 1, scratch, len);
+            }
+        }
+    }
+}
+
+typedef struct outputStrip {
+    tgaImage *image;
+    int format;
+    int flags;
+    unsigned int first, rows;
+    unsigned char *data;    // encoded bytes, a whole IDAT chunk for png
+    size_t size;
+    size_t raw;             // png: filtered bytes fed to deflate
+    uint32_t adler;         // png: of those bytes
+    int error;
+    renderStats stats;      // of the helper thread, for statsJoin
+} outputStrip;
+
+// row j in output order, top first
+static const unsigned char * outputRow(tgaImage *image, unsigned int j, int flags)
+{
+    unsigned int row = flags & OUTPUT_BOTTOM_UP ? image->height - 1 - j : j;
+    return image->data + (size_t)row * image->width * image->bpp;
+}
+
+static unsigned int outputBpp(tgaImage *image, int format)
+{
+    if (format == OUTPUT_PPM || format == OUTPUT_RAW) {
+        return image->bpp == GRAYSCALE ? 1 : 3;
+    }
+    return image->bpp;
+}
+
+static int encodePng(outputStrip *strip)
+{
+    tgaImage *image = strip->image;
+    unsigned int bpp = outputBpp(image, strip->format);
+    size_t len = (size_t)image->width * bpp;
+    size_t raw = strip->rows * (len + 1);
+    int stored = strip->format == OUTPUT_PNG_STORED;
+    size_t bound = stored ? raw + 5 * (raw / OUTPUT_STORED_BLOCK + 1) : raw + raw / 8 + 64;
+    unsigned char *filtered = (unsigned char *)malloc(raw);
+    unsigned char *rows = (unsigned char *)calloc(2, len + 1); // current, previous
+    uint32_t *head = stored ? NULL : (uint32_t *)malloc(sizeof(uint32_t) << HASH_BITS);
+    strip->data = (unsigned char *)malloc(bound + 12 + 2);
+    if (!filtered || !rows || (!stored && !head) || !strip->data) {
+        free(filtered);
+        free(rows);
+        free(head);
+        return -1;
+    }
+    unsigned char *cur = rows, *prev = rows + len + 1;
+    if (strip->first) {
+        swizzleRow(outputRow(image, strip->first - 1, strip->flags), prev, image->width, image->bpp, bpp);
+    }
+    unsigned int j;
+    for (j = 0; j < strip->rows; ++j) {
+        unsigned char *f = filtered + j * (len + 1);
+        swizzleRow(outputRow(image, strip->first + j, strip->flags), cur, image->width, image->bpp, bpp);
+        if (stored) {
+            f[0] = 0;
+            memcpy(f + 1, cur, len);
+        } else {
+            filterRow(cur, prev, len, bpp, f, strip->data); // output buffer is scratch until deflate
+        }
+        unsigned char *t = cur;
+        cur = prev;
+        prev = t;
+    }
+    strip->raw = raw;
+    strip->adler = adler32Update(1, filtered, raw);
+
+    unsigned char *p = strip->data + 8;
+    if (!strip->first) {
+        *p++ = 0x78; // zlib, 32k window
+        *p++ = 0x01;
+    }
+    p = stored ? deflateStored(filtered, raw, p) : deflateFast(filtered, raw, p, head);
+    put32(strip->data, p - strip->data - 8);
+    memcpy(strip->data + 4, "IDAT", 4);
+    put32(p, crc32Update(0, strip->data + 4, p - strip->data - 4));
+    strip->size = p + 4 - strip->data;
+    free(filtered);
+    free(rows);
+    free(head);
+    return 0;
+}
+
+static void * encodeStrip(void *arg)
+{
+    outputStrip *strip = (outputStrip *)arg;
+    tgaImage *image = strip->image;
+    unsigned int j;
+    if (strip->format == OUTPUT_PNG || strip->format == OUTPUT_PNG_STORED) {
+        strip->error = encodePng(strip);
+        return NULL;
+    }
+    if (strip->format == OUTPUT_TGA_RLE) {
+        strip->data = (unsigned char *)malloc((size_t)strip->rows * image->width * (image->bpp + 1));
+        if (!strip->data) {
+            strip->error = -1;
+            return NULL;
+        }
+        if (!(strip->flags & OUTPUT_BOTTOM_UP)) {
+            strip->size = tgaEncodeRLE(image, strip->first, strip->rows, strip->data);
+            return NULL;
+        }
+        strip->size = 0;
+        for (j = 0; j < strip->rows; ++j) {
+            strip->size += tgaEncodeRLE(image, image->height - 1 - strip->first - j, 1, strip->data + strip->size);
+        }
+        return NULL;
+    }
+    unsigned int bpp = outputBpp(image, strip->format);
+    size_t len = (size_t)image->width * bpp;
+    strip->data = (unsigned char *)malloc(strip->rows * len);
+    if (!strip->data) {
+        strip->error = -1;
+        return NULL;
+    }
+    for (j = 0; j < strip->rows; ++j) {
+        swizzleRow(outputRow(image, strip->first + j, strip->flags), strip->data + j * len, image->width, image->bpp, bpp);
+    }
+    strip->size = strip->rows * len;
+    return NULL;
+}
+
+/* encodeStrip on a helper thread */
+static void * encodeThread(void *arg)
+{
+    encodeStrip(arg);
+    statsTake(&((outputStrip *)arg)->stats);
+    return NULL;
+}
+
+static int writeChunk(FILE *fd, const char *type, const unsigned char *data, uint32_t len)
+{
+    unsigned char head[8], tail[4];
+    put32(head, len);
+    memcpy(head + 4, type, 4);
+    put32(tail, crc32Update(crc32Update(0, head + 4, 4), data, len));
+    if (1 != fwrite(head, 8, 1, fd) || (len && 1 != fwrite(data, len, 1, fd)) || 1 != fwrite(tail, 4, 1, fd)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int writeHeader(tgaImage *image, FILE *fd, int format)
+{
+    static const char *tuple_types[5] = { NULL, "GRAYSCALE", NULL, "RGB", "RGB_ALPHA" };
+    switch (format) {
+    case OUTPUT_TGA:
+    case OUTPUT_TGA_RLE:
+        return tgaWriteHeader(image, fd, format == OUTPUT_TGA_RLE);
+    case OUTPUT_PPM:
+        return fprintf(fd, "P%c\n%u %u\n255\n", image->bpp == GRAYSCALE ? '5' : '6',
+                       image->width, image->height) < 0 ? -1 : 0;
+    case OUTPUT_PAM:
+        return fprintf(fd, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                       image->width, image->height, image->bpp, tuple_types[image->bpp]) < 0 ? -1 : 0;
+    case OUTPUT_PNG:
+    case OUTPUT_PNG_STORED: {
+        static const unsigned char color_types[5] = { 0, 0, 0, 2, 6 };
+        unsigned char ihdr[13];
+        put32(ihdr, image->width);
+        put32(ihdr + 4, image->height);
+        ihdr[8] = 8;
+        ihdr[9] = color_types[image->bpp];
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;
+        if (1 != fwrite("\x89PNG\r\n\x1a\n", 8, 1, fd)) {
+            return -1;
+        }
+        return writeChunk(fd, "IHDR", ihdr, sizeof(ihdr));
+    }
+    default:
+        return 0;
+    }
+}
+
+int outputParseFormat(const char *name)
+{
+    assert(name);
+    int i;
+    for (i = 0; i < OUTPUT_FORMATS; ++i) {
+        if (!strcmp(name, format_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int outputFormatFromPath(const char *path)
+{
+    assert(path);
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/')) {
+        return OUTPUT_TGA;
+    }
+    ++ext;
+    if (!strcasecmp(ext, "png")) {
+        return OUTPUT_PNG;
+    } else if (!strcasecmp(ext, "ppm") || !strcasecmp(ext, "pgm")) {
+        return OUTPUT_PPM;
+    } else if (!strcasecmp(ext, "pam")) {
+        return OUTPUT_PAM;
+    } else if (!strcasecmp(ext, "raw")) {
+        return OUTPUT_RAW;
+    }
+    return OUTPUT_TGA;
+}
+
+int outputWrite(tgaImage *image, FILE *fd, int format, unsigned int threads, int flags)
+{
+    assert(image);
+    assert(fd);
+    assert(format >= 0 && format < OUTPUT_FORMATS);
+    assert(image->bpp == GRAYSCALE || image->bpp == RGB || image->bpp == RGBA);
+    pthread_once(&tables_once, initTables);
+
+    if (-1 == writeHeader(image, fd, format)) {
+        return -1;
+    }
+    if (format == OUTPUT_TGA) {
+        size_t data_size = (size_t)image->height * image->width * image->bpp;
+        if (flags & OUTPUT_BOTTOM_UP) {
+            size_t len = (size_t)image->width * image->bpp;
+            unsigned int j;
+            for (j = 0; j < image->height; ++j) {
+                if (1 != fwrite(outputRow(image, j, flags), len, 1, fd)) {
+                    return -1;
+                }
+            }
+        } else if (1 != fwrite(image->data, data_size, 1, fd)) {
+            return -1;
+        }
+        return tgaWriteFooter(fd);
+    }
+
+    if (!threads) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? online : 1;
+    }
+    unsigned int most = (image->height + OUTPUT_STRIP_ROWS - 1) / OUTPUT_STRIP_ROWS;
+    unsigned int n = threads < most ? threads : most;
+    outputStrip *strips = (outputStrip *)calloc(n, sizeof(outputStrip));
+    pthread_t *tids = (pthread_t *)calloc(n, sizeof(pthread_t));
+    int *started = (int *)calloc(n, sizeof(int));
+    if (!strips || !tids || !started) {
+        free(strips);
+        free(tids);
+        free(started);
+        return -1;
+    }
+    unsigned int i;
+    for (i = 0; i < n; ++i) {
+        strips[i].image = image;
+        strips[i].format = format;
+        strips[i].flags = flags;
+        strips[i].first = (uint64_t)image->height * i / n;
+        strips[i].rows = (uint64_t)image->height * (i + 1) / n - strips[i].first;
+    }
+    for (i = 1; i < n; ++i) {
+        started[i] = !pthread_create(&tids[i], NULL, encodeThread, &strips[i]);
+    }
+    encodeStrip(&strips[0]);
+    for (i = 1; i < n; ++i) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+            statsJoin(&strips[i].stats);
+        } else {
+            encodeStrip(&strips[i]);
+        }
+    }
+
+    int rv = 0;
+    uint32_t adler = 1;
+    for (i = 0; i < n; ++i) {
+        if (strips[i].error || 1 != fwrite(strips[i].data, strips[i].size, 1, fd)) {
+            rv = -1;
+            break;
+        }
+        adler = adler32Combine(adler, strips[i].adler, strips[i].raw);
+    }
+    if (!rv && format == OUTPUT_TGA_RLE) {
+        rv = tgaWriteFooter(fd);
+    } else if (!rv && (format == OUTPUT_PNG || format == OUTPUT_PNG_STORED)) {
+        // the final, empty stored block and the zlib checksum
+        unsigned char end[9] = { 0x01, 0x00, 0x00, 0xff, 0xff };
+        put32(end + 5, adler);
+        if (-1 == writeChunk(fd, "IDAT", end, sizeof(end)) || -1 == writeChunk(fd, "IEND", NULL, 0)) {
+            rv = -1;
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        free(strips[i].data);
+    }
+    free(strips);
+    free(tids);
+    free(started);
+    return rv;
+}
+
+int outputSave(tgaImage *image, const char *filename, int format, unsigned int threads, int flags)
+{
+    assert(image);
+    assert(filename);
+    if (!strcmp(filename, "-")) {
+        if (-1 == outputWrite(image, stdout, format, threads, flags) || EOF == fflush(stdout)) {
+            return -1;
+        }
+        return 0;
+    }
+    FILE *fd = fopen(filename, "wb");
+    if (!fd) {
+        return -1;
+    }
+    int rv = outputWrite(image, fd, format, threads, flags);
+    if (EOF == fclose(fd)) {
+        rv = -1;
+    }
+    return rv;
+}
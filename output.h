@@ -0,0 +1,54 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <stdio.h>
+#include "tga.h"
+
+#define OUTPUT_STRIP_ROWS 32   // fewest rows given to one encoding thread
+#define OUTPUT_STORED_BLOCK 65535
+
+// flags: image rows are bottom first, as rendered; written top first without flipping the image
+#define OUTPUT_BOTTOM_UP 1
+
+/*
+ * Image writers. Files always hold rows top first, as tgaSaveToFile writes
+ * them; a rendered image is written with OUTPUT_BOTTOM_UP instead of being
+ * flipped, so the framebuffer is left as it is between frames. RGBA keeps
+ * its alpha in tga, pam and png, ppm and raw hold RGB or gray only.
+ *
+ *   tga         uncompressed, as tgaSaveToFile
+ *   tga-rle     run length packets, small for flat backgrounds
+ *   ppm         binary P6, or P5 for gray
+ *   pam         P7 with a tuple type
+ *   png         fixed Huffman deflate with a one entry hash, per row filters
+ *   png-stored  deflate stored blocks, no filtering, fastest png
+ *   raw         bare RGB or gray rows, for piping into other tools
+ *
+ * Everything but tga is encoded by row strips on several threads. Every
+ * png strip is a run of deflate blocks ending byte aligned in its own
+ * IDAT chunk, so strips compress apart and are written in order.
+ */
+enum outputFormat {
+    OUTPUT_TGA,
+    OUTPUT_TGA_RLE,
+    OUTPUT_PPM,
+    OUTPUT_PAM,
+    OUTPUT_PNG,
+    OUTPUT_PNG_STORED,
+    OUTPUT_RAW,
+    OUTPUT_FORMATS
+};
+
+// format by name, -1 when unknown
+int outputParseFormat(const char *name);
+
+// by extension: .png, .ppm/.pgm, .pam, .raw, tga otherwise
+int outputFormatFromPath(const char *path);
+
+// threads 0 takes every online cpu
+int outputWrite(tgaImage *image, FILE *fd, int format, unsigned int threads, int flags);
+
+// "-" writes to stdout
+int outputSave(tgaImage *image, const char *filename, int format, unsigned int threads, int flags);
+
+#endif // OUTPUT_H_
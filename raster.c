@@ -0,0 +1,612 @@
+#include "raster.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+// fragments that passed the depth test, shaded after the raster loop, one buffer per thread
+static __thread Fragment *fragments = NULL;
+static __thread size_t fragcap = 0;
+
+void lookAt(Vec3 eye, Vec3 center, Vec3 up, Mat4x4 M)
+{
+    int i,j,k;
+    Vec3 l = { eye[0] - center[0], eye[1] - center[1], eye[2] - center[2] };
+    double distance = v_length(l);
+    normal_vec3(&l,distance);
+    Vec3 e, h;
+    product_vec3(up,l,&e);
+    normal_vec3(&e,v_length(e));
+    product_vec3(l,e,&h);
+    normal_vec3(&h,v_length(h));
+    double r = -1/distance;
+    Mat4x4 vw1 = {
+               {e[0], e[1], e[2], 0.0},
+               {h[0], h[1], h[2], 0.0},
+               {l[0], l[1], l[2], 0.0},
+               {0.0, 0.0, 0.0, 1.0}
+               };
+    Mat4x4 vw2 = {
+               {1.0, 0.0, 0.0, -center[0]},
+               {0.0, 1.0, 0.0, -center[1]},
+               {0.0, 0.0, 1.0, -center[2]},
+               {0.0, 0.0, 0.0, 1.0}
+               };
+    Mat4x4 a = {
+               {1.0, 0.0, 0.0, 0.0},
+               {0.0, 1.0, 0.0, 0.0},
+               {0.0, 0.0, 1.0, 0.0},
+               {0.0, 0.0,   r, 1.0}
+               };
+    // M = a * vw1 * vw2, built once instead of three products per vertex
+    Mat4x4 T;
+    for (i = 0; i < 4; ++i) {
+        for (j = 0; j < 4; ++j) {
+            T[i][j] = 0.0;
+            for (k = 0; k < 4; ++k) {
+                T[i][j] += vw1[i][k]*vw2[k][j];
+            }
+        }
+    }
+    for (i = 0; i < 4; ++i) {
+        for (j = 0; j < 4; ++j) {
+            M[i][j] = 0.0;
+            for (k = 0; k < 4; ++k) {
+                M[i][j] += a[i][k]*T[k][j];
+            }
+        }
+    }
+}
+
+void defaultCamera(Mat4x4 M)
+{
+	Vec3 eye = {0.0,0.5,3.0};
+	Vec3 center = {0.0,0.5,0.0};
+	Vec3 up = {0.0,1.0,0.0};
+    lookAt(eye, center, up, M);
+}
+
+void projectVertices(tgaImage *image, Model *model, Vector *screen)
+{
+    Mat4x4 M;
+    defaultCamera(M);
+    projectVerticesWith(M, image, model, screen, NULL);
+}
+
+void projectVerticesWith(Mat4x4 M, tgaImage *image, Model *model, Vector *screen, double *invw)
+{
+    int i,j;
+    Mat4x1 b, V;
+    for (j = 0; j < model->nvert; ++j) {
+        for(i = 0; i < 3; ++i) {
+            b[i] = model->vertices[j][i];
+        }
+        b[3] = 1;
+
+        product_mat(M, b, &V);
+
+        screen[j][0] = (V[0]/V[3] + 1)*image->width/2;
+        screen[j][1] = (V[1]/V[3] + 1)*image->height/2;
+        screen[j][2] = (V[2]/V[3] + 1)*255/2;
+        if (invw) {
+            invw[j] = 1/V[3];
+        }
+    }
+}
+
+void resolveSamples(const shadeTarget *target)
+{
+    tgaImage *image = target->image;
+    const int ns = target->samples;
+    int x, y, k;
+    for (y = target->clip[1]; y <= target->clip[3]; ++y)
+    for (x = target->clip[0]; x <= target->clip[2]; ++x) {
+        size_t i = (size_t)y * image->width + x;
+        const tgaColor *s = target->sample_colors + i * ns;
+        unsigned int r = 0, g = 0, b = 0;
+        for (k = 0; k < ns; ++k) {
+            r += Red(s[k]);
+            g += Green(s[k]);
+            b += Blue(s[k]);
+        }
+        tgaColor c = tgaRGB((r + ns/2) / ns, (g + ns/2) / ns, (b + ns/2) / ns);
+        memcpy(image->data + i * image->bpp, &c, image->bpp);
+    }
+}
+
+void line (tgaImage *image, 
+           int x0, int y0,
+           int x1, int y1,
+           tgaColor color)
+{  
+    int flag = 0;
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    if (dx < dy) {
+	    swap(&x0,&y0);
+	    swap(&x1,&y1);
+	    swap(&dx,&dy);
+        flag = 1;
+    }
+    if (x0 > x1) {
+        swap(&x0,&x1);
+	    swap(&y0,&y1);
+    }
+    int e = 0;
+    int de = 2*abs(y1 - y0);
+    int i;
+    int x = x0;
+    int y = y0;	
+    for (i = 0;i <= dx; ++i) {
+	if (e >= dx) {
+        e -= 2*dx;
+	    if (y1 < y0) { 	
+            y -= 1;
+	    } else {
+	        y += 1;
+	    }
+        }
+	if (flag) {
+	    tgaSetPixel(image, y, x, color);
+	} else {
+	    tgaSetPixel(image, x, y, color);
+	}
+	x += 1;
+	e += de;
+    }
+}
+
+// coverage and depth test, returns the number of fragments left in `fragments`
+static inline __attribute__((always_inline))
+size_t rasterizeTemplate(tgaImage *image, const int clip[4], Vector a, Vector b, Vector c, const double z[3], void *zbuffer, const int format, const int record) {
+    int i0 = 0;
+    int i1 = c_length(a[1], b[1], c[1], &i0);
+    int j0 = 0;
+    int j1 = c_length(a[0], b[0], c[0], &j0);
+    // clip bounding box to the image or tile, zbuffer has no guard band
+    if (i0 < clip[1]) i0 = clip[1];
+    if (j0 < clip[0]) j0 = clip[0];
+    if (i1 > clip[3]) i1 = clip[3];
+    if (j1 > clip[2]) j1 = clip[2];
+    if (i0 > i1 || j0 > j1) {
+        return 0;
+    }
+    size_t area = (size_t)(i1 - i0 + 1) * (j1 - j0 + 1);
+    if (record && area > fragcap) { // realloc
+        while (fragcap < area) {
+            fragcap = fragcap ? fragcap * 2 : 64;
+        }
+        fragments = (Fragment *)realloc(fragments, fragcap * sizeof(Fragment));
+        assert(fragments);
+    }
+    statsBegin(STAGE_RASTER);
+    Vector P;
+	Vec3 X, Y, W;
+    int i,j;
+    double U = 0;
+    double V = 0;
+    size_t nfrag = 0;
+    unsigned long long tested = 0;
+    for (i = i0; i <= i1; ++i) {
+       P[1] = i; 
+       for (j = j0; j <= j1; ++j) {
+           P[0] = j;
+           X[0] = a[0] - P[0]; 
+           X[1] = b[0] - a[0]; 
+           X[2] = c[0] - a[0];
+           Y[0] = a[1] - P[1]; 
+           Y[1] = b[1] - a[1]; 
+           Y[2] = c[1] - a[1]; 
+           product_vec3(X, Y, &W);
+           U = W[1]/W[0];
+           V = W[2]/W[0];
+           if ((U < 0) || (V < 0) || ((1 - U - V) < 0)) {
+               continue;
+           }
+           ++tested;
+               if (depthTestWrite(zbuffer, j + i*image->width, (1 - U - V)*z[0] + U*z[1] + V*z[2], format)) {
+                   if (record) {
+                       Fragment *f = &fragments[nfrag];
+                       f->x = j;
+                       f->y = i;
+                       f->u = U;
+                       f->v = V;
+                   }
+                   ++nfrag;
+               }
+       }
+    }
+    statsEnd(STAGE_RASTER);
+    STATS_ADD(CNT_FRAG_TESTED, tested);
+    STATS_ADD(CNT_FRAG_DEPTH_REJECTED, tested - nfrag);
+    return nfrag;
+}
+
+// one specialized loop per depth format, with and without recording fragments
+#define RASTERIZE_FORMAT(fn, format, record, ...) \
+    switch (format) { \
+    case DEPTH_LEGACY: return record ? fn(__VA_ARGS__, DEPTH_LEGACY, 1) : fn(__VA_ARGS__, DEPTH_LEGACY, 0); \
+    case DEPTH_16:     return record ? fn(__VA_ARGS__, DEPTH_16, 1)     : fn(__VA_ARGS__, DEPTH_16, 0); \
+    case DEPTH_24:     return record ? fn(__VA_ARGS__, DEPTH_24, 1)     : fn(__VA_ARGS__, DEPTH_24, 0); \
+    case DEPTH_32:     return record ? fn(__VA_ARGS__, DEPTH_32, 1)     : fn(__VA_ARGS__, DEPTH_32, 0); \
+    case DEPTH_FLOAT:  return record ? fn(__VA_ARGS__, DEPTH_FLOAT, 1)  : fn(__VA_ARGS__, DEPTH_FLOAT, 0); \
+    } \
+    return 0;
+
+static size_t rasterize(tgaImage *image, const int clip[4], Vector a, Vector b, Vector c, const double z[3], void *zbuffer, int format, int record) {
+    RASTERIZE_FORMAT(rasterizeTemplate, format, record, image, clip, a, b, c, z, zbuffer)
+}
+
+void triangle(tgaImage *image, Model* model, Vector a, Vector b, Vector c, Vec3 UVa, Vec3 UVb, Vec3 UVc, double I, int* zbuffer) {
+    double z[3] = { a[2], b[2], c[2] };
+    int clip[4] = { 0, 0, image->width - 1, image->height - 1 };
+    size_t nfrag = rasterize(image, clip, a, b, c, z, zbuffer, DEPTH_LEGACY, 1);
+    STATS_ADD(CNT_FRAG_SHADED, nfrag);
+
+    statsBegin(STAGE_SHADE);
+    tgaColor col;
+    Vec3 Puv = {0.0, 0.0, 0.0};
+    size_t k;
+    for (k = 0; k < nfrag; ++k) {
+        double U = fragments[k].u;
+        double V = fragments[k].v;
+        Puv[0] = (1 - U - V)*UVa[0] + U*UVb[0] + V*UVc[0];
+        Puv[1] = (1 - U - V)*UVa[1] + U*UVb[1] + V*UVc[1];
+        col = getDiffuseColor(model, &Puv);
+        tgaSetPixel(image, fragments[k].x, fragments[k].y, tgaRGB(I*Red(col), I*Green(col), I*Blue(col)) );
+    }
+    statsEnd(STAGE_SHADE);
+}
+
+/* sample positions relative to the pixel, rotated grids as used by most GPUs */
+static const double samples2[2][2] = {
+    { 0.25, 0.25 }, { -0.25, -0.25 }
+};
+static const double samples4[4][2] = {
+    { -0.125, -0.375 }, { 0.375, -0.125 }, { -0.375, 0.125 }, { 0.125, 0.375 }
+};
+static const double samples8[8][2] = {
+    { 0.0625, -0.1875 }, { -0.0625, 0.1875 }, { 0.3125, 0.0625 }, { -0.1875, -0.3125 },
+    { -0.3125, 0.3125 }, { -0.4375, -0.0625 }, { 0.1875, 0.4375 }, { 0.4375, -0.4375 }
+};
+
+static const double (*samplePattern(int samples))[2]
+{
+    switch (samples) {
+    case 2: return samples2;
+    case 4: return samples4;
+    case 8: return samples8;
+    }
+    return NULL;
+}
+
+int validSampleCount(int samples)
+{
+    return samples == 1 || samplePattern(samples) != NULL;
+}
+
+/*
+ * Coverage and depth per sample, one fragment per pixel with the mask of
+ * samples that passed. The fragment is shaded at the centroid of those
+ * samples, which always lies inside the triangle.
+ */
+static inline __attribute__((always_inline))
+size_t rasterizeMsaaTemplate(const shadeTarget *target, Vector a, Vector b, Vector c, const double z[3], void *zbuffer, const int format, const int record) {
+    tgaImage *image = target->image;
+    const int ns = target->samples;
+    const double (*offsets)[2] = samplePattern(ns);
+    int i0 = 0;
+    int i1 = c_length(a[1], b[1], c[1], &i0);
+    int j0 = 0;
+    int j1 = c_length(a[0], b[0], c[0], &j0);
+    if (i0 < target->clip[1]) i0 = target->clip[1];
+    if (j0 < target->clip[0]) j0 = target->clip[0];
+    if (i1 > target->clip[3]) i1 = target->clip[3];
+    if (j1 > target->clip[2]) j1 = target->clip[2];
+    if (i0 > i1 || j0 > j1) {
+        return 0;
+    }
+    size_t area = (size_t)(i1 - i0 + 1) * (j1 - j0 + 1);
+    if (record && area > fragcap) { // realloc
+        while (fragcap < area) {
+            fragcap = fragcap ? fragcap * 2 : 64;
+        }
+        fragments = (Fragment *)realloc(fragments, fragcap * sizeof(Fragment));
+        assert(fragments);
+    }
+    statsBegin(STAGE_RASTER);
+    // same edge terms as product_vec3 in rasterize, constant parts hoisted
+    double X1 = b[0] - a[0], X2 = c[0] - a[0];
+    double Y1 = b[1] - a[1], Y2 = c[1] - a[1];
+    double W0 = X1*Y2 - X2*Y1;
+    size_t nfrag = 0;
+    unsigned long long tested = 0;
+    int i, j, k;
+    for (i = i0; i <= i1; ++i) {
+        for (j = j0; j <= j1; ++j) {
+            size_t zs = (size_t)(j + i*image->width) * ns;
+            unsigned int mask = 0;
+            int covered = 0;
+            int passed = 0;
+            double su = 0, sv = 0;
+            for (k = 0; k < ns; ++k) {
+                double X0 = a[0] - (j + offsets[k][0]);
+                double Y0 = a[1] - (i + offsets[k][1]);
+                double U = (X2*Y0 - X0*Y2)/W0;
+                double V = (X0*Y1 - X1*Y0)/W0;
+                if ((U < 0) || (V < 0) || ((1 - U - V) < 0)) {
+                    continue;
+                }
+                covered = 1;
+                if (depthTestWrite(zbuffer, zs + k, (1 - U - V)*z[0] + U*z[1] + V*z[2], format)) {
+                    mask |= 1u << k;
+                    su += U;
+                    sv += V;
+                    ++passed;
+                }
+            }
+            tested += covered;
+            if (!mask) {
+                continue;
+            }
+            if (record) {
+                Fragment *f = &fragments[nfrag];
+                f->x = j;
+                f->y = i;
+                f->u = su / passed;
+                f->v = sv / passed;
+                f->mask = mask;
+            }
+            ++nfrag;
+        }
+    }
+    statsEnd(STAGE_RASTER);
+    STATS_ADD(CNT_FRAG_TESTED, tested);
+    STATS_ADD(CNT_FRAG_DEPTH_REJECTED, tested - nfrag);
+    return nfrag;
+}
+
+static size_t rasterizeMsaa(const shadeTarget *target, Vector a, Vector b, Vector c, const double z[3], void *zbuffer, int format, int record) {
+    RASTERIZE_FORMAT(rasterizeMsaaTemplate, format, record, target, a, b, c, z, zbuffer)
+}
+
+void triangleShaded(const shadeTarget *target, Model *model, Vector a, Vector b, Vector c, const double z[3], const shader *sh, const shadeFace *face, depthBuffer *depth) {
+    size_t nfrag;
+    int record = sh->shade != NULL;
+    if (target->samples > 1) {
+        nfrag = rasterizeMsaa(target, a, b, c, z, depth->data, depth->format, record);
+    } else {
+        nfrag = rasterize(target->image, target->clip, a, b, c, z, depth->data, depth->format, record);
+    }
+    if (!record) {
+        return;
+    }
+    statsBegin(STAGE_SHADE);
+    if (target->samples > 1) {
+        sh->shade_msaa(target, model, face, fragments, nfrag);
+    } else {
+        sh->shade(target, model, face, fragments, nfrag);
+    }
+    statsEnd(STAGE_SHADE);
+}
+
+int smallTriangle(Vector a, Vector b, Vector c) {
+    int lo, hi;
+    hi = c_length(a[0], b[0], c[0], &lo);
+    if (hi - lo >= SMALL_TRIANGLE) {
+        return 0;
+    }
+    hi = c_length(a[1], b[1], c[1], &lo);
+    return hi - lo < SMALL_TRIANGLE;
+}
+
+/*
+ * The cross product of rasterizeTemplate in integers: W0 is twice the
+ * area, W1 and W2 are the unnormalized weights of b and c. A pixel whose
+ * weights have the wrong sign is certainly outside; the rest go through
+ * the same double expressions as the general loop, so the pixels, weights
+ * and depths match it exactly. Fragments of triangle t are counts[t]
+ * consecutive entries.
+ */
+static inline __attribute__((always_inline))
+size_t rasterizeSmallTemplate(tgaImage *image, const int clip[4], const smallBatch *batch, Vector *screen, const double *zv, unsigned char *counts, void *zbuffer, const int format, const int record) {
+    if (record && fragcap < SMALL_TRIANGLE * SMALL_TRIANGLE * SMALL_BATCH) {
+        fragcap = SMALL_TRIANGLE * SMALL_TRIANGLE * SMALL_BATCH;
+        fragments = (Fragment *)realloc(fragments, fragcap * sizeof(Fragment));
+        assert(fragments);
+    }
+    size_t nfrag = 0;
+    unsigned long long tested = 0;
+    size_t t;
+    for (t = 0; t < batch->count; ++t) {
+        int *a = screen[batch->vert[t][0]];
+        int *b = screen[batch->vert[t][1]];
+        int *c = screen[batch->vert[t][2]];
+        double z[3] = { zv[batch->vert[t][0]], zv[batch->vert[t][1]], zv[batch->vert[t][2]] };
+        int i0, j0;
+        int i1 = c_length(a[1], b[1], c[1], &i0);
+        int j1 = c_length(a[0], b[0], c[0], &j0);
+        if (i0 < clip[1]) i0 = clip[1];
+        if (j0 < clip[0]) j0 = clip[0];
+        if (i1 > clip[3]) i1 = clip[3];
+        if (j1 > clip[2]) j1 = clip[2];
+        int X1 = b[0] - a[0], X2 = c[0] - a[0];
+        int Y1 = b[1] - a[1], Y2 = c[1] - a[1];
+        long W0 = (long)X1*Y2 - (long)X2*Y1;
+        long sign = W0 < 0 ? -1 : 1;
+        size_t first = nfrag;
+        int i, j;
+        for (i = i0; i <= i1; ++i) {
+            int Y0 = a[1] - i;
+            for (j = j0; j <= j1; ++j) {
+                int X0 = a[0] - j;
+                long W1 = (long)X2*Y0 - (long)X0*Y2;
+                long W2 = (long)X0*Y1 - (long)X1*Y0;
+                if (W1*sign < 0 || W2*sign < 0 || (W0 - W1 - W2)*sign < 0) {
+                    continue;
+                }
+                double U = (double)W1/W0;
+                double V = (double)W2/W0;
+                if ((U < 0) || (V < 0) || ((1 - U - V) < 0)) {
+                    continue;
+                }
+                ++tested;
+                if (depthTestWrite(zbuffer, j + i*image->width, (1 - U - V)*z[0] + U*z[1] + V*z[2], format)) {
+                    if (record) {
+                        Fragment *f = &fragments[nfrag];
+                        f->x = j;
+                        f->y = i;
+                        f->u = U;
+                        f->v = V;
+                    }
+                    ++nfrag;
+                }
+            }
+        }
+        counts[t] = nfrag - first;
+    }
+    STATS_ADD(CNT_FRAG_TESTED, tested);
+    STATS_ADD(CNT_FRAG_DEPTH_REJECTED, tested - nfrag);
+    return nfrag;
+}
+
+static size_t rasterizeSmall(tgaImage *image, const int clip[4], const smallBatch *batch, Vector *screen, const double *z, unsigned char *counts, void *zbuffer, int format, int record) {
+    RASTERIZE_FORMAT(rasterizeSmallTemplate, format, record, image, clip, batch, screen, z, counts, zbuffer)
+}
+
+void triangleBatchShaded(const shadeTarget *target, Model *model, smallBatch *batch, Vector *screen, const double *z, const shader *sh, Vec3 light, Vec3 view, const shadeVertices *vs, depthBuffer *depth) {
+    assert(target->samples == 1);
+    unsigned char counts[SMALL_BATCH];
+    int record = sh->shade != NULL;
+    statsBegin(STAGE_RASTER);
+    size_t nfrag = rasterizeSmall(target->image, target->clip, batch, screen, z, counts, depth->data, depth->format, record);
+    statsEnd(STAGE_RASTER);
+    if (record && nfrag) {
+        // later triangles overwrite earlier ones on shared pixels, like one at a time
+        statsBegin(STAGE_SHADE);
+        shadeFace face;
+        size_t t, first = 0;
+        for (t = 0; t < batch->count; ++t) {
+            if (!counts[t]) {
+                continue;
+            }
+            shadeSetup(model, batch->face[t], sh, light, view, vs, &face);
+            sh->shade(target, model, &face, fragments + first, counts[t]);
+            first += counts[t];
+        }
+        statsEnd(STAGE_SHADE);
+    }
+    batch->count = 0;
+}
+
+// 1 if triangle is degenerate or lies completely outside of the image
+int cull(tgaImage *image, Vector a, Vector b, Vector c) {
+    long area = (long)(b[0] - a[0]) * (c[1] - a[1]) - (long)(c[0] - a[0]) * (b[1] - a[1]);
+    if (area == 0) {
+        return 1;
+    }
+    int lo, hi;
+    hi = c_length(a[0], b[0], c[0], &lo);
+    if (hi < 0 || lo >= (int)image->width) {
+        return 1;
+    }
+    hi = c_length(a[1], b[1], c[1], &lo);
+    if (hi < 0 || lo >= (int)image->height) {
+        return 1;
+    }
+    return 0;
+}
+
+void swap(int *a, int *b) {
+    int t = *a;
+    *a = *b;
+    *b = t;
+}
+
+int c_length(int A, int B, int C, int *s) {
+    int a = A;
+    int b = B;
+    int c = C;
+    if (a >= b) {
+        swap(&a, &b);
+    }
+    if (a >= c) {
+        swap(&a, &c);
+    }
+    if (b >= c) {
+        swap(&b, &c);
+    }
+    *s = a;
+    return c ;
+}
+
+int abs(int a) {
+    return (a > 0) ? a : -a;
+}
+
+double d_abs(double a) {
+    return (a > 0) ? a : -a;
+}
+
+int Round(double a) {
+    int b = a;
+    if ((a - b) >= 0.5) {
+        return (b + 1);
+    } else {
+	return b;
+    }
+}
+
+void product_vec3(Vec3 A, Vec3 B, Vec3* W) {
+    (*W)[0] = A[1]*B[2] - A[2]*B[1];
+    (*W)[1] = B[0]*A[2] - A[0]*B[2];
+    (*W)[2] = A[0]*B[1] - A[1]*B[0];
+}
+
+double product_dot(Vec3 A, Vec3 B) {
+    double dot = A[0]*B[0] + A[1]*B[1] + A[2]*B[2];
+    return dot;
+} 
+
+double v_length(Vec3 A) {
+    double length = sqrt(A[0]*A[0] + A[1]*A[1] + A[2]*A[2]);
+    return length;
+}
+double intension (Vec3* v0, Vec3* v1, Vec3* v2, Vec3 light) {
+    Vec3 AB, AC;
+    AB[0] = (*v1)[0] - (*v0)[0];
+    AB[1] = (*v1)[1] - (*v0)[1];
+    AB[2] = (*v1)[2] - (*v0)[2];
+    AC[0] = (*v2)[0] - (*v0)[0];
+    AC[1] = (*v2)[1] - (*v0)[1];
+    AC[2] = (*v2)[2] - (*v0)[2];
+    Vec3 W;
+    product_vec3(AB, AC, &W);
+    W[0] = -W[0];
+    W[1] = -W[1];
+    W[2] = -W[2];
+    normal_vec3(&W, v_length(W));
+    return product_dot(light, W); 
+}
+
+void normal_vec3(Vec3* A, double l) {
+    (*A)[0] = (*A)[0]/l;
+    (*A)[1] = (*A)[1]/l;
+    (*A)[2] = (*A)[2]/l;
+}
+
+void product_mat(Mat4x4 A, Mat4x1 B, Mat4x1* C) {
+    int i,j;
+    Mat4x1 V = {0.0, 0.0, 0.0, 0.0};
+    for(i=0; i < 4; ++i) {
+        for(j=0; j < 4; ++j) {
+            V[i] = V[i] + A[i][j]*B[j];
+        }
+        (*C)[i] = V[i];
+    }
+}
+
+
+ 
@@ -0,0 +1,74 @@
+#ifndef RASTER_H_
+#define RASTER_H_
+
+#include "tga.h"
+#include "model.h"
+#include "shade.h"
+#include "depth.h"
+
+typedef int Vector[3];
+typedef double Mat4x4[4][4];
+typedef double Mat4x1[4];
+
+void swap(int *a, int *b);
+int abs(int a);
+double d_abs(double a);
+int Round(double a);
+int c_length(int a, int b, int c, int *s);
+void product_vec3(Vec3 A, Vec3 B, Vec3 *W);
+double v_length(Vec3 A);
+double product_dot(Vec3 A, Vec3 B);
+double intension (Vec3* v0, Vec3* v1, Vec3* v2, Vec3 light);
+void normal_vec3(Vec3* A, double l);
+void product_mat(Mat4x4 A, Mat4x1 B, Mat4x1* C);
+int cull(tgaImage *image, Vector a, Vector b, Vector c);
+
+void line (tgaImage *image, 
+           int x0, int y0,
+           int x1, int y1,
+           tgaColor color);
+void triangle(tgaImage *image, Model* model, Vector a, Vector b, Vector c, Vec3 UVa, Vec3 UVb, Vec3 UVc, double I, int* zbuffer);
+// rasterizes with the specialized loop of `sh`, face is filled by shadeSetup
+// z is the depth of a, b and c in buffer units, see depthValue
+// with target->samples > 1 depth holds one value per sample
+void triangleShaded(const shadeTarget *target, Model *model, Vector a, Vector b, Vector c, const double z[3], const shader *sh, const shadeFace *face, depthBuffer *depth);
+
+/*
+ * Triangles that passed cull() with a bounding box of at most
+ * SMALL_TRIANGLE x SMALL_TRIANGLE pixels, the common case on dense meshes.
+ * They are queued and rasterized together with integer edge functions,
+ * which give the same pixels and weights as the general loop.
+ */
+#define SMALL_TRIANGLE 4
+#define SMALL_BATCH 256
+
+int smallTriangle(Vector a, Vector b, Vector c);
+
+// consecutive small triangles, by face and position indices
+typedef struct smallBatch {
+    size_t count;
+    unsigned int face[SMALL_BATCH];
+    unsigned int vert[SMALL_BATCH][3];
+} smallBatch;
+
+// depth tests the whole batch then shades it in order, single sample targets only; empties the batch
+// vs is passed on to shadeSetup
+void triangleBatchShaded(const shadeTarget *target, Model *model, smallBatch *batch, Vector *screen, const double *z, const shader *sh, Vec3 light, Vec3 view, const shadeVertices *vs, depthBuffer *depth);
+
+// 1, 2, 4 or 8
+int validSampleCount(int samples);
+
+// averages the samples of every pixel in target->clip into target->image
+void resolveSamples(const shadeTarget *target);
+
+// view and perspective matrix of a camera at eye looking at center
+void lookAt(Vec3 eye, Vec3 center, Vec3 up, Mat4x4 M);
+// from (0, 0.5, 3) towards (0, 0.5, 0)
+void defaultCamera(Mat4x4 M);
+
+// world -> screen space for every vertex of the model, default camera
+void projectVertices(tgaImage *image, Model *model, Vector *screen);
+// with the camera matrix M, also 1/w per vertex for the depth buffer when invw is not NULL
+void projectVerticesWith(Mat4x4 M, tgaImage *image, Model *model, Vector *screen, double *invw);
+
+#endif // RASTER_H_
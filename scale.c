@@ -0,0 +1,257 @@
+#include "scale.h"
+#include "context.h"
+#include "output.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+enum scaleMode { SCALE_STRIPS, SCALE_FRAMES, SCALE_MODES };
+enum scaleStage { SCALE_DRAW, SCALE_SSAO, SCALE_OUTPUT, SCALE_STAGES };
+
+static const char *mode_names[SCALE_MODES] = { "strips", "frames" };
+
+typedef struct scaleWorker {
+    Model *model;
+    const scaleParams *params;
+    renderContext *ctx;
+    FILE *null;
+    unsigned int threads;       // for ssao and the encoder within a frame
+    unsigned int frames;
+    int error;
+    double stage[SCALE_STAGES]; // seconds over all frames
+} scaleWorker;
+
+/* VmHWM can be reset since Linux 4.0, ru_maxrss can't */
+static int resetPeakRss(void)
+{
+    FILE *fd = fopen("/proc/self/clear_refs", "w");
+    if (!fd) {
+        return -1;
+    }
+    int rv = EOF == fputs("5", fd) ? -1 : 0;
+    if (EOF == fclose(fd)) {
+        rv = -1;
+    }
+    return rv;
+}
+
+/* kB */
+static long peakRss(void)
+{
+    long kb = -1;
+    char line[256];
+    FILE *fd = fopen("/proc/self/status", "r");
+    if (fd) {
+        while (kb < 0 && fgets(line, sizeof(line), fd)) {
+            if (1 != sscanf(line, "VmHWM: %ld", &kb)) {
+                kb = -1;
+            }
+        }
+        fclose(fd);
+    }
+    if (kb < 0) {
+        struct rusage ru;
+        kb = getrusage(RUSAGE_SELF, &ru) ? -1 : ru.ru_maxrss;
+    }
+    return kb;
+}
+
+static int scaleFrame(scaleWorker *w)
+{
+    const scaleParams *params = w->params;
+    double t0 = statsWallTime();
+    renderClear(w->ctx, tgaRGB(0, 0, 0));
+    if (-1 == renderDrawModel(w->ctx, w->model, params->shading)) {
+        return -1;
+    }
+    tgaImage *image = renderResolve(w->ctx);
+    double t1 = statsWallTime();
+    if (params->ssao.radius > 0) {
+        ssaoParams ssao = params->ssao;
+        ssao.threads = w->threads;
+        if (-1 == ssaoApply(w->ctx, &ssao)) {
+            return -1;
+        }
+    }
+    double t2 = statsWallTime();
+    if (-1 == outputWrite(image, w->null, params->format, w->threads, OUTPUT_BOTTOM_UP)) {
+        return -1;
+    }
+    double t3 = statsWallTime();
+    w->stage[SCALE_DRAW] += t1 - t0;
+    w->stage[SCALE_SSAO] += t2 - t1;
+    w->stage[SCALE_OUTPUT] += t3 - t2;
+    return 0;
+}
+
+static void * runWorker(void *arg)
+{
+    scaleWorker *w = (scaleWorker *)arg;
+    unsigned int i;
+    for (i = 0; i < w->frames && !w->error; ++i) {
+        w->error = scaleFrame(w);
+    }
+    return NULL;
+}
+
+/* what the contexts of a row hold, the model and the per frame scratch aside */
+static size_t rowBytes(const scaleParams *params, unsigned int size, unsigned int contexts)
+{
+    size_t pixels = (size_t)size * size;
+    size_t bytes = pixels * RGB + depthBytes(size, size, params->samples, params->depth);
+    if (params->samples > 1) {
+        bytes += pixels * params->samples * sizeof(tgaColor);
+    }
+    return bytes * contexts;
+}
+
+static int fitsMemory(size_t bytes)
+{
+    long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page <= 0) {
+        return 1;
+    }
+    return bytes / page < (size_t)pages / 2;
+}
+
+/* base is the rate of the single thread row of the mode and size, set by it */
+static int scaleRow(Model *model, const scaleParams *params, FILE *csv, int mode, unsigned int size,
+                    unsigned int threads, double *base)
+{
+    unsigned int contexts = mode == SCALE_FRAMES ? threads : 1;
+    if (!fitsMemory(rowBytes(params, size, contexts))) {
+        fprintf(stderr, "%-6s %5ux%-5u %3u threads: skipped, needs more than half of memory\n",
+                mode_names[mode], size, size, threads);
+        return 0;
+    }
+    int reset = resetPeakRss();
+    scaleWorker *workers = (scaleWorker *)calloc(contexts, sizeof(scaleWorker));
+    pthread_t *tids = (pthread_t *)calloc(contexts, sizeof(pthread_t));
+    int *started = (int *)calloc(contexts, sizeof(int));
+    int rv = workers && tids && started ? 0 : -1;
+    unsigned int i;
+    for (i = 0; i < contexts && !rv; ++i) {
+        workers[i].model = model;
+        workers[i].params = params;
+        workers[i].threads = mode == SCALE_FRAMES ? 1 : threads;
+        workers[i].ctx = renderNewContext(size, size, params->samples, params->depth);
+        workers[i].null = fopen("/dev/null", "wb");
+        if (!workers[i].ctx || !workers[i].null) {
+            rv = -1;
+        }
+    }
+
+    // one untimed frame each touches the buffers, the first also sets the frame count
+    unsigned int frames = 1;
+    for (i = 0; i < contexts && !rv; ++i) {
+        double start = statsWallTime();
+        rv = scaleFrame(&workers[i]);
+        if (i == 0) {
+            double once = statsWallTime() - start;
+            frames = once > 0 && once < SCALE_MIN_SECONDS ? (unsigned int)(SCALE_MIN_SECONDS / once) + 1 : 1;
+        }
+        memset(workers[i].stage, 0, sizeof(workers[i].stage));
+        workers[i].frames = frames;
+    }
+
+    double elapsed = 0;
+    if (!rv) {
+        double start = statsWallTime();
+        for (i = 1; i < contexts; ++i) {
+            started[i] = !pthread_create(&tids[i], NULL, runWorker, &workers[i]);
+        }
+        runWorker(&workers[0]);
+        for (i = 1; i < contexts; ++i) {
+            if (started[i]) {
+                pthread_join(tids[i], NULL);
+            } else {
+                runWorker(&workers[i]);
+            }
+        }
+        elapsed = statsWallTime() - start;
+        for (i = 0; i < contexts; ++i) {
+            if (workers[i].error) {
+                rv = -1;
+            }
+        }
+    }
+
+    if (!rv) {
+        long rss = peakRss();
+        double total = (double)contexts * frames;
+        double rate = total / elapsed;
+        if (threads == 1) {
+            *base = rate;
+        }
+        double speedup = *base > 0 ? rate / *base : 0;
+        double stage[SCALE_STAGES] = { 0 };
+        unsigned long long buffer_allocs = 0, frame_allocs = 0;
+        size_t buffer_bytes = 0;
+        int k;
+        for (i = 0; i < contexts; ++i) {
+            for (k = 0; k < SCALE_STAGES; ++k) {
+                stage[k] += workers[i].stage[k];
+            }
+            buffer_allocs += workers[i].ctx->buffers->allocs;
+            buffer_bytes += workers[i].ctx->buffers->peak;
+            frame_allocs += workers[i].ctx->frame->allocs;
+        }
+        // the image of every context is one more framebuffer allocation
+        fprintf(csv, "%s,%u,%u,%u,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%ld,%d,%llu,%llu,%zu,%.2f\n",
+                mode_names[mode], size, threads, contexts, frames, elapsed, rate, rate * size * size * 1e-6,
+                speedup, speedup / threads,
+                stage[SCALE_DRAW] * 1e3 / total, stage[SCALE_SSAO] * 1e3 / total, stage[SCALE_OUTPUT] * 1e3 / total,
+                rss, !reset, model->arena ? model->arena->allocs : 0, buffer_allocs + contexts,
+                (buffer_bytes + (size_t)contexts * size * size * RGB) >> 10,
+                (double)frame_allocs / (total + contexts));
+        fprintf(stderr, "%-6s %5ux%-5u %3u threads: %9.2f frames/s %9.2f Mpix/s %6.2fx %10ld kB peak\n",
+                mode_names[mode], size, size, threads, rate, rate * size * size * 1e-6, speedup, rss);
+    }
+
+    for (i = 0; workers && i < contexts; ++i) {
+        if (workers[i].ctx) {
+            renderFreeContext(workers[i].ctx);
+        }
+        if (workers[i].null) {
+            fclose(workers[i].null);
+        }
+    }
+    free(workers);
+    free(tids);
+    free(started);
+    return rv;
+}
+
+int scaleRun(Model *model, const scaleParams *params, FILE *csv)
+{
+    unsigned int threads = params->threads;
+    if (!threads) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? online : 1;
+    }
+    fprintf(csv, "mode,size,threads,contexts,frames_per_context,seconds,frames_per_s,mpix_per_s,speedup,efficiency,"
+                 "draw_ms,ssao_ms,output_ms,peak_rss_kb,rss_reset,model_allocs,framebuffer_allocs,framebuffer_kb,"
+                 "frame_allocs_per_frame\n");
+    unsigned int size;
+    for (size = SCALE_MIN_SIZE; size <= params->max_size; size *= 2) {
+        int mode;
+        for (mode = 0; mode < SCALE_MODES; ++mode) {
+            double base = 0;
+            unsigned int n;
+            for (n = 1; n <= threads; ++n) {
+                if (-1 == scaleRow(model, params, csv, mode, size, n, &base)) {
+                    fprintf(stderr, "%s %ux%u with %u threads failed\n", mode_names[mode], size, size, n);
+                    return -1;
+                }
+            }
+        }
+        if (EOF == fflush(csv)) {
+            return -1;
+        }
+    }
+    return 0;
+}
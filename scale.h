@@ -0,0 +1,45 @@
+#ifndef SCALE_H_
+#define SCALE_H_
+
+#include <stdio.h>
+#include "model.h"
+#include "ssao.h"
+
+#define SCALE_MIN_SIZE 512         // first square size, doubled up to the largest
+#define SCALE_MAX_SIZE 8192
+#define SCALE_MIN_SECONDS 0.5      // timed run of every row, at least one frame per thread
+#define SCALE_SSAO_RADIUS 0.05     // world units, when the command line gives none
+
+/*
+ * The frame every row times: model cleared, drawn and resolved into a
+ * square context, darkened by ssao and encoded to /dev/null in format.
+ * Only ssao and the encoder split a frame over threads, so two modes are
+ * measured for every size and thread count:
+ *
+ *   strips  one context, ssao and encoding with that many threads
+ *   frames  that many threads each drawing whole frames into a context of
+ *           their own, like the workers of renderd
+ *
+ * Memory is the peak resident set of the row, reset before it through
+ * /proc/self/clear_refs; where that isn't writable it is the peak of the
+ * process so far and only ever grows. Rows whose contexts wouldn't fit in
+ * half of physical memory are skipped.
+ */
+typedef struct scaleParams {
+    int shading;
+    int samples;
+    int depth;
+    int format;               // output format of the encode
+    ssaoParams ssao;          // radius 0 leaves ssao out, threads is set per row
+    unsigned int threads;     // largest thread count, 0 for every online cpu
+    unsigned int max_size;    // largest square size
+} scaleParams;
+
+/*
+ * One CSV row per mode, size and thread count into csv, a line of
+ * progress per row on stderr. -1 when a frame could not be drawn or
+ * written.
+ */
+int scaleRun(Model *model, const scaleParams *params, FILE *csv);
+
+#endif // SCALE_H_
@@ -0,0 +1,422 @@
+#include "scene.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+enum { MAP_DIFFUSE, MAP_NORMAL, MAP_SPECULAR };
+
+// room for one more element, doubling
+static int grow(void **array, unsigned int *cap, unsigned int n, size_t size)
+{
+    if (n < *cap) {
+        return 0;
+    }
+    unsigned int cap_new = *cap ? *cap * 2 : 8;
+    void *p = realloc(*array, (size_t)cap_new * size);
+    if (!p) {
+        return -1;
+    }
+    *array = p;
+    *cap = cap_new;
+    return 0;
+}
+
+static void resolvePath(const char *scene_path, const char *path, char *out, size_t size)
+{
+    const char *slash = strrchr(scene_path, '/');
+    if (path[0] == '/' || !slash) {
+        snprintf(out, size, "%s", path);
+    } else {
+        snprintf(out, size, "%.*s/%s", (int)(slash - scene_path), scene_path, path);
+    }
+}
+
+static sceneAsset * findAsset(sceneAsset *assets, unsigned int n, const char *path)
+{
+    unsigned int i;
+    for (i = 0; i < n; ++i) {
+        if (!strcmp(assets[i].path, path)) {
+            return &assets[i];
+        }
+    }
+    return NULL;
+}
+
+static Model * sharedModel(scene *s, const char *path)
+{
+    sceneAsset *asset = findAsset(s->models, s->nmodel, path);
+    if (asset) {
+        return (Model *)asset->data;
+    }
+    if (-1 == grow((void **)&s->models, &s->cap_model, s->nmodel, sizeof(sceneAsset))) {
+        return NULL;
+    }
+    char *copy = strdup(path);
+    Model *model = copy ? loadModel(path) : NULL;
+    if (!model) {
+        free(copy);
+        return NULL;
+    }
+    s->models[s->nmodel].path = copy;
+    s->models[s->nmodel].data = model;
+    ++s->nmodel;
+    return model;
+}
+
+static tgaImage * sharedImage(scene *s, const char *path)
+{
+    sceneAsset *asset = findAsset(s->images, s->nimage, path);
+    if (asset) {
+        return (tgaImage *)asset->data;
+    }
+    if (-1 == grow((void **)&s->images, &s->cap_image, s->nimage, sizeof(sceneAsset))) {
+        return NULL;
+    }
+    char *copy = strdup(path);
+    tgaImage *image = copy ? loadTextureMap(path) : NULL;
+    if (!image) {
+        free(copy);
+        return NULL;
+    }
+    s->images[s->nimage].path = copy;
+    s->images[s->nimage].data = image;
+    ++s->nimage;
+    return image;
+}
+
+static int findMesh(scene *s, const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < s->nmesh; ++i) {
+        if (!strcmp(s->meshes[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int parseVec3(char **save, Vec3 v)
+{
+    int c;
+    for (c = 0; c < 3; ++c) {
+        char *token = strtok_r(NULL, " \t\r\n", save);
+        char *end;
+        if (!token) {
+            return -1;
+        }
+        v[c] = strtod(token, &end);
+        if (*end) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void multiply(Mat4x4 A, Mat4x4 B)
+{
+    Mat4x4 C;
+    int i, j, k;
+    for (i = 0; i < 4; ++i) {
+        for (j = 0; j < 4; ++j) {
+            C[i][j] = 0.0;
+            for (k = 0; k < 4; ++k) {
+                C[i][j] += A[i][k]*B[k][j];
+            }
+        }
+    }
+    memcpy(A, C, sizeof(Mat4x4));
+}
+
+static void identity(Mat4x4 M)
+{
+    int i, j;
+    for (i = 0; i < 4; ++i) {
+        for (j = 0; j < 4; ++j) {
+            M[i][j] = i == j;
+        }
+    }
+}
+
+// T * Rz * Ry * Rx * S
+static void composeTransform(Vec3 translate, Vec3 rotate, double scale, Mat4x4 M)
+{
+    int axis;
+    identity(M);
+    for (axis = 0; axis < 3; ++axis) {
+        M[axis][3] = translate[axis];
+    }
+    for (axis = 2; axis >= 0; --axis) {
+        double a = rotate[axis] * M_PI / 180.0;
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        Mat4x4 R;
+        identity(R);
+        R[u][u] = cos(a);
+        R[u][v] = -sin(a);
+        R[v][u] = sin(a);
+        R[v][v] = cos(a);
+        multiply(M, R);
+    }
+    Mat4x4 S;
+    identity(S);
+    S[0][0] = S[1][1] = S[2][2] = scale;
+    multiply(M, S);
+}
+
+static int parseMesh(scene *s, const char *filename, char **save, const char **why)
+{
+    char path[SCENE_MAX_LINE];
+    char *name = strtok_r(NULL, " \t\r\n", save);
+    char *file = strtok_r(NULL, " \t\r\n", save);
+    if (!name || !file) {
+        *why = "mesh needs a name and a file";
+        return -1;
+    }
+    if (findMesh(s, name) >= 0) {
+        *why = "mesh name already used";
+        return -1;
+    }
+    if (-1 == grow((void **)&s->meshes, &s->cap_mesh, s->nmesh, sizeof(sceneMesh))) {
+        *why = "out of memory";
+        return -1;
+    }
+    sceneMesh *mesh = &s->meshes[s->nmesh];
+    memset(mesh, 0, sizeof(*mesh));
+    resolvePath(filename, file, path, sizeof(path));
+    mesh->model = sharedModel(s, path);
+    if (!mesh->model) {
+        *why = "can't load mesh file";
+        return -1;
+    }
+    char *key;
+    while ((key = strtok_r(NULL, " \t\r\n", save))) {
+        static const char *keys[3] = { "diffuse", "normal", "specular" };
+        int map;
+        for (map = 0; map < 3 && strcmp(key, keys[map]); ++map)
+            ;
+        char *value = strtok_r(NULL, " \t\r\n", save);
+        if (map == 3 || !value) {
+            *why = "expected diffuse, normal or specular and a file";
+            return -1;
+        }
+        resolvePath(filename, value, path, sizeof(path));
+        mesh->maps[map] = sharedImage(s, path);
+        if (!mesh->maps[map]) {
+            *why = "can't load map";
+            return -1;
+        }
+    }
+    // tangents belong to the geometry, every mesh sharing it reuses them
+    if (mesh->maps[MAP_NORMAL] && !mesh->model->tangents && -1 == computeTangents(mesh->model)) {
+        *why = "out of memory";
+        return -1;
+    }
+    mesh->name = strdup(name);
+    if (!mesh->name) {
+        *why = "out of memory";
+        return -1;
+    }
+    modelBounds(mesh->model, mesh->bounds);
+    ++s->nmesh;
+    return 0;
+}
+
+static int parseInstance(scene *s, char **save, const char **why)
+{
+    char *name = strtok_r(NULL, " \t\r\n", save);
+    int mesh = name ? findMesh(s, name) : -1;
+    if (mesh < 0) {
+        *why = "instance of an unknown mesh";
+        return -1;
+    }
+    Vec3 translate = { 0.0, 0.0, 0.0 };
+    Vec3 rotate = { 0.0, 0.0, 0.0 };
+    double scale = 1.0;
+    char *key;
+    while ((key = strtok_r(NULL, " \t\r\n", save))) {
+        if (!strcmp(key, "translate")) {
+            if (-1 == parseVec3(save, translate)) {
+                *why = "bad translate";
+                return -1;
+            }
+        } else if (!strcmp(key, "rotate")) {
+            if (-1 == parseVec3(save, rotate)) {
+                *why = "bad rotate";
+                return -1;
+            }
+        } else if (!strcmp(key, "scale")) {
+            char *value = strtok_r(NULL, " \t\r\n", save);
+            char *end;
+            scale = value ? strtod(value, &end) : 0.0;
+            if (!value || *end || scale <= 0.0) {
+                *why = "bad scale";
+                return -1;
+            }
+        } else {
+            *why = "expected translate, rotate or scale";
+            return -1;
+        }
+    }
+    if (-1 == grow((void **)&s->instances, &s->cap_instance, s->ninstance, sizeof(sceneInstance))) {
+        *why = "out of memory";
+        return -1;
+    }
+    s->instances[s->ninstance].mesh = mesh;
+    composeTransform(translate, rotate, scale, s->instances[s->ninstance].transform);
+    ++s->ninstance;
+    return 0;
+}
+
+static int parseStatement(scene *s, const char *filename, char *line, const char **why)
+{
+    char *save;
+    char *comment = strchr(line, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+    char *key = strtok_r(line, " \t\r\n", &save);
+    if (!key) {
+        return 0;
+    }
+    if (!strcmp(key, "mesh")) {
+        return parseMesh(s, filename, &save, why);
+    } else if (!strcmp(key, "instance")) {
+        return parseInstance(s, &save, why);
+    }
+    Vec3 v;
+    if (-1 == parseVec3(&save, v) || strtok_r(NULL, " \t\r\n", &save)) {
+        *why = "expected x y z";
+        return -1;
+    }
+    if (!strcmp(key, "eye")) {
+        memcpy(s->eye, v, sizeof(Vec3));
+        s->has_camera = 1;
+    } else if (!strcmp(key, "center")) {
+        memcpy(s->center, v, sizeof(Vec3));
+        s->has_camera = 1;
+    } else if (!strcmp(key, "up")) {
+        memcpy(s->up, v, sizeof(Vec3));
+        s->has_camera = 1;
+    } else if (!strcmp(key, "light")) {
+        memcpy(s->light, v, sizeof(Vec3));
+        s->has_light = 1;
+    } else {
+        *why = "unknown statement";
+        return -1;
+    }
+    return 0;
+}
+
+scene * sceneLoad(const char *filename)
+{
+    assert(filename);
+    FILE *fd = fopen(filename, "r");
+    if (!fd) {
+        perror(filename);
+        return NULL;
+    }
+    scene *s = (scene *)calloc(1, sizeof(scene));
+    if (!s) {
+        fclose(fd);
+        return NULL;
+    }
+    // the default camera
+    Vec3 eye = { 0.0, 0.5, 3.0 }, center = { 0.0, 0.5, 0.0 }, up = { 0.0, 1.0, 0.0 };
+    Vec3 light = { 0.0, 0.0, 1.0 };
+    memcpy(s->eye, eye, sizeof(Vec3));
+    memcpy(s->center, center, sizeof(Vec3));
+    memcpy(s->up, up, sizeof(Vec3));
+    memcpy(s->light, light, sizeof(Vec3));
+
+    char line[SCENE_MAX_LINE];
+    unsigned int lineno = 0;
+    while (fgets(line, sizeof(line), fd)) {
+        const char *why = NULL;
+        ++lineno;
+        if (-1 == parseStatement(s, filename, line, &why)) {
+            fprintf(stderr, "%s:%u: %s\n", filename, lineno, why);
+            fclose(fd);
+            sceneFree(s);
+            return NULL;
+        }
+    }
+    fclose(fd);
+    return s;
+}
+
+void sceneFree(scene *s)
+{
+    if (!s) {
+        return;
+    }
+    unsigned int i;
+    for (i = 0; i < s->nmodel; ++i) {
+        free(s->models[i].path);
+        freeModel((Model *)s->models[i].data);
+    }
+    for (i = 0; i < s->nimage; ++i) {
+        free(s->images[i].path);
+        tgaFreeImage((tgaImage *)s->images[i].data);
+    }
+    for (i = 0; i < s->nmesh; ++i) {
+        free(s->meshes[i].name);
+    }
+    free(s->models);
+    free(s->images);
+    free(s->meshes);
+    free(s->instances);
+    free(s);
+}
+
+void sceneBounds(scene *s, Vec3 lo, Vec3 hi)
+{
+    unsigned int i, corner;
+    int c;
+    for (c = 0; c < 3; ++c) {
+        lo[c] = hi[c] = 0.0;
+    }
+    for (i = 0; i < s->ninstance; ++i) {
+        sceneInstance *instance = &s->instances[i];
+        Vec3 *bounds = s->meshes[instance->mesh].bounds;
+        for (corner = 0; corner < 8; ++corner) {
+            Mat4x1 p = { bounds[corner & 1][0], bounds[(corner >> 1) & 1][1], bounds[(corner >> 2) & 1][2], 1.0 };
+            Mat4x1 w;
+            product_mat(instance->transform, p, &w);
+            for (c = 0; c < 3; ++c) {
+                if ((!i && !corner) || w[c] < lo[c]) lo[c] = w[c];
+                if ((!i && !corner) || w[c] > hi[c]) hi[c] = w[c];
+            }
+        }
+    }
+}
+
+int sceneDraw(renderContext *ctx, scene *s, int shading)
+{
+    assert(ctx);
+    assert(s);
+    unsigned int i;
+    int drawn = 0;
+    if (!s->ninstance) {
+        return 0;
+    }
+    Vec3 lo, hi;
+    sceneBounds(s, lo, hi);
+    renderFitDepth(ctx, lo, hi);
+    for (i = 0; i < s->ninstance; ++i) {
+        sceneInstance *instance = &s->instances[i];
+        sceneMesh *mesh = &s->meshes[instance->mesh];
+        // the shared geometry with this mesh's maps, nothing is copied
+        Model view = *mesh->model;
+        view.diffuse_map = mesh->maps[MAP_DIFFUSE];
+        view.normal_map = mesh->maps[MAP_NORMAL];
+        view.specular_map = mesh->maps[MAP_SPECULAR];
+        int culled = renderDrawInstance(ctx, &view, shading, instance->transform, mesh->bounds);
+        if (culled < 0) {
+            return -1;
+        }
+        drawn += !culled;
+    }
+    return drawn;
+}
@@ -0,0 +1,68 @@
+#ifndef SCENE_H_
+#define SCENE_H_
+
+#include "model.h"
+#include "raster.h"
+#include "context.h"
+
+#define SCENE_MAX_LINE 4096
+
+/*
+ * A scene file lists meshes and the instances placing them in the world,
+ * one statement per line, # starts a comment:
+ *
+ *   mesh <name> <file> [diffuse <tga>] [normal <tga>] [specular <tga>]
+ *   instance <mesh name> [translate x y z] [rotate x y z] [scale s]
+ *   eye x y z | center x y z | up x y z
+ *   light x y z
+ *
+ * Relative paths are taken from the directory of the scene file. Every
+ * geometry or texture file is loaded once however many meshes name it,
+ * and every instance draws the shared data with its own transform.
+ * Rotations are in degrees, applied around x, then y, then z.
+ */
+typedef struct sceneAsset {
+    char *path;
+    void *data;               // Model * or tgaImage *
+} sceneAsset;
+
+typedef struct sceneMesh {
+    char *name;
+    Model *model;             // shared, maps are left unset on it
+    tgaImage *maps[3];        // diffuse, normal, specular, shared as well
+    Vec3 bounds[2];           // model space box, lo and hi
+} sceneMesh;
+
+typedef struct sceneInstance {
+    unsigned int mesh;
+    Mat4x4 transform;         // model to world
+} sceneInstance;
+
+typedef struct scene {
+    sceneAsset *models;
+    sceneAsset *images;
+    sceneMesh *meshes;
+    sceneInstance *instances;
+    unsigned int nmodel, nimage, nmesh, ninstance;
+    unsigned int cap_model, cap_image, cap_mesh, cap_instance;
+    Vec3 eye, center, up;
+    Vec3 light;
+    int has_camera;           // any of eye, center or up was given
+    int has_light;
+} scene;
+
+// NULL with the reason printed as file:line on stderr
+scene * sceneLoad(const char *filename);
+void sceneFree(scene *s);
+
+// world space box of every instance
+void sceneBounds(scene *s, Vec3 lo, Vec3 hi);
+
+/*
+ * Fits the depth range to the whole scene, then draws every instance not
+ * entirely off screen with the context camera and light. Returns the
+ * number of instances drawn, -1 when out of memory.
+ */
+int sceneDraw(renderContext *ctx, scene *s, int shading);
+
+#endif // SCENE_H_
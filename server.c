@@ -0,0 +1,700 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tga.h"
+#include "model.h"
+#include "context.h"
+#include "cache.h"
+#include "output.h"
+#include "stats.h"
+
+/*
+ * Render daemon: listens on a unix domain socket and renders jobs on a
+ * pool of threads, keeping parsed models and textures in an LRU cache
+ * keyed by path and mtime, so hot assets only cost rasterization.
+ *
+ * A job is a block of "key value" lines ended by an empty line:
+ *
+ *     model /abs/cat.obj         required, obj or mesh
+ *     diffuse /abs/cat_diff.tga
+ *     normal /abs/cat_norm.tga   implies phong
+ *     specular /abs/cat_spec.tga implies phong
+ *     shading flat               depth|flat|gouraud|phong
+ *     size 1000 1000             width height
+ *     msaa 4
+ *     depth 24                   see depthParseFormat
+ *     lod 1                      draw a simplified level fitting size and camera
+ *     eye 0 0.5 3
+ *     center 0 0.5 0
+ *     up 0 1 0
+ *     output /abs/out.tga        required, .png .ppm .pam .raw pick the format
+ *
+ * and is answered with a single line, "ok <milliseconds>" or "error <why>".
+ * A connection may send any number of jobs, answered in order. Paths are
+ * opened by the server, so clients should send absolute ones.
+ *
+ * The main thread polls every connection between jobs and reads until a
+ * whole job has arrived; only then is the connection handed to a worker,
+ * for that one job, and polled again once it is answered. Idle clients
+ * hold no worker.
+ */
+
+#define MAX_DIM 16384
+#define LINE_MAX_LEN 4096
+#define JOB_MAX_LEN (16 * LINE_MAX_LEN) // bytes of one job, with its lines
+#define MAX_CONNECTIONS 1024
+
+typedef struct renderJob {
+    char model[LINE_MAX_LEN];
+    char diffuse[LINE_MAX_LEN];
+    char normal[LINE_MAX_LEN];
+    char specular[LINE_MAX_LEN];
+    char output[LINE_MAX_LEN];
+    int shading;
+    unsigned int width;
+    unsigned int height;
+    int samples;
+    int depth;
+    int lod;
+    Vec3 eye;
+    Vec3 center;
+    Vec3 up;
+} renderJob;
+
+typedef struct connection {
+    int fd;
+    char *buf;                // read but not yet answered, one spare byte for a '\0'
+    size_t len;
+    size_t cap;
+    size_t job;               // length of the job at the front of buf while a worker has it
+    int eof;
+    int broken;               // an answer couldn't be written
+    int busy;                 // with a worker, not polled
+    struct connection *next;  // in the done list
+} connection;
+
+/* jobs waiting for a worker, at most one per connection */
+typedef struct jobQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    connection **jobs;
+    unsigned int cap;
+    unsigned int head;
+    unsigned int count;
+    int closing;
+    connection *done;         // answered, to be polled again
+} jobQueue;
+
+static assetCache *cache;
+static jobQueue queue;
+static int wake[2] = { -1, -1 }; // breaks the poll of the main thread
+static volatile sig_atomic_t stop = 0;
+
+static void wakeUp(void)
+{
+    int saved = errno;
+    // non-blocking, a full pipe is already awake
+    ssize_t n = write(wake[1], "", 1);
+    (void)n;
+    errno = saved;
+}
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    stop = 1;
+    wakeUp();
+}
+
+static void defaultJob(renderJob *job)
+{
+    memset(job, 0, sizeof(renderJob));
+    job->shading = SHADING_FLAT;
+    job->width = 1000;
+    job->height = 1000;
+    job->samples = 1;
+    job->depth = DEPTH_DEFAULT;
+    job->eye[1] = 0.5;
+    job->eye[2] = 3.0;
+    job->center[1] = 0.5;
+    job->up[1] = 1.0;
+}
+
+static int parseVec3(const char *value, Vec3 v)
+{
+    return 3 == sscanf(value, "%lf %lf %lf", &v[0], &v[1], &v[2]) ? 0 : -1;
+}
+
+static int parseShading(const char *value)
+{
+    static const char *names[SHADING_MODES] = { "depth", "flat", "gouraud", "phong" };
+    int i;
+    for (i = 0; i < SHADING_MODES; ++i) {
+        if (!strcmp(value, names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* one "key value" line into job, error text in why */
+static int parseLine(renderJob *job, char *line, const char **why)
+{
+    char *value = strchr(line, ' ');
+    if (!value) {
+        *why = "expected key value";
+        return -1;
+    }
+    *value++ = '\0';
+    if (!strcmp(line, "model")) {
+        snprintf(job->model, sizeof(job->model), "%s", value);
+    } else if (!strcmp(line, "diffuse")) {
+        snprintf(job->diffuse, sizeof(job->diffuse), "%s", value);
+    } else if (!strcmp(line, "normal")) {
+        snprintf(job->normal, sizeof(job->normal), "%s", value);
+        job->shading = SHADING_PHONG;
+    } else if (!strcmp(line, "specular")) {
+        snprintf(job->specular, sizeof(job->specular), "%s", value);
+        job->shading = SHADING_PHONG;
+    } else if (!strcmp(line, "output")) {
+        snprintf(job->output, sizeof(job->output), "%s", value);
+    } else if (!strcmp(line, "shading")) {
+        if (-1 == (job->shading = parseShading(value))) {
+            *why = "unknown shading";
+            return -1;
+        }
+    } else if (!strcmp(line, "size")) {
+        if (2 != sscanf(value, "%u %u", &job->width, &job->height) ||
+            !job->width || !job->height || job->width > MAX_DIM || job->height > MAX_DIM) {
+            *why = "bad size";
+            return -1;
+        }
+    } else if (!strcmp(line, "msaa")) {
+        job->samples = atoi(value);
+        if (!validSampleCount(job->samples)) {
+            *why = "bad msaa";
+            return -1;
+        }
+    } else if (!strcmp(line, "depth")) {
+        if (-1 == (job->depth = depthParseFormat(value))) {
+            *why = "unknown depth format";
+            return -1;
+        }
+    } else if (!strcmp(line, "lod")) {
+        job->lod = atoi(value) != 0;
+    } else if (!strcmp(line, "eye")) {
+        if (-1 == parseVec3(value, job->eye)) {
+            *why = "bad eye";
+            return -1;
+        }
+    } else if (!strcmp(line, "center")) {
+        if (-1 == parseVec3(value, job->center)) {
+            *why = "bad center";
+            return -1;
+        }
+    } else if (!strcmp(line, "up")) {
+        if (-1 == parseVec3(value, job->up)) {
+            *why = "bad up";
+            return -1;
+        }
+    } else {
+        *why = "unknown key";
+        return -1;
+    }
+    return 0;
+}
+
+/* a whole job, read out of text, which is modified; -1 when it is malformed */
+static int parseJob(char *text, size_t len, renderJob *job, const char **why)
+{
+    char *end = text + len;
+    defaultJob(job);
+    while (text < end) {
+        char *line = text;
+        char *nl = (char *)memchr(text, '\n', end - text);
+        size_t n = nl ? (size_t)(nl - text) : (size_t)(end - text);
+        text = nl ? nl + 1 : end;
+        while (n && line[n - 1] == '\r') {
+            --n;
+        }
+        line[n] = '\0';
+        if (!n) {
+            continue;
+        }
+        if (n >= LINE_MAX_LEN) {
+            *why = "line too long";
+            return -1;
+        }
+        if (-1 == parseLine(job, line, why)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* the renderContext of a worker, rebuilt when the job needs other buffers */
+static renderContext * contextFor(renderContext *ctx, const renderJob *job)
+{
+    if (ctx && (ctx->samples != job->samples || ctx->depth->format != job->depth)) {
+        renderFreeContext(ctx);
+        ctx = NULL;
+    }
+    if (!ctx) {
+        return renderNewContext(job->width, job->height, job->samples, job->depth);
+    }
+    if (-1 == renderResize(ctx, job->width, job->height)) {
+        renderFreeContext(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static int runJob(renderContext **ctx, const renderJob *job, const char **why)
+{
+    cacheEntry *model_entry = NULL;
+    cacheEntry *maps[3] = { NULL, NULL, NULL };
+    const char *paths[3] = { job->diffuse, job->normal, job->specular };
+    int rv = -1;
+    int i;
+
+    if (!job->model[0] || !job->output[0]) {
+        *why = "model and output are required";
+        return -1;
+    }
+    model_entry = cacheGet(cache, job->lod ? CACHE_LOD : CACHE_MODEL, job->model);
+    if (!model_entry) {
+        *why = "can't load model";
+        return -1;
+    }
+    for (i = 0; i < 3; ++i) {
+        if (paths[i][0] && !(maps[i] = cacheGet(cache, CACHE_TEXTURE, paths[i]))) {
+            *why = "can't load texture";
+            goto out;
+        }
+    }
+
+    *ctx = contextFor(*ctx, job);
+    if (!*ctx) {
+        *why = "out of memory";
+        goto out;
+    }
+    renderSetCamera(*ctx, (double *)job->eye, (double *)job->center, (double *)job->up);
+
+    // the cached model is shared, the maps of this job go on a shallow copy
+    Model *base = (Model *)model_entry->data;
+    if (job->lod) {
+        base = lodSelect((modelLod *)model_entry->data, (*ctx)->camera, job->width, job->height);
+    }
+    Model model = *base;
+    model.diffuse_map = maps[0] ? (tgaImage *)maps[0]->data : NULL;
+    model.normal_map = maps[1] ? (tgaImage *)maps[1]->data : NULL;
+    model.specular_map = maps[2] ? (tgaImage *)maps[2]->data : NULL;
+    renderClear(*ctx, tgaRGB(0, 0, 0));
+    if (-1 == renderDrawModel(*ctx, &model, job->shading)) {
+        *why = "out of memory";
+        goto out;
+    }
+    tgaImage *image = renderResolve(*ctx);
+    // jobs already run one per thread, so encode on this one
+    if (-1 == outputSave(image, job->output, outputFormatFromPath(job->output), 1, OUTPUT_BOTTOM_UP)) {
+        *why = "can't write output";
+        goto out;
+    }
+    rv = 0;
+out:
+    for (i = 0; i < 3; ++i) {
+        cacheRelease(cache, maps[i]);
+    }
+    cacheRelease(cache, model_entry);
+    return rv;
+}
+
+static int writeAll(int fd, const char *data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void serveJob(connection *c, renderContext **ctx)
+{
+    renderJob job;
+    const char *why = NULL;
+    char answer[64];
+    double start = statsWallTime();
+    if (-1 == parseJob(c->buf, c->job, &job, &why) || -1 == runJob(ctx, &job, &why)) {
+        snprintf(answer, sizeof(answer), "error %s\n", why);
+    } else {
+        snprintf(answer, sizeof(answer), "ok %.3f\n", (statsWallTime() - start) * 1e3);
+    }
+    if (-1 == writeAll(c->fd, answer, strlen(answer))) {
+        c->broken = 1;
+    }
+}
+
+static void * worker(void *arg)
+{
+    renderContext *ctx = NULL;
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&queue.lock);
+        while (!queue.count && !queue.closing) {
+            pthread_cond_wait(&queue.ready, &queue.lock);
+        }
+        // jobs still queued are dropped, their clients are being shut down
+        if (queue.closing) {
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
+        connection *c = queue.jobs[queue.head];
+        queue.head = (queue.head + 1) % queue.cap;
+        --queue.count;
+        pthread_mutex_unlock(&queue.lock);
+
+        serveJob(c, &ctx);
+
+        pthread_mutex_lock(&queue.lock);
+        c->next = queue.done;
+        queue.done = c;
+        pthread_mutex_unlock(&queue.lock);
+        wakeUp();
+    }
+    renderFreeContext(ctx);
+    return NULL;
+}
+
+static void enqueue(connection *c)
+{
+    pthread_mutex_lock(&queue.lock);
+    assert(queue.count < queue.cap);
+    queue.jobs[(queue.head + queue.count) % queue.cap] = c;
+    ++queue.count;
+    pthread_cond_signal(&queue.ready);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+/* connections of the main thread, busy ones included */
+static connection *conns[MAX_CONNECTIONS];
+static unsigned int nconns = 0;
+
+static void closeConnection(connection *c)
+{
+    unsigned int i;
+    for (i = 0; i < nconns; ++i) {
+        if (conns[i] == c) {
+            conns[i] = conns[--nconns];
+            break;
+        }
+    }
+    close(c->fd);
+    free(c->buf);
+    free(c);
+}
+
+/* best effort, the client may not be reading */
+static void refuse(int fd, const char *answer)
+{
+    if (send(fd, answer, strlen(answer), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN) {
+        perror("send");
+    }
+}
+
+static void acceptConnection(int sock)
+{
+    int fd = accept(sock, NULL, NULL);
+    if (-1 == fd) {
+        if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("accept");
+        }
+        return;
+    }
+    connection *c = nconns < MAX_CONNECTIONS ? (connection *)calloc(1, sizeof(connection)) : NULL;
+    if (c) {
+        c->cap = LINE_MAX_LEN;
+        c->buf = (char *)malloc(c->cap);
+    }
+    if (!c || !c->buf) {
+        refuse(fd, "error busy\n");
+        close(fd);
+        if (c) {
+            free(c);
+        }
+        return;
+    }
+    c->fd = fd;
+    conns[nconns++] = c;
+}
+
+/* what the client sent since the last poll; -1 when the connection failed */
+static int readConnection(connection *c)
+{
+    if (c->len + 1 == c->cap) {
+        size_t cap = 2 * c->cap < JOB_MAX_LEN ? 2 * c->cap : JOB_MAX_LEN;
+        char *buf = (char *)realloc(c->buf, cap);
+        if (!buf) {
+            return -1;
+        }
+        c->buf = buf;
+        c->cap = cap;
+    }
+    ssize_t n = read(c->fd, c->buf + c->len, c->cap - 1 - c->len);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (!n) {
+        c->eof = 1;
+    }
+    c->len += n;
+    return 0;
+}
+
+/* length of the job at the front of buf, 0 until all of it has been read */
+static size_t jobLength(const connection *c)
+{
+    size_t start = 0;
+    size_t i;
+    for (i = 0; i < c->len; ++i) {
+        if (c->buf[i] == '\n') {
+            size_t end = i;
+            while (end > start && c->buf[end - 1] == '\r') {
+                --end;
+            }
+            if (end == start) {
+                return i + 1;
+            }
+            start = i + 1;
+        }
+    }
+    return c->eof ? c->len : 0;
+}
+
+/*
+ * Gives the next job of c to the workers when it has been read whole.
+ * -1 when c is done with, at the end of its stream or on an error.
+ */
+static int schedule(connection *c)
+{
+    if (c->broken) {
+        return -1;
+    }
+    // blank lines between jobs
+    size_t skip = 0;
+    while (skip < c->len && (c->buf[skip] == '\n' || c->buf[skip] == '\r')) {
+        ++skip;
+    }
+    c->len -= skip;
+    memmove(c->buf, c->buf + skip, c->len);
+    if ((c->job = jobLength(c))) {
+        c->busy = 1;
+        enqueue(c);
+        return 0;
+    }
+    if (c->len + 1 == JOB_MAX_LEN) {
+        refuse(c->fd, "error job too long\n");
+        return -1;
+    }
+    return c->eof ? -1 : 0;
+}
+
+/* connections the workers are done with, back to polling */
+static void takeDone(void)
+{
+    char drain[64];
+    while (read(wake[0], drain, sizeof(drain)) > 0) {
+    }
+    pthread_mutex_lock(&queue.lock);
+    connection *c = queue.done;
+    queue.done = NULL;
+    pthread_mutex_unlock(&queue.lock);
+    while (c) {
+        connection *next = c->next;
+        c->busy = 0;
+        c->len -= c->job;
+        memmove(c->buf, c->buf + c->job, c->len);
+        c->job = 0;
+        if (-1 == schedule(c)) {
+            closeConnection(c);
+        }
+        c = next;
+    }
+}
+
+static void serve(int sock)
+{
+    static struct pollfd fds[MAX_CONNECTIONS + 2];
+    static connection *polled[MAX_CONNECTIONS + 2];
+    while (!stop) {
+        unsigned int n = 2;
+        unsigned int i;
+        fds[0].fd = wake[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = sock;
+        fds[1].events = POLLIN;
+        for (i = 0; i < nconns; ++i) {
+            if (!conns[i]->busy) {
+                fds[n].fd = conns[i]->fd;
+                fds[n].events = POLLIN;
+                polled[n++] = conns[i];
+            }
+        }
+        if (-1 == poll(fds, n, -1)) {
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            continue;
+        }
+        // polled connections stay valid: only these are closed below, each once
+        for (i = 2; i < n; ++i) {
+            if (fds[i].revents && (-1 == readConnection(polled[i]) || -1 == schedule(polled[i]))) {
+                closeConnection(polled[i]);
+            }
+        }
+        if (fds[0].revents) {
+            takeDone();
+        }
+        if (fds[1].revents) {
+            acceptConnection(sock);
+        }
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-s socket] [-t threads] [-c cache_mb] [-O]\n"
+                    "  -O  reorder cached models for vertex locality\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_path = "/tmp/renderd.sock";
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long cache_mb = 512;
+    int optimize = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:c:O")) != -1) {
+        switch (opt) {
+        case 's': socket_path = optarg; break;
+        case 't': threads = atoi(optarg); break;
+        case 'c': cache_mb = atol(optarg); break;
+        case 'O': optimize = 1; break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (threads < 1 || cache_mb < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == sock) {
+        perror("socket");
+        return -1;
+    }
+    unlink(socket_path);
+    if (-1 == bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || -1 == listen(sock, 64)) {
+        perror(socket_path);
+        close(sock);
+        return -1;
+    }
+
+    if (-1 == pipe(wake) || -1 == fcntl(wake[0], F_SETFL, O_NONBLOCK) ||
+        -1 == fcntl(wake[1], F_SETFL, O_NONBLOCK) || -1 == fcntl(sock, F_SETFL, O_NONBLOCK)) {
+        perror("pipe");
+        return -1;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    cache = cacheNew((size_t)cache_mb << 20);
+    if (!cache) {
+        perror("cacheNew");
+        return -1;
+    }
+    cache->optimize = optimize;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.ready, NULL);
+    queue.cap = MAX_CONNECTIONS;
+    queue.jobs = (connection **)malloc(queue.cap * sizeof(connection *));
+    pthread_t *pool = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    if (!queue.jobs || !pool) {
+        perror("malloc");
+        return -1;
+    }
+    // signals go to the main thread, where they break the poll
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    int started;
+    for (started = 0; started < threads; ++started) {
+        if (pthread_create(&pool[started], NULL, worker, NULL)) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!started) {
+        fprintf(stderr, "Can't start a worker thread\n");
+        return -1;
+    }
+    fprintf(stderr, "Listening on %s with %d threads\n", socket_path, started);
+
+    serve(sock);
+
+    // a worker blocked writing to its client returns
+    int i;
+    for (i = 0; i < (int)nconns; ++i) {
+        shutdown(conns[i]->fd, SHUT_RDWR);
+    }
+    pthread_mutex_lock(&queue.lock);
+    queue.closing = 1;
+    pthread_cond_broadcast(&queue.ready);
+    pthread_mutex_unlock(&queue.lock);
+    for (i = 0; i < started; ++i) {
+        pthread_join(pool[i], NULL);
+    }
+    while (nconns) {
+        closeConnection(conns[0]);
+    }
+    close(sock);
+    unlink(socket_path);
+    fprintf(stderr, "%llu cache hits, %llu misses\n", cache->hits, cache->misses);
+    cacheFree(cache);
+    free(pool);
+    free(queue.jobs);
+    close(wake[0]);
+    close(wake[1]);
+    return 0;
+}
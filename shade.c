@@ -0,0 +1,422 @@
+#include "shade.h"
+#include "raster.h"
+#include "stats.h"
+
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+/*
+ * Per pixel shading loops. shadeTemplate is expanded once per mode and
+ * feature set with constant arguments, so every variant is a straight
+ * loop without tests for maps it does not use. Texels are read directly
+ * from the map data: fragments and uvs are already in range, which makes
+ * the asserts and fallbacks of getDiffuseColor/tgaSetPixel unnecessary.
+ */
+
+#define AMBIENT 5.0
+#define SPECULAR_WEIGHT 0.6
+
+static void normalize3(Vec3 v)
+{
+    double l = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    if (l > 0) {
+        v[0] /= l;
+        v[1] /= l;
+        v[2] /= l;
+    }
+}
+
+static inline tgaColor texel(const tgaImage *map, const Vec3 uv)
+{
+    unsigned int x = map->width * uv[0];
+    unsigned int y = map->height * uv[1];
+    if (x >= map->width) x = map->width - 1;
+    if (y >= map->height) y = map->height - 1;
+    tgaColor c = 0;
+    memcpy(&c, map->data + (x + y * map->width) * map->bpp, map->bpp);
+    return c;
+}
+
+static inline void putPixel(const shadeTarget *target, const Fragment *f, tgaColor c, const int msaa)
+{
+    if (msaa) {
+        tgaColor *samples = target->sample_colors + (f->x + f->y * target->image->width) * target->samples;
+        int s;
+        for (s = 0; s < target->samples; ++s) {
+            if (f->mask & (1u << s)) {
+                samples[s] = c;
+            }
+        }
+    } else {
+        tgaImage *image = target->image;
+        memcpy(image->data + (f->x + f->y * image->width) * image->bpp, &c, image->bpp);
+    }
+}
+
+static inline unsigned char clamp255(double c)
+{
+    return c > 255 ? 255 : c;
+}
+
+/* share of the light reaching the fragment, 1 fully lit */
+static inline double shadowed(const shadeShadowMap *map, const shadeFace *face, double w0, double u, double v)
+{
+    double x = w0 * face->shadow[0][0] + u * face->shadow[1][0] + v * face->shadow[2][0];
+    double y = w0 * face->shadow[0][1] + u * face->shadow[1][1] + v * face->shadow[2][1];
+    float z = (float)(w0 * face->shadow[0][2] + u * face->shadow[1][2] + v * face->shadow[2][2] + map->bias);
+    int cx = (int)floor(x), cy = (int)floor(y);
+    const int r = map->pcf, w = map->width, h = map->height;
+    int lit = 0;
+    int dx, dy;
+    if (cx - r >= 0 && cy - r >= 0 && cx + r < w && cy + r < h) {
+        // the whole kernel is on the map, the common case
+        const float *row = map->depth + (size_t)(cy - r) * w + cx - r;
+        for (dy = -r; dy <= r; ++dy, row += w) {
+            for (dx = 0; dx <= 2 * r; ++dx) {
+                lit += z >= row[dx];
+            }
+        }
+    } else {
+        for (dy = -r; dy <= r; ++dy) {
+            int ty = cy + dy;
+            for (dx = -r; dx <= r; ++dx) {
+                int tx = cx + dx;
+                // nothing was drawn outside the map, so nothing there casts a shadow
+                lit += tx < 0 || ty < 0 || tx >= w || ty >= h || z >= map->depth[(size_t)ty * w + tx];
+            }
+        }
+    }
+    return (double)lit / ((2 * r + 1) * (2 * r + 1));
+}
+
+static inline __attribute__((always_inline))
+void shadeTemplate(const shadeTarget *target, Model *model, const shadeFace *face,
+                   const Fragment *fragments, size_t nfrag,
+                   const int mode, const int features, const int msaa)
+{
+    const int textured = features & SHADE_TEXTURE;
+    const int normal_map = features & SHADE_NORMAL_MAP;
+    const int specular = features & SHADE_SPECULAR;
+    const int shadow = features & SHADE_SHADOW;
+    size_t i;
+    int k;
+    for (i = 0; i < nfrag; ++i) {
+        const Fragment *f = &fragments[i];
+        double w0 = 1 - f->u - f->v;
+        Vec3 uv = {0.0, 0.0, 0.0};
+        if (textured || normal_map || specular) {
+            uv[0] = w0 * face->uv[0][0] + f->u * face->uv[1][0] + f->v * face->uv[2][0];
+            uv[1] = w0 * face->uv[0][1] + f->u * face->uv[1][1] + f->v * face->uv[2][1];
+        }
+        tgaColor col = textured ? texel(model->diffuse_map, uv) : tgaRGB(255, 255, 255);
+        double light = 1.0;
+        if (shadow) {
+            light = shadowed(target->shadow, face, w0, f->u, f->v);
+        }
+
+        if (mode == SHADING_FLAT) {
+            double I = face->intensity[0];
+            if (shadow && light < 1.0) {
+                I *= SHADOW_KEEP + (1 - SHADOW_KEEP) * light;
+            }
+            putPixel(target, f, tgaRGB(I*Red(col), I*Green(col), I*Blue(col)), msaa);
+        } else if (mode == SHADING_GOURAUD) {
+            double I = w0 * face->intensity[0] + f->u * face->intensity[1] + f->v * face->intensity[2];
+            if (shadow && light < 1.0) {
+                I *= SHADOW_KEEP + (1 - SHADOW_KEEP) * light;
+            }
+            putPixel(target, f, tgaRGB(I*Red(col), I*Green(col), I*Blue(col)), msaa);
+        } else if (mode == SHADING_PHONG) {
+            Vec3 n;
+            for (k = 0; k < 3; ++k) {
+                n[k] = w0 * face->norm[0][k] + f->u * face->norm[1][k] + f->v * face->norm[2][k];
+            }
+            normalize3(n);
+
+            if (normal_map) {
+                // Gram-Schmidt the face frame against the interpolated normal
+                Vec3 t, b, nm;
+                double d = n[0]*face->tangent[0] + n[1]*face->tangent[1] + n[2]*face->tangent[2];
+                for (k = 0; k < 3; ++k) {
+                    t[k] = face->tangent[k] - d * n[k];
+                }
+                normalize3(t);
+                double dn = n[0]*face->bitangent[0] + n[1]*face->bitangent[1] + n[2]*face->bitangent[2];
+                double dt = t[0]*face->bitangent[0] + t[1]*face->bitangent[1] + t[2]*face->bitangent[2];
+                for (k = 0; k < 3; ++k) {
+                    b[k] = face->bitangent[k] - dn * n[k] - dt * t[k];
+                }
+                normalize3(b);
+                tgaColor c = texel(model->normal_map, uv);
+                // tangent space: x in red, y in green, z in blue
+                nm[0] = Red(c) / 255.0 * 2.0 - 1.0;
+                nm[1] = Green(c) / 255.0 * 2.0 - 1.0;
+                nm[2] = Blue(c) / 255.0 * 2.0 - 1.0;
+                for (k = 0; k < 3; ++k) {
+                    n[k] = t[k] * nm[0] + b[k] * nm[1] + n[k] * nm[2];
+                }
+                normalize3(n);
+            }
+
+            const double *l = face->light;
+            double ndl = n[0]*l[0] + n[1]*l[1] + n[2]*l[2];
+            double diff = ndl > 0 ? ndl : 0.0;
+            double spec = 0.0;
+            if (specular) {
+                // reflected light against the direction to the viewer
+                const double *e = face->view;
+                double rv = 0.0;
+                for (k = 0; k < 3; ++k) {
+                    rv += (2 * ndl * n[k] - l[k]) * e[k];
+                }
+                if (rv > 0) {
+                    double power = Blue(texel(model->specular_map, uv));
+                    spec = pow(rv, power < 1.0 ? 1.0 : power);
+                }
+            }
+            if (shadow && light < 1.0) {
+                // no highlight off a surface the light doesn't reach
+                diff *= SHADOW_KEEP + (1 - SHADOW_KEEP) * light;
+                spec *= light;
+            }
+            double intensity = diff + SPECULAR_WEIGHT * spec;
+            putPixel(target, f, tgaRGB(clamp255(AMBIENT + Red(col) * intensity),
+                                       clamp255(AMBIENT + Green(col) * intensity),
+                                       clamp255(AMBIENT + Blue(col) * intensity)), msaa);
+        }
+    }
+    STATS_ADD(CNT_FRAG_SHADED, nfrag);
+    STATS_ADD(CNT_TEXEL_FETCHED, nfrag * (!!textured + !!normal_map + !!specular));
+}
+
+#define SHADER(name, mode, features) \
+    static void name(const shadeTarget *target, Model *model, const shadeFace *face, \
+                     const Fragment *fragments, size_t nfrag) \
+    { \
+        shadeTemplate(target, model, face, fragments, nfrag, mode, features, 0); \
+    } \
+    static void name##Msaa(const shadeTarget *target, Model *model, const shadeFace *face, \
+                           const Fragment *fragments, size_t nfrag) \
+    { \
+        shadeTemplate(target, model, face, fragments, nfrag, mode, features, 1); \
+    }
+
+// every variant once without and once with the shadow lookup
+#define SHADERS(name, mode, features) \
+    SHADER(name, mode, features) \
+    SHADER(name##Shadow, mode, (features) | SHADE_SHADOW)
+
+SHADERS(shadeFlat, SHADING_FLAT, 0)
+SHADERS(shadeFlatTex, SHADING_FLAT, SHADE_TEXTURE)
+SHADERS(shadeGouraud, SHADING_GOURAUD, 0)
+SHADERS(shadeGouraudTex, SHADING_GOURAUD, SHADE_TEXTURE)
+SHADERS(shadePhong, SHADING_PHONG, 0)
+SHADERS(shadePhongTex, SHADING_PHONG, SHADE_TEXTURE)
+SHADERS(shadePhongNm, SHADING_PHONG, SHADE_NORMAL_MAP)
+SHADERS(shadePhongTexNm, SHADING_PHONG, SHADE_TEXTURE | SHADE_NORMAL_MAP)
+SHADERS(shadePhongSpec, SHADING_PHONG, SHADE_SPECULAR)
+SHADERS(shadePhongTexSpec, SHADING_PHONG, SHADE_TEXTURE | SHADE_SPECULAR)
+SHADERS(shadePhongNmSpec, SHADING_PHONG, SHADE_NORMAL_MAP | SHADE_SPECULAR)
+SHADERS(shadePhongTexNmSpec, SHADING_PHONG, SHADE_TEXTURE | SHADE_NORMAL_MAP | SHADE_SPECULAR)
+
+// mode and features known only at run time, the baseline of the variants
+static void shadeGeneric(const shadeTarget *target, Model *model, const shadeFace *face,
+                         const Fragment *fragments, size_t nfrag)
+{
+    shadeTemplate(target, model, face, fragments, nfrag, face->mode, face->features, 0);
+}
+
+static void shadeGenericMsaa(const shadeTarget *target, Model *model, const shadeFace *face,
+                             const Fragment *fragments, size_t nfrag)
+{
+    shadeTemplate(target, model, face, fragments, nfrag, face->mode, face->features, 1);
+}
+
+#define ENTRIES(name, mode, features, fn) \
+    { name,             mode, features, fn, fn##Msaa }, \
+    { name "+shadow",   mode, (features) | SHADE_SHADOW, fn##Shadow, fn##ShadowMsaa }
+
+static const shader shaders[] = {
+    { "depth",                SHADING_DEPTH,   0, NULL, NULL },
+    ENTRIES("flat",              SHADING_FLAT,    0, shadeFlat),
+    ENTRIES("flat+tex",          SHADING_FLAT,    SHADE_TEXTURE, shadeFlatTex),
+    ENTRIES("gouraud",           SHADING_GOURAUD, 0, shadeGouraud),
+    ENTRIES("gouraud+tex",       SHADING_GOURAUD, SHADE_TEXTURE, shadeGouraudTex),
+    ENTRIES("phong",             SHADING_PHONG,   0, shadePhong),
+    ENTRIES("phong+tex",         SHADING_PHONG,   SHADE_TEXTURE, shadePhongTex),
+    ENTRIES("phong+nm",          SHADING_PHONG,   SHADE_NORMAL_MAP, shadePhongNm),
+    ENTRIES("phong+tex+nm",      SHADING_PHONG,   SHADE_TEXTURE | SHADE_NORMAL_MAP, shadePhongTexNm),
+    ENTRIES("phong+spec",        SHADING_PHONG,   SHADE_SPECULAR, shadePhongSpec),
+    ENTRIES("phong+tex+spec",    SHADING_PHONG,   SHADE_TEXTURE | SHADE_SPECULAR, shadePhongTexSpec),
+    ENTRIES("phong+nm+spec",     SHADING_PHONG,   SHADE_NORMAL_MAP | SHADE_SPECULAR, shadePhongNmSpec),
+    ENTRIES("phong+tex+nm+spec", SHADING_PHONG,   SHADE_TEXTURE | SHADE_NORMAL_MAP | SHADE_SPECULAR,
+            shadePhongTexNmSpec),
+};
+
+int shaderFeatures(Model *model, int mode)
+{
+    assert(model);
+    int features = 0;
+    if (model->diffuse_map && mode != SHADING_DEPTH) {
+        features |= SHADE_TEXTURE;
+    }
+    if (mode == SHADING_PHONG) {
+        if (model->normal_map && model->tangents) {
+            features |= SHADE_NORMAL_MAP;
+        }
+        if (model->specular_map) {
+            features |= SHADE_SPECULAR;
+        }
+    }
+    return features;
+}
+
+const shader * shaderSelect(int mode, int features, const shadeTarget *target)
+{
+    assert(mode >= 0 && mode < SHADING_MODES);
+    if (mode == SHADING_DEPTH) {
+        features = 0;
+    } else if (mode != SHADING_PHONG) {
+        features &= SHADE_TEXTURE;
+    }
+    features &= ~SHADE_SHADOW;
+    if (mode != SHADING_DEPTH && target && target->shadow) {
+        features |= SHADE_SHADOW;
+    }
+    unsigned int i;
+    for (i = 0; i < sizeof(shaders) / sizeof(shaders[0]); ++i) {
+        if (shaders[i].mode == mode && shaders[i].features == features) {
+            return &shaders[i];
+        }
+    }
+    return NULL;
+}
+
+shader shaderGeneric(const shader *sh)
+{
+    assert(sh);
+    shader generic = *sh;
+    if (sh->shade) {
+        generic.name = "generic";
+        generic.shade = shadeGeneric;
+        generic.shade_msaa = shadeGenericMsaa;
+    }
+    return generic;
+}
+
+// unnormalized, twice the area long
+static void faceCross(Model *model, unsigned int nface, Vec3 n)
+{
+    Vec3 *v0 = getVertex(model, nface, 0);
+    Vec3 *v1 = getVertex(model, nface, 1);
+    Vec3 *v2 = getVertex(model, nface, 2);
+    n[0] = ((*v1)[1] - (*v0)[1]) * ((*v2)[2] - (*v0)[2]) - ((*v1)[2] - (*v0)[2]) * ((*v2)[1] - (*v0)[1]);
+    n[1] = ((*v1)[2] - (*v0)[2]) * ((*v2)[0] - (*v0)[0]) - ((*v1)[0] - (*v0)[0]) * ((*v2)[2] - (*v0)[2]);
+    n[2] = ((*v1)[0] - (*v0)[0]) * ((*v2)[1] - (*v0)[1]) - ((*v1)[1] - (*v0)[1]) * ((*v2)[0] - (*v0)[0]);
+}
+
+static void faceNormal(Model *model, unsigned int nface, Vec3 n)
+{
+    faceCross(model, nface, n);
+    normalize3(n);
+}
+
+void shadeLightVertices(Model *model, Vec3 light, double *intensity, Vec3 *normals)
+{
+    unsigned int i, k;
+    if (model->nnorm) {
+        for (i = 0; i < model->nnorm; ++i) {
+            Vec3 n;
+            memcpy(n, model->normals[i], sizeof(Vec3));
+            normalize3(n);
+            double I = product_dot(n, light);
+            intensity[i] = I > 0 ? I : 0.0;
+        }
+        return;
+    }
+    // larger faces weigh more, slivers barely move the normal
+    memset(normals, 0, model->nvert * sizeof(Vec3));
+    for (i = 0; i < model->nface; ++i) {
+        Vec3 n;
+        faceCross(model, i, n);
+        for (k = 0; k < 3; ++k) {
+            double *v = normals[getVertexIndex(model, i, k)];
+            v[0] += n[0];
+            v[1] += n[1];
+            v[2] += n[2];
+        }
+    }
+    for (i = 0; i < model->nvert; ++i) {
+        normalize3(normals[i]);
+        // computed normals have no reliable orientation, light both sides like flat
+        intensity[i] = d_abs(product_dot(normals[i], light));
+    }
+}
+
+void shadeSetup(Model *model, unsigned int nface, const shader *sh, Vec3 light, Vec3 view,
+                const shadeVertices *vs, shadeFace *face)
+{
+    assert(model);
+    assert(sh);
+    assert(face);
+    int k;
+    face->mode = sh->mode;
+    face->features = sh->features;
+    if (sh->mode == SHADING_DEPTH) {
+        return;
+    }
+    if (sh->features & (SHADE_TEXTURE | SHADE_NORMAL_MAP | SHADE_SPECULAR)) {
+        for (k = 0; k < 3; ++k) {
+            memcpy(face->uv[k], *getDiffuseUV(model, nface, k), sizeof(Vec3));
+        }
+    }
+    memcpy(face->light, light, sizeof(Vec3));
+    memcpy(face->view, view, sizeof(Vec3));
+    if (vs && vs->shadow) {
+        for (k = 0; k < 3; ++k) {
+            memcpy(face->shadow[k], vs->shadow[getVertexIndex(model, nface, k)], sizeof(Vec3));
+        }
+    }
+
+    if (sh->mode == SHADING_FLAT) {
+        double I = intension(getVertex(model, nface, 0), getVertex(model, nface, 1),
+                             getVertex(model, nface, 2), light);
+        face->intensity[0] = d_abs(I);
+        return;
+    }
+
+    if (sh->mode == SHADING_GOURAUD && vs && vs->lit) {
+        for (k = 0; k < 3; ++k) {
+            face->intensity[k] = model->nnorm ? vs->lit[model->faces[nface][3 * k + 2]] : vs->lit[getVertexIndex(model, nface, k)];
+        }
+        return;
+    }
+
+    if (model->nnorm) {
+        for (k = 0; k < 3; ++k) {
+            memcpy(face->norm[k], *getNorm(model, nface, k), sizeof(Vec3));
+            normalize3(face->norm[k]);
+        }
+    } else { // no vn in the file, light the face flat
+        Vec3 n;
+        faceNormal(model, nface, n);
+        for (k = 0; k < 3; ++k) {
+            memcpy(face->norm[k], n, sizeof(Vec3));
+        }
+    }
+
+    if (sh->mode == SHADING_GOURAUD) {
+        for (k = 0; k < 3; ++k) {
+            double I = product_dot(face->norm[k], light);
+            // face normals have no reliable orientation, light both sides like flat
+            face->intensity[k] = model->nnorm ? (I > 0 ? I : 0.0) : d_abs(I);
+        }
+        return;
+    }
+
+    if (sh->features & SHADE_NORMAL_MAP) {
+        memcpy(face->tangent, model->tangents[nface], sizeof(Vec3));
+        memcpy(face->bitangent, model->bitangents[nface], sizeof(Vec3));
+    }
+}
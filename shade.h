@@ -0,0 +1,119 @@
+#ifndef SHADE_H_
+#define SHADE_H_
+
+#include <stddef.h>
+#include "tga.h"
+#include "model.h"
+
+/* a pixel that passed the depth test, u and v are the barycentric weights of b and c */
+typedef struct Fragment {
+    int x, y;
+    double u, v;
+    unsigned int mask; // covered samples, multisampling only
+} Fragment;
+
+#define MAX_SAMPLES 8
+
+/*
+ * Depth seen from the light, drawn beforehand by a depth only pass. A
+ * fragment is lit when its own depth from the light is within bias of
+ * the stored one; with pcf > 0 the (2 pcf + 1)^2 texels around it vote.
+ */
+typedef struct shadeShadowMap {
+    const float *depth;      // DEPTH_FLOAT values, larger is nearer the light
+    unsigned int width, height;
+    int pcf;
+    double bias;             // in depth units
+} shadeShadowMap;
+
+#define SHADOW_KEEP 0.3      // share of the direct light left in shadow
+
+/* where shaded fragments go: the image itself or one color per sample */
+typedef struct shadeTarget {
+    tgaImage *image;
+    int samples;             // 1 writes the image directly
+    tgaColor *sample_colors; // width * height * samples, pixel major
+    int clip[4];             // x0, y0, x1, y1 inclusive, the pixels draws may touch
+    const shadeShadowMap *shadow; // NULL draws without shadows
+} shadeTarget;
+
+enum shadingMode {
+    SHADING_DEPTH,    // depth only, no color writes
+    SHADING_FLAT,     // one intension() per face
+    SHADING_GOURAUD,  // intensity per vertex, interpolated
+    SHADING_PHONG,    // lighting per pixel from interpolated normals
+    SHADING_MODES
+};
+
+/* optional inputs, combined as bit flags */
+enum shadeFeature {
+    SHADE_TEXTURE    = 1, // diffuse map, white otherwise
+    SHADE_NORMAL_MAP = 2, // phong only
+    SHADE_SPECULAR   = 4, // phong only
+    SHADE_SHADOW     = 8, // target has a shadow map, set by shaderSelect
+    SHADE_FEATURES   = 16
+};
+
+/* everything the per pixel loops need from one face */
+typedef struct shadeFace {
+    Vec3 uv[3];
+    Vec3 norm[3];
+    Vec3 tangent;
+    Vec3 bitangent;
+    Vec3 light;
+    Vec3 view;           // towards the viewer, model space like light
+    double intensity[3]; // flat uses the first one
+    Vec3 shadow[3];      // shadow map x, y and depth of the corners
+    int mode, features;  // of the shader set up for, read by the generic loop
+} shadeFace;
+
+typedef void (*shadeFn)(const shadeTarget *target, Model *model, const shadeFace *face,
+                        const Fragment *fragments, size_t nfrag);
+
+/*
+ * One specialized inner loop per mode and feature set, and a second one
+ * that writes covered samples. `shade` is NULL for depth only, the
+ * rasterizer then skips recording fragments.
+ */
+typedef struct shader {
+    const char *name;
+    int mode;
+    int features;
+    shadeFn shade;
+    shadeFn shade_msaa;
+} shader;
+
+/* features the model can provide for the mode: maps that are loaded and used */
+int shaderFeatures(Model *model, int mode);
+
+/*
+ * Picked once per draw, features not supported by the mode are dropped.
+ * SHADE_SHADOW comes from target, the variants without it don't look at
+ * the shadow map at all.
+ */
+const shader * shaderSelect(int mode, int features, const shadeTarget *target);
+
+/*
+ * sh with its loops replaced by one that tests mode and features per
+ * fragment, the specialized variants must match it pixel for pixel.
+ */
+shader shaderGeneric(const shader *sh);
+
+/*
+ * Gouraud lighting for the vertex stage, once per unique vertex instead of
+ * once per face corner: intensity gets one value per normal (nnorm) when
+ * the model has vn, otherwise one per position (nvert) from area weighted
+ * face normals, built in normals (nvert entries, untouched with vn).
+ */
+void shadeLightVertices(Model *model, Vec3 light, double *intensity, Vec3 *normals);
+
+/* results of the vertex stage of one draw, NULL when not needed */
+typedef struct shadeVertices {
+    const double *lit;       // gouraud, from shadeLightVertices
+    const Vec3 *shadow;      // per position, when the target has a shadow map
+} shadeVertices;
+
+void shadeSetup(Model *model, unsigned int nface, const shader *sh, Vec3 light, Vec3 view,
+                const shadeVertices *vs, shadeFace *face);
+
+#endif // SHADE_H_
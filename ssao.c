@@ -0,0 +1,415 @@
+#include "ssao.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define SSAO_BIAS 0.1f         // cosine below which a tap doesn't occlude, against self occlusion on flat ground
+#define SSAO_DEPTH_SIGMA 0.01  // relative w difference halving an upsampling weight
+#define SSAO_MAX_STRIPS 64
+
+typedef struct ssaoJob {
+    const ssaoParams *params;
+    tgaImage *image;
+    const depthBuffer *depth;
+    unsigned int width, height;
+    unsigned int step;          // 1 full, 2 half resolution
+    unsigned int gw, gh;        // occlusion grid
+    unsigned int strips;
+    float *grid;                // w per grid pixel, 0 where nothing was drawn
+    int (*span)[2];             // drawn grid pixels of a row lie in [span[0], span[1])
+    float *ao;                  // per grid pixel, 1 open
+    float *normals;             // three rows of normal components per strip
+    const float *empty;         // a grid row of zeros
+    float *invw;                // one full resolution row of 1/w per strip, for upsampling, then its factors
+    // a grid pixel at w sits at w times its ndc across and (1 - w) * distance towards the eye
+    float distance;             // eye to center
+    float ndc[2][2];            // grid pixel to ndc, x then y: scale and offset
+    int taps[SSAO_SAMPLES][2];  // grid offsets, the same for every pixel
+    int ntaps;
+} ssaoJob;
+
+typedef void (*ssaoRows)(ssaoJob *job, unsigned int strip, unsigned int y0, unsigned int y1);
+
+typedef struct ssaoStrip {
+    ssaoJob *job;
+    ssaoRows rows;
+    unsigned int index, y0, y1;
+    renderStats stats;          // of the helper thread, for statsJoin
+} ssaoStrip;
+
+static void * runStrip(void *arg)
+{
+    ssaoStrip *strip = (ssaoStrip *)arg;
+    strip->rows(strip->job, strip->index, strip->y0, strip->y1);
+    statsTake(&strip->stats);
+    return NULL;
+}
+
+/* rows [0, height) split over job->strips threads, the caller's thread takes the first strip */
+static void runStrips(ssaoJob *job, ssaoRows rows, unsigned int height)
+{
+    ssaoStrip strips[SSAO_MAX_STRIPS];
+    pthread_t tids[SSAO_MAX_STRIPS];
+    int started[SSAO_MAX_STRIPS];
+    unsigned int n = job->strips, i;
+    for (i = 0; i < n; ++i) {
+        strips[i].job = job;
+        strips[i].rows = rows;
+        strips[i].index = i;
+        strips[i].y0 = (uint64_t)height * i / n;
+        strips[i].y1 = (uint64_t)height * (i + 1) / n;
+    }
+    for (i = 1; i < n; ++i) {
+        started[i] = !pthread_create(&tids[i], NULL, runStrip, &strips[i]);
+    }
+    runStrip(&strips[0]);
+    for (i = 1; i < n; ++i) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+            statsJoin(&strips[i].stats);
+        } else {
+            runStrip(&strips[i]);
+        }
+    }
+}
+
+/* w of every grid pixel from 1/w in the depth buffer, and where each row was drawn */
+static void linearRows(ssaoJob *job, unsigned int strip, unsigned int y0, unsigned int y1)
+{
+    const int gw = job->gw;
+    unsigned int y;
+    int x;
+    (void)strip;
+    for (y = y0; y < y1; ++y) {
+        float *row = job->grid + (size_t)y * gw;
+        depthRowInvW(job->depth, y * job->step, 0, job->width, job->step, row);
+        // first and last drawn pixel as a min and a max, each its own loop so both vectorize
+        int first = gw, last = 0;
+        for (x = 0; x < gw; ++x) {
+            int i = row[x] > 0 ? x : gw;
+            first = i < first ? i : first;
+        }
+        for (x = 0; x < gw; ++x) {
+            int i = row[x] > 0 ? x + 1 : 0;
+            last = i > last ? i : last;
+        }
+        job->span[y][0] = first;
+        job->span[y][1] = last;
+        for (x = first; x < last; ++x) {
+            // divide unconditionally, a select on the result keeps the loop vectorizable
+            float v = row[x], inv = 1.0f / (v > 0 ? v : 1.0f);
+            row[x] = v > 0 ? inv : 0.0f;
+        }
+    }
+}
+
+/*
+ * Unit normals over the drawn span of grid row y, facing the eye, 0 where
+ * nothing was drawn. Each comes from the neighbours on the nearer side, so
+ * silhouettes don't bend it, and with neither neighbour drawn it faces the
+ * eye; the choices are selects, the loop vectorizes like the taps do.
+ */
+static void rowNormals(const ssaoJob *job, int y, float *restrict nx, float *restrict ny, float *restrict nz)
+{
+    const int gw = job->gw, gh = job->gh;
+    const float *restrict g = job->grid + (size_t)y * gw;
+    // a missing row reads as nothing drawn
+    const float *restrict gd = y > 0 ? g - gw : job->empty;
+    const float *restrict gu = y + 1 < gh ? g + gw : job->empty;
+    const float sx = job->ndc[0][0], bx = job->ndc[0][1];
+    const float sy = job->ndc[1][0], by = job->ndc[1][1];
+    const float distance = job->distance;
+    const float fy = y * sy + by;
+    int first = job->span[y][0], last = job->span[y][1], x;
+    // pixels on the left and right edge have one neighbour in the row, they face the eye
+    if (first == 0) {
+        nx[0] = ny[0] = 0.0f;
+        nz[0] = g[0] > 0 ? 1.0f : 0.0f;
+        ++first;
+    }
+    if (last == gw && last > first) {
+        --last;
+        nx[last] = ny[last] = 0.0f;
+        nz[last] = g[last] > 0 ? 1.0f : 0.0f;
+    }
+    for (x = first; x < last; ++x) {
+        float w = g[x], l = g[x - 1], r = g[x + 1], d = gd[x], u = gu[x];
+        float fx = x * sx + bx;
+        int right = (r > 0) & ((l <= 0) | (fabsf(r - w) < fabsf(w - l)));
+        int up = (u > 0) & ((d <= 0) | (fabsf(u - w) < fabsf(w - d)));
+        // one step along the row and one across it, both towards +x and +y
+        float h = right ? r : l, sh = right ? 1.0f : -1.0f;
+        float v = up ? u : d, sv = up ? 1.0f : -1.0f;
+        float dx0 = sh * (((x + sh) * sx + bx) * h - fx * w);
+        float dx1 = sh * fy * (h - w);
+        float dx2 = sh * (w - h) * distance;
+        float dy0 = sv * fx * (v - w);
+        float dy1 = sv * (((y + sv) * sy + by) * v - fy * w);
+        float dy2 = sv * (w - v) * distance;
+        float n0 = dx1 * dy2 - dx2 * dy1;
+        float n1 = dx2 * dy0 - dx0 * dy2;
+        float n2 = dx0 * dy1 - dx1 * dy0;
+        float len = sqrtf(n0 * n0 + n1 * n1 + n2 * n2);
+        // towards the eye, which sits at (0, 0, distance) with the pixel at w * (fx, fy) and (1 - w) * distance
+        float facing = n2 * w * distance - (n0 * fx + n1 * fy) * w;
+        float scale = (facing < 0 ? -1.0f : 1.0f) / (len > 0 ? len : 1.0f);
+        int found = (w > 0) & ((l > 0) | (r > 0)) & ((d > 0) | (u > 0));
+        nx[x] = found ? n0 * scale : 0.0f;
+        ny[x] = found ? n1 * scale : 0.0f;
+        nz[x] = found ? n2 * scale : w > 0 ? 1.0f : 0.0f;
+    }
+}
+
+/*
+ * Taps are the outer loop and the pixels of the row the inner one: every
+ * tap sits at the same offset from its pixel, so both rows are read in
+ * order and the inner loop is plain float arithmetic over arrays, the
+ * tests folded into a select, which the compiler vectorizes.
+ */
+static void occlusionRows(ssaoJob *job, unsigned int strip, unsigned int y0, unsigned int y1)
+{
+    const int gw = job->gw, gh = job->gh;
+    const float inv_r2 = 1.0f / (float)(job->params->radius * job->params->radius);
+    const float strength = job->params->strength / job->ntaps;
+    const float sx = job->ndc[0][0], bx = job->ndc[0][1];
+    const float sy = job->ndc[1][0], by = job->ndc[1][1];
+    const float distance = job->distance;
+    float *restrict nx = job->normals + (size_t)strip * 3 * gw;
+    float *restrict ny = nx + gw, *restrict nz = ny + gw;
+    int x, y, k;
+    for (y = y0; y < (int)y1; ++y) {
+        const float *restrict g = job->grid + (size_t)y * gw;
+        float *restrict ao = job->ao + (size_t)y * gw;
+        const int first = job->span[y][0], last = job->span[y][1];
+        for (x = 0; x < gw; ++x) {
+            ao[x] = 0.0f;
+        }
+        if (first >= last) {
+            continue;
+        }
+        rowNormals(job, y, nx, ny, nz);
+        const float fy = y * sy + by;
+        for (k = 0; k < job->ntaps; ++k) {
+            const int ox = job->taps[k][0], ys = y + job->taps[k][1];
+            if (ys < 0 || ys >= gh) {
+                continue;
+            }
+            const float *restrict gs = job->grid + (size_t)ys * gw + ox;
+            const float fys = ys * sy + by, fox = ox * sx;
+            const int a = first > -ox ? first : -ox;
+            const int b = last < gw - ox ? last : gw - ox;
+            for (x = a; x < b; ++x) {
+                float w = g[x], ws = gs[x];
+                float fx = x * sx + bx;
+                // tap minus pixel in view space
+                float v0 = fx * (ws - w) + fox * ws;
+                float v1 = fys * ws - fy * w;
+                float v2 = (w - ws) * distance;
+                float vv = v0 * v0 + v1 * v1 + v2 * v2;
+                float c = (v0 * nx[x] + v1 * ny[x] + v2 * nz[x]) / sqrtf(vv + 1e-12f) - SSAO_BIAS;
+                float falloff = 1.0f - vv * inv_r2;
+                // everything is worked out for every lane, only the result is selected
+                float o = (c > 0 ? c : 0.0f) * (falloff > 0 ? falloff : 0.0f);
+                ao[x] += ws > 0 ? o : 0.0f;
+            }
+        }
+        for (x = 0; x < gw; ++x) {
+            float a = 1.0f - strength * ao[x];
+            ao[x] = a < 0 ? 0.0f : a;
+        }
+    }
+}
+
+static inline void darken(unsigned char *px, int bpp, float a)
+{
+    int c, channels = bpp == RGBA ? 3 : bpp;
+    for (c = 0; c < channels; ++c) {
+        px[c] = (unsigned char)(px[c] * a + 0.5f);
+    }
+}
+
+static void compositeRows(ssaoJob *job, unsigned int strip, unsigned int y0, unsigned int y1)
+{
+    tgaImage *image = job->image;
+    const int bpp = image->bpp;
+    unsigned int y;
+    int x;
+    (void)strip;
+    for (y = y0; y < y1; ++y) {
+        const float *g = job->grid + (size_t)y * job->width;
+        const float *ao = job->ao + (size_t)y * job->width;
+        unsigned char *row = image->data + (size_t)y * image->width * bpp;
+        for (x = job->span[y][0]; x < job->span[y][1]; ++x) {
+            if (ao[x] < 1.0f && g[x] > 0) {
+                darken(row + x * bpp, bpp, ao[x]);
+            }
+        }
+    }
+}
+
+/* of a grid pixel at w of g for a pixel with 1/w of z; 0 where nothing was drawn */
+static inline float upsampleWeight(float g, float z)
+{
+    // (g - w) / w in units of sigma, without dividing by the pixel's w
+    float t = (g * z - 1.0f) * (1.0f / SSAO_DEPTH_SIGMA);
+    return g > 0 ? 1.0f / (1.0f + t * t) : 0.0f;
+}
+
+/*
+ * Depth aware average of the grid columns ia and ib of two rows, for a
+ * pixel with 1/w of z; 1 where nothing was drawn. A column or row given
+ * twice counts twice, which leaves the average as it is.
+ */
+static inline float upsampleFactor(float z, const float *g0, const float *ao0, const float *g1, const float *ao1,
+                                   int ia, int ib)
+{
+    float w0 = upsampleWeight(g0[ia], z), w1 = upsampleWeight(g0[ib], z);
+    float w2 = upsampleWeight(g1[ia], z), w3 = upsampleWeight(g1[ib], z);
+    float sum = w0 * ao0[ia] + w1 * ao0[ib] + w2 * ao1[ia] + w3 * ao1[ib];
+    float total = w0 + w1 + w2 + w3;
+    return (z > 0) & (total > 1e-6f) ? sum / (total > 1e-6f ? total : 1.0f) : 1.0f;
+}
+
+/*
+ * Full pixels sit on even grid pixels or halfway between two: bilinear
+ * weights, each scaled down by how far the w of the grid pixel is from
+ * the pixel's own, taken from its 1/w without a second grid. The
+ * even and the odd pixels of a row are two loops over grid columns, each
+ * plain selects that vectorize; the factors replace the row of 1/w and
+ * are applied after.
+ */
+static void upsampleRows(ssaoJob *job, unsigned int strip, unsigned int y0, unsigned int y1)
+{
+    tgaImage *image = job->image;
+    const int bpp = image->bpp;
+    const int gw = job->gw, gh = job->gh;
+    float *f = job->invw + (size_t)strip * job->width;
+    unsigned int y;
+    int x, i;
+    for (y = y0; y < y1; ++y) {
+        int j0 = y / 2, j1 = (y & 1) && j0 + 1 < gh ? j0 + 1 : j0;
+        // nothing to take from outside the spans of both grid rows
+        int first = job->span[j0][0] < job->span[j1][0] ? job->span[j0][0] : job->span[j1][0];
+        int last = job->span[j0][1] > job->span[j1][1] ? job->span[j0][1] : job->span[j1][1];
+        if (first >= last) {
+            continue;
+        }
+        const float *g0 = job->grid + (size_t)j0 * gw, *g1 = job->grid + (size_t)j1 * gw;
+        const float *ao0 = job->ao + (size_t)j0 * gw, *ao1 = job->ao + (size_t)j1 * gw;
+        unsigned char *row = image->data + (size_t)y * image->width * bpp;
+        int x0 = first > 0 ? 2 * first - 1 : 0;
+        int x1 = 2 * last < (int)job->width ? 2 * last : (int)job->width;
+        depthRowInvW(job->depth, y, x0, x1, 1, f);
+        for (i = (x0 + 1) / 2; i < (x1 + 1) / 2; ++i) {
+            f[2 * i - x0] = upsampleFactor(f[2 * i - x0], g0, ao0, g1, ao1, i, i);
+        }
+        // the last pixel of an even width has no grid column to its right
+        int odd = x1 / 2 < gw - 1 ? x1 / 2 : gw - 1;
+        for (i = x0 / 2; i < odd; ++i) {
+            f[2 * i + 1 - x0] = upsampleFactor(f[2 * i + 1 - x0], g0, ao0, g1, ao1, i, i + 1);
+        }
+        if (odd < x1 / 2) {
+            f[2 * odd + 1 - x0] = upsampleFactor(f[2 * odd + 1 - x0], g0, ao0, g1, ao1, odd, odd);
+        }
+        for (x = x0; x < x1; ++x) {
+            if (f[x - x0] < 1.0f) {
+                darken(row + x * bpp, bpp, f[x - x0]);
+            }
+        }
+    }
+}
+
+int ssaoApply(renderContext *ctx, const ssaoParams *params)
+{
+    assert(ctx && params);
+    if (ctx->depth->format == DEPTH_LEGACY || params->radius <= 0) {
+        return 0;
+    }
+    ssaoJob job;
+    int k;
+    job.params = params;
+    job.image = ctx->image;
+    job.depth = ctx->depth;
+    job.width = ctx->image->width;
+    job.height = ctx->image->height;
+    job.step = params->full ? 1 : 2;
+    job.gw = (job.width + job.step - 1) / job.step;
+    job.gh = (job.height + job.step - 1) / job.step;
+    // lookAt puts -1/distance times the view axis in the last row
+    double r = sqrt(ctx->camera[3][0] * ctx->camera[3][0] + ctx->camera[3][1] * ctx->camera[3][1] +
+                    ctx->camera[3][2] * ctx->camera[3][2]);
+    job.distance = r > 0 ? 1 / r : 1;
+    for (k = 0; k < 2; ++k) {
+        unsigned int size = k ? job.height : job.width;
+        job.ndc[k][0] = 2.0f * job.step / size;
+        job.ndc[k][1] = 1.0f / size - 1.0f;
+    }
+    /*
+     * The radius in pixels is taken at w = 1, the depth of the center, for
+     * the whole frame: nearer and farther surfaces get a kernel a little too
+     * small or too large, in exchange the taps are fixed offsets. Golden
+     * angle spiral, denser in the middle where occluders matter most; taps
+     * rounding onto the pixel itself or onto an earlier tap are dropped.
+     * At half resolution a tap stands for a 2x2 block and the upsample
+     * blends neighbouring blocks, fewer of them do.
+     */
+    double reach = params->radius * job.width / 2.0;
+    if (reach > SSAO_MAX_RADIUS) reach = SSAO_MAX_RADIUS;
+    reach /= job.step;
+    if (reach < 1.0) reach = 1.0;
+    int samples = job.step == 1 ? SSAO_SAMPLES : SSAO_HALF_SAMPLES;
+    job.ntaps = 0;
+    for (k = 0; k < samples; ++k) {
+        double a = k * 2.39996323, s = sqrt((k + 0.5) / samples) * reach;
+        int ox = (int)floor(s * cos(a) + 0.5), oy = (int)floor(s * sin(a) + 0.5);
+        int t = 0;
+        while (t < job.ntaps && (job.taps[t][0] != ox || job.taps[t][1] != oy)) {
+            ++t;
+        }
+        if ((ox || oy) && t == job.ntaps) {
+            job.taps[job.ntaps][0] = ox;
+            job.taps[job.ntaps][1] = oy;
+            ++job.ntaps;
+        }
+    }
+
+    unsigned int threads = params->threads;
+    if (!threads) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? online : 1;
+    }
+    unsigned int most = (job.gh + SSAO_STRIP_ROWS - 1) / SSAO_STRIP_ROWS;
+    job.strips = threads < most ? threads : most;
+    if (job.strips > SSAO_MAX_STRIPS) job.strips = SSAO_MAX_STRIPS;
+    if (job.strips < 1) job.strips = 1;
+
+    size_t mark = arenaMark(ctx->frame);
+    size_t ngrid = (size_t)job.gw * job.gh;
+    job.grid = (float *)arenaAlloc(ctx->frame, ngrid * sizeof(float));
+    job.span = (int (*)[2])arenaAlloc(ctx->frame, job.gh * sizeof(*job.span));
+    job.ao = (float *)arenaAlloc(ctx->frame, ngrid * sizeof(float));
+    job.normals = (float *)arenaAlloc(ctx->frame, (size_t)job.strips * 3 * job.gw * sizeof(float));
+    float *empty = (float *)arenaAlloc(ctx->frame, job.gw * sizeof(float));
+    job.empty = empty;
+    job.invw = NULL;
+    if (job.step != 1) {
+        job.invw = (float *)arenaAlloc(ctx->frame, (size_t)job.strips * job.width * sizeof(float));
+    }
+    if (!job.grid || !job.span || !job.ao || !job.normals || !empty || (job.step != 1 && !job.invw)) {
+        arenaRewind(ctx->frame, mark);
+        return -1;
+    }
+    memset(empty, 0, job.gw * sizeof(float));
+    statsBegin(STAGE_SHADE);
+    runStrips(&job, linearRows, job.gh);
+    runStrips(&job, occlusionRows, job.gh);
+    runStrips(&job, job.step == 1 ? compositeRows : upsampleRows, job.height);
+    statsEnd(STAGE_SHADE);
+    arenaRewind(ctx->frame, mark);
+    return 0;
+}
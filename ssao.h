@@ -0,0 +1,36 @@
+#ifndef SSAO_H_
+#define SSAO_H_
+
+#include "context.h"
+
+#define SSAO_SAMPLES 12       // taps per pixel on a spiral
+#define SSAO_HALF_SAMPLES 8   // the same at half resolution, at most SSAO_SAMPLES
+#define SSAO_MAX_RADIUS 48    // pixels, near surfaces don't sample the whole image
+#define SSAO_STRIP_ROWS 16    // fewest rows given to one thread
+
+/*
+ * Screen space ambient occlusion after the frame is resolved. Positions
+ * are rebuilt from the depth buffer and the camera, normals from the
+ * neighbouring positions, and every pixel is darkened by how much of the
+ * hemisphere around its normal is closed off by what lies within radius
+ * (world units) of it; the taps are spread over radius as it appears at
+ * the depth of the center, one kernel for the frame. Unless full is set
+ * the occlusion is worked out at half width and height, for a quarter of
+ * the pixels, and brought back up with weights that fall off with the
+ * depth difference, so it doesn't bleed across silhouettes.
+ */
+typedef struct ssaoParams {
+    double radius;
+    double strength;          // 1 for the plain estimate, more darkens further
+    int full;                 // occlusion of every pixel, not of every 2x2 block
+    unsigned int threads;     // row strips run in parallel, 0 takes every online cpu
+} ssaoParams;
+
+/*
+ * Multiplies the colors of ctx->image by the occlusion, call after
+ * renderResolve. Legacy depth has no 1/w to rebuild positions from, the
+ * image is left as it is then. -1 when out of memory.
+ */
+int ssaoApply(renderContext *ctx, const ssaoParams *params);
+
+#endif // SSAO_H_
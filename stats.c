@@ -0,0 +1,131 @@
+#include "stats.h"
+
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+__thread renderStats g_stats;
+
+static const char *stage_names[STAGE_COUNT] = {
+    "parse", "texture", "transform", "raster", "shade", "output"
+};
+
+static const char *counter_names[CNT_COUNT] = {
+    "triangles_submitted",
+    "triangles_culled",
+    "triangles_rasterized",
+    "triangles_small",
+    "instances_culled",
+    "edges_drawn",
+    "fragments_tested",
+    "fragments_depth_rejected",
+    "fragments_shaded",
+    "texels_fetched"
+};
+
+static double timespecToSec(struct timespec *ts)
+{
+    return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+double statsWallTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespecToSec(&ts);
+}
+
+double statsCpuTime(void)
+{
+    // not the process clock: other renders running meanwhile aren't this stage's
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return timespecToSec(&ts) + g_stats.joined_cpu;
+}
+
+void statsTake(renderStats *out)
+{
+    assert(out);
+    *out = g_stats;
+    out->joined_cpu = statsCpuTime();
+}
+
+void statsJoin(const renderStats *helper)
+{
+    assert(helper);
+    int i;
+    for (i = 0; i < CNT_COUNT; ++i) {
+        g_stats.counters[i] += helper->counters[i];
+    }
+    g_stats.joined_cpu += helper->joined_cpu;
+}
+
+void statsEnable(int enabled)
+{
+    g_stats.enabled = enabled;
+}
+
+void statsReset(void)
+{
+    int enabled = g_stats.enabled;
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.enabled = enabled;
+}
+
+void statsBegin(int stage)
+{
+    assert(stage >= 0 && stage < STAGE_COUNT);
+    if (!g_stats.enabled) {
+        return;
+    }
+    g_stats.wall_start[stage] = statsWallTime();
+    g_stats.cpu_start[stage] = statsCpuTime();
+}
+
+void statsEnd(int stage)
+{
+    assert(stage >= 0 && stage < STAGE_COUNT);
+    if (!g_stats.enabled) {
+        return;
+    }
+    g_stats.wall[stage] += statsWallTime() - g_stats.wall_start[stage];
+    g_stats.cpu[stage] += statsCpuTime() - g_stats.cpu_start[stage];
+}
+
+void statsPrintText(FILE *fd)
+{
+    assert(fd);
+    int i;
+    double wall = 0.0;
+    double cpu = 0.0;
+    fprintf(fd, "%-12s %12s %12s\n", "stage", "wall ms", "cpu ms");
+    for (i = 0; i < STAGE_COUNT; ++i) {
+        fprintf(fd, "%-12s %12.3f %12.3f\n", stage_names[i],
+                g_stats.wall[i] * 1e3, g_stats.cpu[i] * 1e3);
+        wall += g_stats.wall[i];
+        cpu += g_stats.cpu[i];
+    }
+    fprintf(fd, "%-12s %12.3f %12.3f\n", "total", wall * 1e3, cpu * 1e3);
+    fprintf(fd, "\n");
+    for (i = 0; i < CNT_COUNT; ++i) {
+        fprintf(fd, "%-26s %14llu\n", counter_names[i], g_stats.counters[i]);
+    }
+}
+
+void statsPrintJson(FILE *fd)
+{
+    assert(fd);
+    int i;
+    fprintf(fd, "{\n  \"stages\": {\n");
+    for (i = 0; i < STAGE_COUNT; ++i) {
+        fprintf(fd, "    \"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f }%s\n",
+                stage_names[i], g_stats.wall[i] * 1e3, g_stats.cpu[i] * 1e3,
+                (i + 1 < STAGE_COUNT) ? "," : "");
+    }
+    fprintf(fd, "  },\n  \"counters\": {\n");
+    for (i = 0; i < CNT_COUNT; ++i) {
+        fprintf(fd, "    \"%s\": %llu%s\n", counter_names[i], g_stats.counters[i],
+                (i + 1 < CNT_COUNT) ? "," : "");
+    }
+    fprintf(fd, "  }\n}\n");
+}
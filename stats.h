@@ -0,0 +1,74 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+
+enum statsStage {
+    STAGE_PARSE,      /* loadFromObj */
+    STAGE_TEXTURE,    /* diffuse/normal/specular maps */
+    STAGE_TRANSFORM,  /* world -> screen for every vertex */
+    STAGE_RASTER,     /* coverage and depth test */
+    STAGE_SHADE,      /* texture fetch and color write */
+    STAGE_OUTPUT,     /* flip and save */
+    STAGE_COUNT
+};
+
+enum statsCounter {
+    CNT_TRI_SUBMITTED,
+    CNT_TRI_CULLED,
+    CNT_TRI_RASTERIZED,
+    CNT_TRI_SMALL,          /* rasterized in batches, see smallTriangle */
+    CNT_INSTANCE_CULLED,    /* renderDrawInstance boxes off screen */
+    CNT_EDGES_DRAWN,        /* wireframe edges left after clipping */
+    CNT_FRAG_TESTED,
+    CNT_FRAG_DEPTH_REJECTED,
+    CNT_FRAG_SHADED,
+    CNT_TEXEL_FETCHED,
+    CNT_COUNT
+};
+
+typedef struct renderStats {
+    int enabled;
+    double wall[STAGE_COUNT]; /* seconds */
+    double cpu[STAGE_COUNT];  /* seconds, the thread and the helpers it joined meanwhile */
+    double wall_start[STAGE_COUNT];
+    double cpu_start[STAGE_COUNT];
+    double joined_cpu;        /* seconds of helper threads taken in by statsJoin */
+    unsigned long long counters[CNT_COUNT];
+} renderStats;
+
+/*
+ * Per thread, so concurrent renders don't race on the counters. A thread
+ * that splits work over helpers gets their counters and CPU time back at
+ * the join: the helper calls statsTake last, the joining one statsJoin.
+ */
+extern __thread renderStats g_stats;
+
+/* counters are cheap enough to be always on */
+#define STATS_ADD(counter, n) (g_stats.counters[(counter)] += (n))
+
+void statsEnable(int enabled);
+
+void statsReset(void);
+
+/* begin/end pairs accumulate, so a stage may be entered many times */
+void statsBegin(int stage);
+
+void statsEnd(int stage);
+
+double statsWallTime(void);
+
+/* CPU time of the calling thread and of the helpers it joined */
+double statsCpuTime(void);
+
+/* the calling thread's stats, joined_cpu then holds all of its statsCpuTime */
+void statsTake(renderStats *out);
+
+/* adds the counters and CPU time of a helper's statsTake, after pthread_join */
+void statsJoin(const renderStats *helper);
+
+void statsPrintText(FILE *);
+
+void statsPrintJson(FILE *);
+
+#endif // STATS_H_
@@ -0,0 +1,234 @@
+#include "stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+enum { SECTION_VERTEX, SECTION_TEXTURE, SECTION_NORMAL, SECTION_FACE };
+
+static int readAt(int fd, void *buf, size_t bytes, off_t offset)
+{
+    while (bytes) {
+        ssize_t n = pread(fd, buf, bytes, offset);
+        if (n <= 0) {
+            return -1;
+        }
+        buf = (unsigned char *)buf + n;
+        bytes -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// one sequential pass over the positions
+static int bounds(meshStream *stream)
+{
+    unsigned int i = 0, k;
+    int first = 1;
+    while (i < stream->header.nvert) {
+        unsigned int n = stream->header.nvert - i;
+        if (n > STREAM_SPAN) {
+            n = STREAM_SPAN;
+        }
+        if (-1 == readAt(stream->fd, stream->span, n * sizeof(Vec3),
+                         stream->offsets[SECTION_VERTEX] + (off_t)i * sizeof(Vec3))) {
+            return -1;
+        }
+        for (k = 0; k < n; ++k) {
+            int c;
+            for (c = 0; c < 3; ++c) {
+                if (first || stream->span[k][c] < stream->lo[c]) stream->lo[c] = stream->span[k][c];
+                if (first || stream->span[k][c] > stream->hi[c]) stream->hi[c] = stream->span[k][c];
+            }
+            first = 0;
+        }
+        i += n;
+    }
+    return 0;
+}
+
+meshStream * streamOpen(const char *filename, unsigned int chunk_faces)
+{
+    assert(filename);
+    assert(chunk_faces > 0);
+
+    meshStream *stream = (meshStream *)calloc(1, sizeof(meshStream));
+    if (!stream) {
+        return NULL;
+    }
+    stream->fd = open(filename, O_RDONLY);
+    if (stream->fd < 0) {
+        free(stream);
+        return NULL;
+    }
+    meshHeader *h = &stream->header;
+    if (-1 == readAt(stream->fd, h, sizeof(*h), 0) ||
+            memcmp(h->magic, MESH_MAGIC, 4) || h->version != MESH_VERSION) {
+        fprintf(stderr, "%s is not a mesh file\n", filename);
+        streamClose(stream);
+        return NULL;
+    }
+    stream->offsets[SECTION_VERTEX] = sizeof(meshHeader);
+    stream->offsets[SECTION_TEXTURE] = stream->offsets[SECTION_VERTEX] + (off_t)h->nvert * sizeof(Vec3);
+    stream->offsets[SECTION_NORMAL] = stream->offsets[SECTION_TEXTURE] + (off_t)h->ntext * sizeof(Vec3);
+    stream->offsets[SECTION_FACE] = stream->offsets[SECTION_NORMAL] + (off_t)h->nnorm * sizeof(Vec3);
+
+    stream->chunk_faces = chunk_faces < h->nface ? chunk_faces : (h->nface ? h->nface : 1);
+    unsigned int corners = 3 * stream->chunk_faces;
+    stream->chunk = createModel(corners, corners, corners, stream->chunk_faces);
+    stream->keys = (uint64_t *)malloc((size_t)corners * sizeof(uint64_t));
+    stream->sorted = (uint64_t *)malloc((size_t)corners * sizeof(uint64_t));
+    stream->unique = (unsigned int *)malloc((size_t)corners * sizeof(unsigned int));
+    stream->span = (Vec3 *)malloc(STREAM_SPAN * sizeof(Vec3));
+    if (!stream->chunk || !stream->keys || !stream->sorted || !stream->unique || !stream->span ||
+            -1 == bounds(stream)) {
+        streamClose(stream);
+        return NULL;
+    }
+    // empty until the first chunk, maps may be loaded on it before that
+    stream->chunk->nvert = stream->chunk->ntext = stream->chunk->nnorm = stream->chunk->nface = 0;
+    return stream;
+}
+
+/* LSD radix sort on the upper 32 bits, stable so equal indices keep corner order */
+static uint64_t * sortKeys(uint64_t *keys, uint64_t *tmp, size_t n)
+{
+    int shift;
+    for (shift = 32; shift < 64; shift += 8) {
+        size_t counts[257] = { 0 };
+        size_t i;
+        for (i = 0; i < n; ++i) {
+            ++counts[((keys[i] >> shift) & 0xff) + 1];
+        }
+        if (counts[((keys[0] >> shift) & 0xff) + 1] == n) {
+            continue; // every key has the same byte here
+        }
+        for (i = 1; i < 257; ++i) {
+            counts[i] += counts[i - 1];
+        }
+        for (i = 0; i < n; ++i) {
+            tmp[counts[(keys[i] >> shift) & 0xff]++] = keys[i];
+        }
+        uint64_t *t = keys;
+        keys = tmp;
+        tmp = t;
+    }
+    return keys;
+}
+
+/*
+ * Reads the entries of one section used by the chunk faces into `values`
+ * and rewrites corner `corner` of every face to index them. Neighbouring
+ * indices are read together, through the gaps between them if small.
+ */
+static int gather(meshStream *stream, int corner, int section, unsigned int total, Vec3 *values, unsigned int *count)
+{
+    Model *chunk = stream->chunk;
+    unsigned int *u = stream->unique;
+    size_t n = 0, i;
+    unsigned int j, k;
+    if (!total) {
+        // no such section, e.g. no normals: the corners aren't looked at
+        *count = 0;
+        return 0;
+    }
+    for (i = 0; i < chunk->nface; ++i) {
+        for (k = corner; k < 9; k += 3) {
+            if (chunk->faces[i][k] >= total) {
+                return -1;
+            }
+            stream->keys[n] = (uint64_t)chunk->faces[i][k] << 32 | (i * 9 + k);
+            ++n;
+        }
+    }
+    if (!n) {
+        *count = 0;
+        return 0;
+    }
+    // renumber in index order while the sorted keys say which corners to rewrite
+    uint64_t *sorted = sortKeys(stream->keys, stream->sorted, n);
+    unsigned int m = 0;
+    unsigned int *corners = &chunk->faces[0][0];
+    for (i = 0; i < n; ++i) {
+        unsigned int index = sorted[i] >> 32;
+        if (!m || index != u[m - 1]) {
+            u[m++] = index;
+        }
+        corners[sorted[i] & 0xffffffffu] = m - 1;
+    }
+
+    for (i = 0; i < m; i = j) {
+        unsigned int start = u[i];
+        for (j = i + 1; j < m && u[j] - u[j - 1] <= STREAM_GAP && u[j] - start < STREAM_SPAN; ++j)
+            ;
+        unsigned int len = u[j - 1] - start + 1;
+        if (-1 == readAt(stream->fd, stream->span, (size_t)len * sizeof(Vec3),
+                         stream->offsets[section] + (off_t)start * sizeof(Vec3))) {
+            return -1;
+        }
+        for (k = i; k < j; ++k) {
+            memcpy(values[k], stream->span[u[k] - start], sizeof(Vec3));
+        }
+    }
+    *count = m;
+    return 0;
+}
+
+Model * streamNext(meshStream *stream)
+{
+    Model *chunk = stream->chunk;
+    meshHeader *h = &stream->header;
+    if (stream->error || stream->next_face >= h->nface) {
+        return NULL;
+    }
+    unsigned int n = h->nface - stream->next_face;
+    if (n > stream->chunk_faces) {
+        n = stream->chunk_faces;
+    }
+    if (-1 == readAt(stream->fd, chunk->faces, (size_t)n * sizeof(Face),
+                     stream->offsets[SECTION_FACE] + (off_t)stream->next_face * sizeof(Face))) {
+        stream->error = 1;
+        return NULL;
+    }
+    chunk->nface = n;
+    stream->next_face += n;
+    if (-1 == gather(stream, 0, SECTION_VERTEX, h->nvert, chunk->vertices, &chunk->nvert) ||
+        -1 == gather(stream, 1, SECTION_TEXTURE, h->ntext, chunk->textures, &chunk->ntext) ||
+        -1 == gather(stream, 2, SECTION_NORMAL, h->nnorm, chunk->normals, &chunk->nnorm)) {
+        stream->error = 1;
+        return NULL;
+    }
+    if (chunk->normal_map && -1 == computeTangents(chunk)) {
+        stream->error = 1;
+        return NULL;
+    }
+    return chunk;
+}
+
+void streamRewind(meshStream *stream)
+{
+    assert(stream);
+    stream->next_face = 0;
+    stream->error = 0;
+}
+
+void streamClose(meshStream *stream)
+{
+    if (!stream) {
+        return;
+    }
+    if (stream->chunk) {
+        freeModel(stream->chunk);
+    }
+    free(stream->keys);
+    free(stream->sorted);
+    free(stream->unique);
+    free(stream->span);
+    if (stream->fd >= 0) {
+        close(stream->fd);
+    }
+    free(stream);
+}
@@ -0,0 +1,43 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "model.h"
+
+#define STREAM_CHUNK_FACES 65536 // default faces per chunk
+#define STREAM_GAP 64            // unused entries read through to merge two reads
+#define STREAM_SPAN 4096         // largest single read, in entries
+
+/*
+ * Walks a binary mesh in chunks of faces without loading it. Every chunk
+ * is a small Model holding only the vertices, uvs and normals its faces
+ * use, renumbered locally, so memory stays bounded by the chunk size
+ * however large the file is. Obj files go through convertObjToMesh first.
+ */
+typedef struct meshStream {
+    int fd;
+    meshHeader header;
+    off_t offsets[4];         // vertices, textures, normals, faces
+    unsigned int chunk_faces;
+    unsigned int next_face;
+    Model *chunk;             // reused, sized for the largest chunk; maps set here stay across chunks
+    uint64_t *keys;           // 3 * chunk_faces, index << 32 | corner of one attribute
+    uint64_t *sorted;         // 3 * chunk_faces, radix sort buffer
+    unsigned int *unique;     // 3 * chunk_faces, sorted indices of one attribute
+    Vec3 *span;               // STREAM_SPAN entries read at once
+    Vec3 lo, hi;              // bounds of every position, for renderFitDepth
+    int error;                // set when streamNext stopped on a read or index error
+} meshStream;
+
+meshStream * streamOpen(const char *filename, unsigned int chunk_faces);
+
+// next chunk, valid until the next call; NULL at the end or on error
+Model * streamNext(meshStream *stream);
+
+// back to the first chunk, to draw the mesh again
+void streamRewind(meshStream *stream);
+
+void streamClose(meshStream *stream);
+
+#endif // STREAM_H_
@@ -42,8 +42,6 @@ unsigned char Green(tgaColor c)
     return c >> 8;
 }
 
-static int loadRLE(tgaImage *, FILE *);
-
 tgaImage * tgaNewImage(unsigned int height, unsigned int width, int format)
 {
     assert(height && width); /* both must be greater then zero */
@@ -103,23 +101,14 @@ tgaColor tgaGetPixel(tgaImage *image, unsigned int x, unsigned int y)
     return color; 
 }
 
-int tgaSaveToFile(tgaImage *image, const char *filename)
+int tgaWriteHeader(tgaImage *image, FILE *fd, int rle)
 {
     assert(image);
-    assert(filename);
-
-    FILE *fd = fopen(filename, "wb");
-    if (!fd) {
-        return -1;
-    }
-    char new_tga_format_signature[] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
-    unsigned char extension_offset[] = { 0, 0, 0, 0};
-    unsigned char developer_offset[] = { 0, 0, 0, 0};
-
+    assert(fd);
     struct tgaHeader header;
     header.id_len = 0;
     header.color_map_type = 0; /* without ColorMap */ 
-    header.image_type = (image->bpp == GRAYSCALE) ? 3 : 2;
+    header.image_type = ((image->bpp == GRAYSCALE) ? 3 : 2) + (rle ? 8 : 0);
     header.color_map_idx = 0;
     header.color_map_len = 0;
     header.color_map_bpp = 0;
@@ -129,39 +118,79 @@ int tgaSaveToFile(tgaImage *image, const char *filename)
     header.image_height = image->height;
     header.image_bpp = image->bpp << 3;
     header.image_descriptor = 0x20; /* top-left origin */
+    return 1 == fwrite(&header, sizeof(header), 1, fd) ? 0 : -1;
+}
 
-    int rv = 0;
-    do {
-        if (-1 == fwrite(&header, sizeof(header), 1, fd)) {
-            rv = -1;
-            break;
-        }
-
-        unsigned int data_size = image->height * image-> width * image->bpp;
-        if (-1 == fwrite(image->data, data_size, 1, fd)) {
-            rv = -1;
-            break;
-        }
-
-        if (-1 == fwrite(extension_offset, sizeof(extension_offset), 1, fd)) {
-            rv = -1;
-            break;
-        }
-
-        if (-1 == fwrite(developer_offset, sizeof(developer_offset), 1, fd)) {
-            rv = -1;
-            break;
-        }
+int tgaWriteFooter(FILE *fd)
+{
+    assert(fd);
+    char new_tga_format_signature[] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+    unsigned char extension_offset[] = { 0, 0, 0, 0};
+    unsigned char developer_offset[] = { 0, 0, 0, 0};
+    if (1 != fwrite(extension_offset, sizeof(extension_offset), 1, fd) ||
+        1 != fwrite(developer_offset, sizeof(developer_offset), 1, fd) ||
+        1 != fwrite(new_tga_format_signature, sizeof(new_tga_format_signature), 1, fd)) {
+        return -1;
+    }
+    return 0;
+}
 
-        if (-1 == fwrite(new_tga_format_signature, sizeof(new_tga_format_signature), 1, fd)) {
-            rv = -1;
-            break;
+size_t tgaEncodeRLE(tgaImage *image, unsigned int first, unsigned int rows, unsigned char *out)
+{
+    assert(image);
+    assert(first + rows <= image->height);
+    unsigned int bpp = image->bpp;
+    unsigned char *start = out;
+    unsigned int j;
+    for (j = first; j < first + rows; ++j) {
+        const unsigned char *row = image->data + (size_t)j * image->width * bpp;
+        unsigned int x = 0;
+        while (x < image->width) {
+            const unsigned char *p = row + x * bpp;
+            unsigned int n = 1;
+            while (x + n < image->width && n < 128 && !memcmp(p, p + n * bpp, bpp)) {
+                ++n;
+            }
+            if (n > 1) {
+                *out++ = 0x80 | (n - 1);
+                memcpy(out, p, bpp);
+                out += bpp;
+            } else {
+                // raw up to the next pair of equal pixels
+                while (x + n < image->width && n < 128 &&
+                       !(x + n + 1 < image->width && !memcmp(p + n * bpp, p + (n + 1) * bpp, bpp))) {
+                    ++n;
+                }
+                *out++ = n - 1;
+                memcpy(out, p, n * bpp);
+                out += n * bpp;
+            }
+            x += n;
         }
+    }
+    return out - start;
+}
 
-    } while (0);
+int tgaSaveToFile(tgaImage *image, const char *filename)
+{
+    assert(image);
+    assert(filename);
 
-    fclose(fd);
-    return rv;;
+    FILE *fd = fopen(filename, "wb");
+    if (!fd) {
+        return -1;
+    }
+    int rv = 0;
+    size_t data_size = (size_t)image->height * image->width * image->bpp;
+    if (-1 == tgaWriteHeader(image, fd, 0) ||
+        1 != fwrite(image->data, data_size, 1, fd) ||
+        -1 == tgaWriteFooter(fd)) {
+        rv = -1;
+    }
+    if (EOF == fclose(fd)) {
+        rv = -1;
+    }
+    return rv;
 }
 
 tgaImage * tgaLoadFromFile(const char *filename)
@@ -224,19 +253,21 @@ void tgaFlipVertically(tgaImage *image)
 {
     assert(image);
     unsigned int bytes_per_line = image->width * image->bpp;
-    unsigned char *line = (unsigned char *)malloc(bytes_per_line);
-    assert(line);
+    unsigned char chunk[4096]; // lines are swapped piecewise, no heap buffer per call
     unsigned int half = image->height / 2;
     int j;
     for (j = 0; j < half; ++j) {
         // swap lines
-        unsigned int l1 = j * bytes_per_line;
-        unsigned int l2 = (image->height - 1 - j) * bytes_per_line;
-        memcpy(line, image->data + l1, bytes_per_line);
-        memmove(image->data + l1, image->data + l2, bytes_per_line);
-        memcpy(image->data + l2, line, bytes_per_line);
+        unsigned char *l1 = image->data + j * bytes_per_line;
+        unsigned char *l2 = image->data + (image->height - 1 - j) * bytes_per_line;
+        unsigned int k;
+        for (k = 0; k < bytes_per_line; k += sizeof(chunk)) {
+            unsigned int n = bytes_per_line - k < sizeof(chunk) ? bytes_per_line - k : sizeof(chunk);
+            memcpy(chunk, l1 + k, n);
+            memcpy(l1 + k, l2 + k, n);
+            memcpy(l2 + k, chunk, n);
+        }
     }
-    free(line);
 }
 
 void tgaFlipHorizontally(tgaImage *image)
@@ -1,6 +1,8 @@
 #ifndef TGA_H_
 #define TGA_H_
 
+#include <stdio.h>
+
 #define TRUE_COLOR_BPP 4 /* R + B + G + A */
 
 typedef struct tgaImage_t {
@@ -36,8 +38,22 @@ tgaColor tgaGetPixel(tgaImage *, unsigned int x, unsigned int y);
 
 int tgaSaveToFile(tgaImage *, const char *filename);
 
+/* pieces of tgaSaveToFile for other writers, rle selects the compressed image types */
+int tgaWriteHeader(tgaImage *, FILE *, int rle);
+int tgaWriteFooter(FILE *);
+
+/*
+ * RLE packets for rows [first, first + rows) into out, which must hold
+ * rows * width * (bpp + 1) bytes. Packets never cross a row, so row
+ * ranges encoded apart can be written one after another. Returns bytes.
+ */
+size_t tgaEncodeRLE(tgaImage *, unsigned int first, unsigned int rows, unsigned char *out);
+
 tgaImage * tgaLoadFromFile(const char *filename);
 
+/* decodes RLE pixel data of an already allocated image, stream must point right after the header */
+int loadRLE(tgaImage *, FILE *);
+
 void tgaFlipVertically(tgaImage *);
 
 void tgaFlipHorizontally(tgaImage *);
@@ -0,0 +1,230 @@
+#include "wire.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+modelEdges * wireEdges(Model *model)
+{
+    unsigned int i, k;
+    modelEdges *edges = (modelEdges *)malloc(sizeof(modelEdges));
+    // edges bucketed by their smaller end, compressed rows
+    unsigned int *offsets = (unsigned int *)calloc(model->nvert + 1, sizeof(unsigned int));
+    unsigned int *other = (unsigned int *)malloc(((size_t)3 * model->nface + 1) * sizeof(unsigned int));
+    unsigned int *seen = (unsigned int *)calloc(model->nvert + 1, sizeof(unsigned int));
+    if (!edges || !offsets || !other || !seen) {
+        goto fail;
+    }
+    for (i = 0; i < model->nface; ++i) {
+        for (k = 0; k < 3; ++k) {
+            unsigned int a = model->faces[i][3 * k];
+            unsigned int b = model->faces[i][3 * ((k + 1) % 3)];
+            if (a != b) {
+                ++offsets[(a < b ? a : b) + 1];
+            }
+        }
+    }
+    for (i = 0; i < model->nvert; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+    unsigned int total = offsets[model->nvert];
+    // fill from the back so every row ends up in face order
+    for (i = model->nface; i-- > 0;) {
+        for (k = 3; k-- > 0;) {
+            unsigned int a = model->faces[i][3 * k];
+            unsigned int b = model->faces[i][3 * ((k + 1) % 3)];
+            if (a != b) {
+                unsigned int lo = a < b ? a : b;
+                other[--offsets[lo + 1]] = a < b ? b : a;
+            }
+        }
+    }
+    // offsets[v + 1] now holds the start of row v, shift back
+    memmove(offsets, offsets + 1, model->nvert * sizeof(unsigned int));
+    offsets[model->nvert] = total;
+
+    edges->vert = (unsigned int (*)[2])malloc(((size_t)total + 1) * sizeof(*edges->vert));
+    if (!edges->vert) {
+        goto fail;
+    }
+    edges->count = 0;
+    for (i = 0; i < model->nvert; ++i) {
+        unsigned int j;
+        for (j = offsets[i]; j < offsets[i + 1]; ++j) {
+            // seen[b] holds the last row that listed b, plus one
+            if (seen[other[j]] != i + 1) {
+                seen[other[j]] = i + 1;
+                edges->vert[edges->count][0] = i;
+                edges->vert[edges->count][1] = other[j];
+                ++edges->count;
+            }
+        }
+    }
+    free(offsets);
+    free(other);
+    free(seen);
+    return edges;
+
+fail:
+    free(edges);
+    free(offsets);
+    free(other);
+    free(seen);
+    return NULL;
+}
+
+void wireFreeEdges(modelEdges *edges)
+{
+    if (edges) {
+        free(edges->vert);
+        free(edges);
+    }
+}
+
+/* Liang-Barsky against [x0, x1] x [y0, y1], 0 when nothing is left */
+static int clipLine(const int clip[4], double *ax, double *ay, double *az, double *bx, double *by, double *bz)
+{
+    double dx = *bx - *ax, dy = *by - *ay;
+    double p[4] = { -dx, dx, -dy, dy };
+    double q[4] = { *ax - clip[0], clip[2] - *ax, *ay - clip[1], clip[3] - *ay };
+    double t0 = 0, t1 = 1;
+    int k;
+    for (k = 0; k < 4; ++k) {
+        if (p[k] == 0) {
+            if (q[k] < 0) {
+                return 0;
+            }
+            continue;
+        }
+        double t = q[k] / p[k];
+        if (p[k] < 0) {
+            if (t > t1) return 0;
+            if (t > t0) t0 = t;
+        } else {
+            if (t < t0) return 0;
+            if (t < t1) t1 = t;
+        }
+    }
+    if (t0 == 0 && t1 == 1) {
+        return 1;
+    }
+    double dz = *bz - *az;
+    double x = *ax, y = *ay, z = *az;
+    *bx = x + t1 * dx;
+    *by = y + t1 * dy;
+    *bz = z + t1 * dz;
+    *ax = x + t0 * dx;
+    *ay = y + t0 * dy;
+    *az = z + t0 * dz;
+    return 1;
+}
+
+/*
+ * Bresenham over the clipped span: the color pointer and the depth index
+ * advance by a fixed step along the major axis and by a row or a column
+ * when the error crosses over, no per pixel bounds checks or address math.
+ */
+static inline __attribute__((always_inline))
+void span(const shadeTarget *target, int x0, int y0, double z0, int x1, int y1, double z1, tgaColor color,
+          const depthBuffer *depth, double bias, const int format, const int tested, const int msaa)
+{
+    tgaImage *image = target->image;
+    const int ns = target->samples;
+    int dx = abs(x1 - x0), dy = abs(y1 - y0);
+    ptrdiff_t sx = x1 < x0 ? -1 : 1;
+    ptrdiff_t sy = y1 < y0 ? -(ptrdiff_t)image->width : (ptrdiff_t)image->width;
+    ptrdiff_t major = sx, minor = sy;
+    int dmajor = dx, dminor = dy;
+    if (dy > dx) {
+        major = sy;
+        minor = sx;
+        dmajor = dy;
+        dminor = dx;
+    }
+    // depth index, color byte and sample steps of both moves
+    const ptrdiff_t bpp = image->bpp;
+    const ptrdiff_t zmajor = major * ns, zminor = minor * ns;
+    const ptrdiff_t pmajor = major * bpp, pminor = minor * bpp;
+    size_t i = ((size_t)y0 * image->width + x0) * ns;
+    unsigned char *p = image->data + ((size_t)y0 * image->width + x0) * bpp;
+    tgaColor *s = msaa ? target->sample_colors + i : NULL;
+    const void *data = tested ? depth->data : NULL;
+    double z = z0 + bias;
+    double dz = dmajor ? (z1 - z0) / dmajor : 0;
+    int e = 2 * dminor - dmajor;
+    int n, k;
+    for (n = 0; n <= dmajor; ++n) {
+        if (!tested || depthTest(data, i, z, format)) {
+            if (msaa) {
+                for (k = 0; k < ns; ++k) {
+                    s[k] = color;
+                }
+            } else {
+                memcpy(p, &color, bpp);
+            }
+        }
+        if (e > 0) {
+            i += zminor;
+            p += pminor;
+            if (msaa) {
+                s += zminor;
+            }
+            e -= 2 * dmajor;
+        }
+        e += 2 * dminor;
+        i += zmajor;
+        p += pmajor;
+        if (msaa) {
+            s += zmajor;
+        }
+        z += dz;
+    }
+}
+
+#define SPAN(format) \
+    if (msaa) span(target, x0, y0, z0, x1, y1, z1, color, depth, bias, format, 1, 1); \
+    else span(target, x0, y0, z0, x1, y1, z1, color, depth, bias, format, 1, 0); \
+    break;
+
+unsigned int wireDraw(const shadeTarget *target, const modelEdges *edges, Vector *screen, const double *z,
+                      tgaColor color, const depthBuffer *depth)
+{
+    const int msaa = target->samples > 1;
+    const int format = depth ? depth->format : DEPTH_LEGACY;
+    double bias = depth ? WIRE_DEPTH_BIAS * depthSpan(depth) : 0;
+    unsigned int drawn = 0;
+    unsigned int j;
+    for (j = 0; j < edges->count; ++j) {
+        unsigned int a = edges->vert[j][0], b = edges->vert[j][1];
+        // depthValue leaves 0 for vertices behind the camera, legacy depth can't tell
+        if (format != DEPTH_LEGACY && (z[a] <= 0 || z[b] <= 0)) {
+            continue;
+        }
+        double ax = screen[a][0], ay = screen[a][1], az = z[a];
+        double bx = screen[b][0], by = screen[b][1], bz = z[b];
+        if (!clipLine(target->clip, &ax, &ay, &az, &bx, &by, &bz)) {
+            continue;
+        }
+        // rounding stays inside, the clip rectangle has integer bounds
+        int x0 = (int)floor(ax + 0.5), y0 = (int)floor(ay + 0.5);
+        int x1 = (int)floor(bx + 0.5), y1 = (int)floor(by + 0.5);
+        double z0 = az, z1 = bz;
+        ++drawn;
+        if (!depth) {
+            if (msaa) span(target, x0, y0, z0, x1, y1, z1, color, NULL, 0, DEPTH_LEGACY, 0, 1);
+            else span(target, x0, y0, z0, x1, y1, z1, color, NULL, 0, DEPTH_LEGACY, 0, 0);
+            continue;
+        }
+        switch (format) {
+        case DEPTH_LEGACY: SPAN(DEPTH_LEGACY)
+        case DEPTH_16:     SPAN(DEPTH_16)
+        case DEPTH_24:     SPAN(DEPTH_24)
+        case DEPTH_32:     SPAN(DEPTH_32)
+        case DEPTH_FLOAT:  SPAN(DEPTH_FLOAT)
+        }
+    }
+    STATS_ADD(CNT_EDGES_DRAWN, drawn);
+    return drawn;
+}
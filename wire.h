@@ -0,0 +1,38 @@
+#ifndef WIRE_H_
+#define WIRE_H_
+
+#include "model.h"
+#include "raster.h"
+#include "shade.h"
+#include "depth.h"
+
+// depth tested edges pass this fraction of the depth range behind the surface
+#define WIRE_DEPTH_BIAS 0.005
+
+/*
+ * Every edge of the mesh once, by position index with a < b. Faces that
+ * share an edge share one entry, so an overlay draws each line once and
+ * its pixels don't depend on face order.
+ */
+typedef struct modelEdges {
+    unsigned int count;
+    unsigned int (*vert)[2];
+} modelEdges;
+
+// NULL when out of memory
+modelEdges * wireEdges(Model *model);
+void wireFreeEdges(modelEdges *edges);
+
+/*
+ * Lines between projected vertices, clipped to target->clip with
+ * Liang-Barsky and stepped with pointers straight into the rows of the
+ * image, or into every sample of the pixel when multisampling. With depth
+ * a pixel is drawn when it is no more than WIRE_DEPTH_BIAS of the range
+ * behind what the buffer holds, so edges on visible faces show and hidden
+ * ones don't; the buffer is only read. Edges with an end behind the
+ * camera are skipped. Returns the number of edges drawn.
+ */
+unsigned int wireDraw(const shadeTarget *target, const modelEdges *edges, Vector *screen, const double *z,
+                      tgaColor color, const depthBuffer *depth);
+
+#endif // WIRE_H_